@@ -0,0 +1,39 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "cpu.h"
+#include "execute.h"
+#include "uart.h"
+
+// Bump whenever a change to the emulator can change the outcome of a run
+#define BATCH_CACHE_VERSION 2
+#define BATCH_QUANTUM 10000 // Instructions between UART receiver refills
+
+typedef struct {
+  const uint8_t *input; // Bytes fed to the UART receiver as it drains
+  size_t input_len;
+  uint64_t cycles;       // Instruction budget
+  const char *cache_dir; // Result cache directory, NULL for none
+} Batch_Job;
+
+typedef struct {
+  Stop_Reason reason;
+  int exit_code;   // Semihosting exit code, for STOP_EXIT
+  uint32_t R[16];
+  uint32_t xpsr;
+  uint64_t cycles;
+  uint8_t *output; // Transmitted UART bytes; release with batch_result_free()
+  size_t output_len;
+  bool cached;     // Replayed from the cache instead of run
+} Batch_Result;
+
+
+bool batch_run(CortexM0_CPU *cpu, Uart *uart, const Batch_Job *job, Batch_Result *result);
+void batch_result_free(Batch_Result *result);
+
+
+#endif // BATCH_H
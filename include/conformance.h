@@ -0,0 +1,57 @@
+#ifndef CONFORMANCE_H
+#define CONFORMANCE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CONFORMANCE_DEFAULT_RANDOM (1ull << 30) // Random operand pairs per operation
+#define CONFORMANCE_CHUNK 65536                 // Cases handed to a thread at a time
+#define CONFORMANCE_BATCH 1024                  // Cases compared at once
+
+// Handlers under test
+typedef enum {
+  CONF_ADD, // ADDS Rd, Rn, Rm
+  CONF_SUB, // SUBS Rd, Rn, Rm
+  CONF_CMP, // CMP Rn, Rm
+  CONF_AND, // ANDS Rdn, Rm
+  CONF_ORR, // ORRS Rdn, Rm
+  CONF_EOR, // EORS Rdn, Rm
+  CONF_TST, // TST Rn, Rm
+  CONF_LSL, // LSLS Rd, Rm, #imm5
+  CONF_LSR, // LSRS Rd, Rm, #imm5
+  CONF_OPS
+} Conf_Op;
+
+typedef struct {
+  uint64_t random_cases;    // Random operand pairs per operation, after the exhaustive space
+  uint64_t seed;            // Same seed, same cases, whatever the thread count
+  unsigned threads;         // 0 = one per online host CPU
+  unsigned exhaustive_bits; // Operand bits swept exhaustively (1-16), 0 = all 16
+} Conformance_Config;
+
+/*
+ * Outcome of one operation. A case is two operands (the second is the
+ * shift amount for shifts), the incoming N, Z, C and V flags and the
+ * incoming destination register; its outcome is the destination register
+ * and NZCV (bit 3 = N ... bit 0 = V) afterwards.
+ */
+typedef struct {
+  uint64_t cases;
+  uint64_t mismatches;
+  // First mismatch found (not necessarily the lowest case index)
+  uint32_t a, b;
+  uint8_t nzcv_in;
+  uint32_t expected, got;
+  uint8_t expected_nzcv, got_nzcv;
+} Conformance_Report;
+
+
+void arm_add_with_carry(uint32_t x, uint32_t y, bool carry_in, uint32_t *result, bool *carry_out,
+                        bool *overflow);
+const char *conformance_op_name(Conf_Op op);
+bool conformance_run(const Conformance_Config *config, Conformance_Report report[CONF_OPS]);
+void print_conformance_report(const Conformance_Report report[CONF_OPS]);
+
+
+#endif // CONFORMANCE_H
@@ -0,0 +1,87 @@
+#ifndef COSIM_H
+#define COSIM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "mcu.h"
+#include "uart.h"
+
+#define COSIM_MAX_NODES 64
+#define COSIM_MAX_PORTS 4          // Links into / out of one node
+#define COSIM_LINK_SLOTS 8192      // Frames per link, must be a power of two
+#define COSIM_DEFAULT_LATENCY 4000 // Cycles from a DR write to delivery at the peer
+
+// Placement flags for cosim_set_placement(), applied to parallel runs
+#define COSIM_PIN 1          // Pin each node's thread to one host CPU
+#define COSIM_LOCAL_MEMORY 2 // Move each node's memory to its CPU's NUMA node (implies COSIM_PIN)
+#define COSIM_HUGE_PAGES 4   // Transparent huge pages for regions of HUGE_PAGE_SIZE or more
+
+/*
+ * A byte in flight on a serial link, stamped with the receiver cycle at
+ * which it arrives.
+ */
+typedef struct {
+  uint64_t time;
+  uint8_t byte;
+} Cosim_Frame;
+
+/*
+ * One-way link: lock-free single-producer/single-consumer ring of frames.
+ * The sending node's thread is the producer, the receiving node's the consumer.
+ */
+typedef struct {
+  _Alignas(64) _Atomic size_t head;
+  _Alignas(64) _Atomic size_t tail;
+  _Alignas(64) uint64_t latency;
+  uint64_t dropped; // Frames lost because the link was full (producer side)
+  Cosim_Frame slots[COSIM_LINK_SLOTS];
+} Cosim_Link;
+
+typedef struct {
+  Mcu *mcu;
+  Uart uart;
+  uint32_t index;
+  Cosim_Link *out[COSIM_MAX_PORTS]; // Every transmitted byte goes to all of these
+  uint32_t out_count;
+  Cosim_Link *in[COSIM_MAX_PORTS];  // Merged into the UART receiver
+  uint32_t in_count;
+  uint64_t quantum_end;             // First cycle of the next time window
+  bool halted;                      // Stopped; no longer executes
+  int cpu;                          // Host CPU the thread is pinned to, -1 if it floats
+  Stop_Reason reason;               // Why the node halted
+  uint64_t late;                    // Deliveries put off to the next window: event table full
+  struct Cosim *sim;
+  pthread_t thread;
+} Cosim_Node;
+
+typedef struct Cosim {
+  Cosim_Node *nodes;
+  uint32_t node_count;
+  Cosim_Link *links[COSIM_MAX_NODES * COSIM_MAX_PORTS];
+  uint32_t link_count;
+  uint64_t quantum; // Smallest link latency
+  uint64_t now;     // Cycle every node has reached
+  uint64_t end_cycle;
+  pthread_barrier_t barrier;
+  _Atomic int start_gate; // 0 = wait, 1 = run, -1 = abort
+  unsigned placement;      // COSIM_* placement flags
+  bool placed;             // Placement applied (before the first parallel run)
+  bool unbound;            // The kernel refused COSIM_LOCAL_MEMORY for some node
+} Cosim;
+
+
+bool cosim_init(Cosim *sim, uint32_t node_count, uint32_t uart_base);
+bool cosim_init_config(Cosim *sim, uint32_t node_count, uint32_t uart_base, const Mcu_Config *config);
+void cosim_destroy(Cosim *sim);
+bool cosim_connect(Cosim *sim, uint32_t from, uint32_t to, uint64_t latency);
+bool cosim_load_image(Cosim *sim, uint32_t node, const void *image, uint32_t len);
+bool cosim_load_shared(Cosim *sim, const Flash_Image *image);
+bool cosim_load_token_ring(Cosim *sim);
+void cosim_set_placement(Cosim *sim, unsigned flags);
+bool cosim_run(Cosim *sim, uint64_t cycles, bool parallel);
+
+
+#endif // COSIM_H
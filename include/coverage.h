@@ -0,0 +1,86 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Bits of a halfword's nibble in the coverage map
+#define COV_EXEC 1      // An instruction starting here was executed
+#define COV_TAKEN 2     // Bcond here was taken
+#define COV_NOT_TAKEN 4 // Bcond here fell through
+
+#define COV_HALFWORDS_PER_WORD 16
+#define COVERAGE_HEADER "VMCUCOV1"
+
+/*
+ * Instruction and branch coverage of an instance's Flash.
+ *
+ * Each Flash halfword has a nibble in map, so a basic block of up to 16
+ * halfwords (and the outcome of the Bcond that ends it) is usually one OR
+ * into one word. The run loop does not touch the map per instruction: it
+ * tracks the start of the current straight-line block in registers and
+ * records the whole block when control leaves it (a taken branch, a Bcond,
+ * an exception or the end of cpu_run()).
+ *
+ * Maps of instances running the same image can be merged with a plain OR
+ * (coverage_merge()), and are stored as COVERAGE_HEADER, the Flash base and
+ * size, then the map.
+ */
+typedef struct Coverage {
+  uint64_t *map;
+  size_t words;        // flash_size / 2 / COV_HALFWORDS_PER_WORD, rounded up
+  uint32_t flash_base;
+  uint32_t flash_size;
+  uint32_t entry, next; // Block in progress between runs: [entry, next)
+} Coverage;
+
+/**
+ * @brief Records that the instructions in [start, end) were executed.
+ *
+ * Inlined into the run loop, which calls it once per block.
+ *
+ * @param outcome COV_TAKEN or COV_NOT_TAKEN if the block ends with a Bcond
+ *                at end - 2, otherwise 0.
+ */
+static inline void coverage_block(Coverage *c, uint32_t start, uint32_t end, uint32_t outcome)
+{
+  uint32_t first = (start - c->flash_base) >> 1;
+  uint32_t last = (end - c->flash_base) >> 1; // Exclusive
+  uint32_t limit = c->flash_size >> 1;
+  if (first >= limit || end <= start) // Code outside Flash is not covered
+  {
+    return;
+  }
+  if (last > limit)
+  {
+    last = limit;
+    outcome = 0;
+  }
+  for (uint32_t h = first; h < last;)
+  {
+    uint32_t w = h / COV_HALFWORDS_PER_WORD;
+    uint32_t stop = (w + 1) * COV_HALFWORDS_PER_WORD;
+    stop = stop < last ? stop : last;
+    uint64_t mask = (0x1111111111111111ull >> ((COV_HALFWORDS_PER_WORD - (stop - h)) * 4))
+                    << ((h % COV_HALFWORDS_PER_WORD) * 4);
+    if (stop == last)
+    {
+      mask |= (uint64_t)outcome << (((last - 1) % COV_HALFWORDS_PER_WORD) * 4);
+    }
+    c->map[w] |= mask;
+    h = stop;
+  }
+}
+
+
+bool coverage_start(void);
+void coverage_stop(void);
+void coverage_invalidate(Coverage *c, uint32_t start, uint32_t end);
+void coverage_merge(uint64_t *dst, const uint64_t *src, size_t words);
+bool coverage_save(const char *path);
+bool coverage_lcov(const char *cov_path, const char *elf_path, FILE *out);
+
+
+#endif // COVERAGE_H
@@ -20,6 +20,15 @@ typedef enum {
 #define C_MASK (1<<29)
 #define V_MASK (1<<28)
 
+// Per-instruction debug output, compiled out unless built with -DTRACE_EXECUTION
+#ifdef TRACE_EXECUTION
+#define TRACE(...) printf(__VA_ARGS__)
+#else
+#define TRACE(...) ((void)0)
+#endif
+
+#define HARDFAULT 3
+
 
 // Application Program Status Register (Flags)
 typedef struct{
@@ -40,6 +49,9 @@ typedef union {
 typedef struct {
     uint32_t R[16];  // General-purpose registers (R0-R15)
     APSR_t APSR;     // Application Program Status Register (Flags)
+    uint8_t exception_pending; // Pending exception number (0 = none)
+    uint8_t ipsr;    // Active exception number (0 = Thread mode)
+    uint64_t cycles; // Cycles executed since reset
 } CortexM0_CPU;
 
 
@@ -49,7 +61,10 @@ typedef struct {
 
 
 void init_cpu(CortexM0_CPU *cpu);
+void cpu_reset(CortexM0_CPU *cpu);
 void print_cpu_state(CortexM0_CPU *cpu);
+uint32_t get_xpsr(CortexM0_CPU *cpu);
+void set_xpsr(CortexM0_CPU *cpu, uint32_t xpsr);
 void update_flags(CortexM0_CPU *cpu, uint32_t result, _Bool carry, _Bool overflow);
 
 void STR(CortexM0_CPU *cpu, uint8_t Rt, uint8_t Rn, uint8_t Rm);
@@ -62,6 +77,10 @@ void LDRB(CortexM0_CPU *cpu, uint8_t Rt, uint8_t Rn, uint8_t Rm);
 void LDRSB(CortexM0_CPU *cpu, uint8_t Rt, uint8_t Rn, uint8_t Rm);
 void PUSH(CortexM0_CPU *cpu, uint32_t value);
 uint32_t POP(CortexM0_CPU *cpu);
+void PUSH_LIST(CortexM0_CPU *cpu, uint16_t reglist);
+void POP_LIST(CortexM0_CPU *cpu, uint16_t reglist);
+void STM(CortexM0_CPU *cpu, uint8_t Rn, uint16_t reglist);
+void LDM(CortexM0_CPU *cpu, uint8_t Rn, uint16_t reglist);
 
 void MOVS(CortexM0_CPU *cpu, uint8_t Rd, uint8_t imm8);
 void MOVS_REG(CortexM0_CPU *cpu, uint8_t Rd, uint8_t Rm);
@@ -69,6 +88,9 @@ void MOVS_REG(CortexM0_CPU *cpu, uint8_t Rd, uint8_t Rm);
 void LSL(CortexM0_CPU *cpu, uint8_t Rd, uint8_t Rm,uint32_t immediate);
 void LSR(CortexM0_CPU *cpu, uint8_t Rd, uint8_t Rm,uint32_t immediate);
 
+void exception_entry(CortexM0_CPU *cpu, uint8_t exception_number);
+void exception_return(CortexM0_CPU *cpu);
+
 void raise_hardfault(CortexM0_CPU *cpu);
 void check_Rt_validity(uint8_t Rt, const char *instruction_name);
 
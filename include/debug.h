@@ -0,0 +1,34 @@
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+#include "memory_file.h"
+
+#define MAX_WATCHPOINTS 16
+
+// Breakpoints: one bit per halfword of backing memory
+#define BP_BITMAP_BYTES(memory_size) (((memory_size) / 2 + 7) / 8)
+#define BP_BITMAP_SIZE BP_BITMAP_BYTES(MEMORY_SIZE) // Default layout
+
+typedef struct {
+  uint32_t addr;
+  uint32_t len;
+} Watchpoint;
+
+
+bool breakpoint_set(uint32_t addr);
+bool breakpoint_clear(uint32_t addr);
+void breakpoints_clear_all(void);
+
+bool watchpoint_set(uint32_t addr, uint32_t len);
+bool watchpoint_clear(uint32_t addr);
+void watchpoints_clear_all(void);
+void watch_check(uint32_t addr, uint32_t size);
+
+void print_debug_points(void);
+
+
+#endif // DEBUG_H
@@ -0,0 +1,54 @@
+#ifndef DMA_H
+#define DMA_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DMA_DEFAULT_BASE 0x40020000
+#define DMA_CHANNELS 4
+#define DMA_CHANNEL_STRIDE 0x10
+#define DMA_REG_SIZE 0x50
+
+// Per-channel register offsets (channel n at n * DMA_CHANNEL_STRIDE)
+#define DMA_CCR   0x00 // Control
+#define DMA_CSRC  0x04 // Source address
+#define DMA_CDST  0x08 // Destination address
+#define DMA_CCNT  0x0C // Number of beats
+// Shared registers
+#define DMA_ISR   0x40 // Bit n: channel n complete, bit n+8: channel n error
+#define DMA_IFCR  0x44 // Write 1 to clear the matching ISR bit
+
+// DMA_CCR bits
+#define DMA_CCR_EN    (1 << 0)
+#define DMA_CCR_TCIE  (1 << 1) // Raise the channel interrupt on completion
+#define DMA_CCR_SIZE_SHIFT 2   // Beat size: 0 = byte, 1 = halfword, 2 = word
+#define DMA_CCR_SIZE_MASK (3 << DMA_CCR_SIZE_SHIFT)
+
+#define DMA_IRQ_BASE 9          // Channel n raises external interrupt DMA_IRQ_BASE + n
+#define DMA_CYCLES_PER_BEAT 2   // One bus read and one bus write per beat
+#define DMA_SETUP_CYCLES 4      // Arbitration and address setup before the first beat
+
+struct Dma;
+
+typedef struct {
+  uint32_t ccr;
+  uint32_t src;
+  uint32_t dst;
+  uint32_t count;
+  struct Dma *dma; // Owning controller, for the completion event
+  uint32_t index;
+} Dma_Channel;
+
+typedef struct Dma {
+  uint32_t base;
+  Dma_Channel ch[DMA_CHANNELS];
+  uint32_t isr;
+} Dma;
+
+
+bool dma_init(Dma *dma, uint32_t base);
+void dma_remove(Dma *dma);
+
+
+#endif // DMA_H
@@ -0,0 +1,28 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MAX_EVENTS 16
+#define NO_EVENT UINT64_MAX
+
+typedef void (*Event_Handler)(void *ctx, uint64_t now);
+
+typedef struct {
+  uint64_t when;
+  Event_Handler handler;
+  void *ctx;
+} Event;
+
+
+void events_bind_clock(const uint64_t *cycles);
+uint64_t event_now(void);
+bool event_schedule(uint64_t when, Event_Handler handler, void *ctx);
+void event_cancel(Event_Handler handler, void *ctx);
+void events_run(uint64_t now);
+void events_clear(void);
+
+
+#endif // EVENTS_H
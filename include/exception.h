@@ -1,12 +1,20 @@
 #ifndef EXCEPTION_H
 #define EXCEPTION_H
 #include <stdint.h>
+#include <stdbool.h>
 
 #define VECTOR_TABLE_SIZE 48
-extern uint32_t vector_table[];
+#define IRQ_BASE 16 // Exception number of external interrupt 0
+#define NUM_IRQS (VECTOR_TABLE_SIZE - IRQ_BASE)
+
+// LR value loaded on exception entry; branching to it performs the return
+#define EXC_RETURN_THREAD_MSP 0xFFFFFFF9
+#define EXC_RETURN_PREFIX 0xFFFFFFF0
 
 
 void load_vector_table(uint32_t *memory);
+void nvic_set_pending(uint32_t irq);
+void nvic_clear_pending(uint32_t irq);
 
 
-#endif // EXCEPTION_H
\ No newline at end of file
+#endif // EXCEPTION_H
@@ -0,0 +1,29 @@
+#ifndef EXECUTE_H
+#define EXECUTE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+
+#define RUN_FOREVER UINT64_MAX
+
+typedef enum {
+  STOP_NONE,       // Instruction budget exhausted
+  STOP_BREAKPOINT, // PC reached a breakpoint (instruction not executed)
+  STOP_WATCHPOINT, // A write hit a watchpoint (instruction completed)
+  STOP_HARDFAULT,  // Invalid access, bad PC or unimplemented instruction
+  STOP_BKPT,       // BKPT instruction executed
+  STOP_EXIT,       // Guest called semihosting SYS_EXIT
+  STOP_STACK_LIMIT, // A push would move SP below the stack limit (instruction not executed)
+} Stop_Reason;
+
+
+bool fetch16(CortexM0_CPU *cpu, uint16_t *instr);
+Stop_Reason execute_instruction(CortexM0_CPU *cpu, uint16_t instr);
+Stop_Reason cpu_step(CortexM0_CPU *cpu);
+Stop_Reason cpu_run(CortexM0_CPU *cpu, uint64_t max_instructions);
+const char *stop_reason_name(Stop_Reason reason);
+
+
+#endif // EXECUTE_H
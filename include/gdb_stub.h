@@ -0,0 +1,19 @@
+#ifndef GDB_STUB_H
+#define GDB_STUB_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+
+#define GDB_PACKET_SIZE 0x4000  // Advertised to GDB through qSupported
+#define GDB_RUN_CHUNK 100000    // Instructions run between checks for Ctrl-C
+#define GDB_XPSR_REGNUM 25      // xPSR number in the m-profile target description
+
+
+int gdb_listen(const char *spec);
+int gdb_accept(int listen_fd);
+void gdb_serve(CortexM0_CPU *cpu, int fd);
+
+
+#endif // GDB_STUB_H
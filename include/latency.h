@@ -0,0 +1,58 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+#include "exception.h"
+
+// Bucket 0 holds 0 cycles, bucket k holds [2^(k-1), 2^k); the last one is open
+#define LATENCY_BUCKETS 33
+
+typedef struct {
+  uint32_t buckets[LATENCY_BUCKETS];
+  uint64_t count;
+  uint64_t total;
+  uint64_t worst;
+  uint32_t worst_pc; // PC interrupted in the worst case
+} Latency_Hist;
+
+/*
+ * Exception timing of one instance, in CPU cycles.
+ *
+ * Entry latency runs from the moment an interrupt became pending (0 for
+ * synchronous exceptions) to the first handler instruction and includes
+ * the stacking cost in entry_cycles. Return is not measured: without
+ * tail-chaining it always takes exactly return_cycles, which is only
+ * charged to the cycle counter. Both costs are 0 by default, so only
+ * instructions count.
+ */
+typedef struct {
+  uint32_t entry_cycles;
+  uint32_t return_cycles;
+  uint64_t pending_since[NUM_IRQS];
+  Latency_Hist entry[VECTOR_TABLE_SIZE];
+} Exc_Latency;
+
+typedef struct {
+  uint64_t count;
+  uint64_t mean;
+  uint64_t p50, p90, p99, p999; // Upper bound of the bucket holding the percentile
+  uint64_t worst;
+  uint32_t worst_pc;
+} Latency_Report;
+
+
+void latency_hist_add(Latency_Hist *h, uint64_t cycles, uint32_t pc);
+uint64_t latency_hist_percentile(const Latency_Hist *h, uint32_t per_mille);
+
+void latency_pending(uint32_t irq, uint64_t now);
+void latency_entry(CortexM0_CPU *cpu, uint8_t exception_number, uint32_t pc);
+void latency_return(CortexM0_CPU *cpu);
+void latency_reset(void);
+bool latency_report(uint8_t exception_number, Latency_Report *out);
+void print_latency_report(void);
+
+
+#endif // LATENCY_H
@@ -0,0 +1,22 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Byte-oriented LZ77 block codec (LZ4 block layout: a token with literal
+ * and match lengths, the literals, a 16-bit offset). Greedy single-probe
+ * matching keeps it fast enough to run behind the emulator on one core.
+ */
+
+// Largest compressed size of an n-byte block
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+
+size_t lz_compress(const uint8_t *src, size_t len, uint8_t *dst);
+bool lz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len);
+
+
+#endif // LZ_H
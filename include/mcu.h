@@ -0,0 +1,146 @@
+#ifndef MCU_H
+#define MCU_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+#include "memory_file.h"
+#include "exception.h"
+#include "events.h"
+#include "mmio.h"
+#include "debug.h"
+#include "semihosting.h"
+#include "stats.h"
+#include "stack_mon.h"
+#include "trace.h"
+#include "coverage.h"
+#include "latency.h"
+
+/*
+ * Complete state of one virtual MCU.
+ *
+ * Modules reach the selected instance through the thread-local `mcu`
+ * pointer, so several instances can run on different host threads (or be
+ * switched on one thread) without changing the instruction and memory APIs.
+ */
+typedef struct Mcu {
+  CortexM0_CPU cpu;
+
+  // Memory map (memory_file.c)
+  uint8_t *memory;
+  uint32_t memory_size;
+  Mem_Region regions[MEM_REGIONS];
+  bool mapped;         // memory and the tables below come from mmap()
+  uint8_t *page_flags; // memory_size >> PAGE_SHIFT entries
+  int numa_node;       // Preferred host NUMA node of the mappings, -1 for none (mcu_place())
+  bool huge_pages;     // Regions of HUGE_PAGE_SIZE or more use transparent huge pages
+
+  // Exceptions (exception.c)
+  uint32_t vector_table[VECTOR_TABLE_SIZE];
+  uint32_t nvic_pending; // Bit n = external interrupt n pending
+
+  // Peripheral events (events.c)
+  uint64_t next_event_cycle; // Earliest cycle at which the run loop calls events_run()
+  const uint64_t *event_clock;
+  Event events[MAX_EVENTS];
+  uint32_t event_count;
+
+  // Peripheral registers (mmio.c)
+  Mmio_Region mmio_regions[MAX_MMIO_REGIONS];
+  uint32_t mmio_count;
+
+  // Debugger (debug.c)
+  uint8_t *bp_bitmap; // BP_BITMAP_BYTES(memory_size), one bit per halfword
+  Watchpoint watchpoints[MAX_WATCHPOINTS];
+  uint32_t watchpoint_count;
+  bool watch_hit;
+  uint32_t watch_hit_addr;
+
+  // Semihosting (semihosting.c)
+  Semihost_File semihost_files[SEMIHOST_MAX_FILES];
+  int semihost_exit_code;
+  clock_t semihost_start_clock;
+  bool semihost_clock_started;
+  bool semihost_host_io; // A call other than SYS_EXIT used host files, console or clock
+
+  // Stack usage (stack_mon.c)
+  Stack_Monitor stack_mon;
+
+  // Exception latency histograms and stacking costs (latency.c)
+  Exc_Latency latency;
+
+  // Execution trace (trace.c)
+  Trace *trace;   // Running trace, if any
+  Trace *tracing; // Same as trace while cpu_run() executes, NULL otherwise
+
+  // Code coverage (coverage.c)
+  Coverage *coverage; // Collected coverage, if any
+
+#ifndef VMCU_NO_STATS
+  Mcu_Stats stats; // Cache-line aligned, written by the running thread only
+#endif
+} Mcu;
+
+/*
+ * Read-only Flash contents shared by every instance it is mapped into.
+ * Instances map it privately, so the host kernel copies a page for an
+ * instance only when that instance writes to it.
+ */
+typedef struct {
+  int fd;       // Sealed memfd, padded to a host page
+  uint32_t len; // Image size in bytes
+} Flash_Image;
+
+// Region sizes of a new instance (0 for the ext RAM leaves it unmapped)
+typedef struct {
+  uint32_t flash_size;
+  uint32_t sram_size;
+  uint32_t ext_ram_size; // Mapped at EXT_RAM_BASE
+} Mcu_Config;
+
+extern _Thread_local Mcu *mcu;
+
+// Host pointers to the start of the selected instance's regions
+#define Flash (mcu->memory + mcu->regions[REGION_FLASH].offset)
+#define SRAM (mcu->memory + mcu->regions[REGION_SRAM].offset)
+
+/**
+ * @brief Tests the breakpoint bit for a host pointer into an instance's memory.
+ *
+ * Used by the run loop on every fetch, so it is a single load and test.
+ */
+static inline bool breakpoint_hit(const Mcu *m, const uint8_t *p)
+{
+  uint32_t hw = (uint32_t)(p - m->memory) >> 1;
+  return m->bp_bitmap[hw >> 3] & (1 << (hw & 7));
+}
+
+/**
+ * @brief Records a guest memory access in the trace of a running instance.
+ */
+static inline void trace_access(bool write, uint32_t addr, uint32_t size, uint32_t value)
+{
+  if (__builtin_expect(mcu->tracing != NULL, 0))
+  {
+    trace_mem(mcu->tracing, write, addr, size, value);
+  }
+}
+
+
+void mcu_init(Mcu *m);
+Mcu *mcu_create(void);
+Mcu *mcu_create_config(const Mcu_Config *config);
+void mcu_destroy(Mcu *m);
+void mcu_select(Mcu *m);
+void mcu_clear_region(Mcu *m, Mem_Region_Id id);
+bool mcu_place(Mcu *m, int numa_node, bool huge_pages);
+bool mcu_bind_memory(void *p, size_t len, int numa_node);
+
+bool flash_image_create(Flash_Image *image, const void *data, uint32_t len);
+bool flash_image_load(Flash_Image *image, const char *path);
+void flash_image_release(Flash_Image *image);
+bool mcu_map_flash(Mcu *m, const Flash_Image *image);
+
+
+#endif // MCU_H
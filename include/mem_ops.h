@@ -0,0 +1,24 @@
+#ifndef MEM_OPS_H
+#define MEM_OPS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Bulk kernels on host memory, used by the guest block operations in
+ * memory_file.c and by coverage merging. On x86-64 they use SSE2, or AVX2
+ * when the host CPU has it (checked at run time, so the build does not need
+ * -mavx2); other hosts use the portable word-at-a-time versions.
+ */
+
+void mem_ops_fill32(uint8_t *p, uint32_t pattern, size_t len);
+size_t mem_ops_mismatch(const uint8_t *a, const uint8_t *b, size_t len);
+void mem_ops_or(uint8_t *dst, const uint8_t *src, size_t len);
+
+// Portable versions, always available (the benchmark compares against them)
+void mem_ops_fill32_scalar(uint8_t *p, uint32_t pattern, size_t len);
+size_t mem_ops_mismatch_scalar(const uint8_t *a, const uint8_t *b, size_t len);
+void mem_ops_or_scalar(uint8_t *dst, const uint8_t *src, size_t len);
+
+
+#endif // MEM_OPS_H
@@ -1,6 +1,5 @@
 
 
-
 #ifndef MEMORY_FILE_H
 #define MEMORY_FILE_H
 
@@ -8,28 +7,95 @@
 #include <stdint.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <string.h>
 #include "cpu.h"
 
 
-#define MEMORY_SIZE 56 // to be changed to 5KB
-#define Stack_size 12 // to be changed to 1KB
+#define FLASH_BASE 0x00000000
+#define FLASH_SIZE 1024         // Default size; see Mcu_Config
+#define SRAM_BASE 0x20000000
+#define SRAM_SIZE 2048          // Default size; see Mcu_Config
+#define EXT_RAM_BASE 0x60000000 // External RAM window, absent by default
+
+#define REGION_MAX_SIZE 0x20000000 // Keeps regions clear of each other and of peripherals
+#define MEMORY_MAX_SIZE 0x40000000 // Largest backing reservation of one instance
 
-#define FLASH_SIZE 1024
-#define SRAM_SIZE 2048
+// Regions start on a host page in the backing memory, so each can be
+// remapped on its own (shared Flash, fresh zero pages); Flash comes first
+#define HOST_PAGE_SIZE 4096
+#define HOST_PAGE_ALIGN(n) (((n) + HOST_PAGE_SIZE - 1) & ~(HOST_PAGE_SIZE - 1))
+#define HUGE_PAGE_SIZE 0x200000 // Transparent huge page on x86-64 and most arm64 hosts
+
+// Backing memory layout of the default instance
+#define FLASH_SPAN HOST_PAGE_ALIGN(FLASH_SIZE)
+#define MEMORY_SIZE (FLASH_SPAN + SRAM_SIZE)
 
 #define WORD_SIZE 4
 #define HALFWORD_SIZE 2
 #define BYTE_SIZE 1
 
-extern uint8_t Memory[MEMORY_SIZE];
-extern uint8_t Stack[Stack_size];
-extern uint8_t Flash[FLASH_SIZE];
-extern uint8_t SRAM[SRAM_SIZE];
-
-
-_Bool check_memory_bounds(uint32_t address, uint32_t size);
-void print_memory();
-void print_stack();
+// Backing memory is split into pages that carry debug flags
+#define PAGE_SHIFT 8
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+#define MEM_PAGES (MEMORY_SIZE >> PAGE_SHIFT)
+
+#define PAGE_WATCHED (1 << 0) // At least one watchpoint overlaps the page
+
+/*
+ * Guest memory is little-endian. These load and store one value at a host
+ * pointer with a single (unaligned-safe) access, byte-swapping only on a
+ * big-endian host.
+ */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define HOST_LE16(v) __builtin_bswap16(v)
+#define HOST_LE32(v) __builtin_bswap32(v)
+#else
+#define HOST_LE16(v) (v)
+#define HOST_LE32(v) (v)
+#endif
+
+static inline uint16_t host_load16(const uint8_t *p)
+{
+  uint16_t v;
+  memcpy(&v, p, sizeof(v));
+  return HOST_LE16(v);
+}
+
+static inline uint32_t host_load32(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return HOST_LE32(v);
+}
+
+static inline void host_store16(uint8_t *p, uint16_t v)
+{
+  v = HOST_LE16(v);
+  memcpy(p, &v, sizeof(v));
+}
+
+static inline void host_store32(uint8_t *p, uint32_t v)
+{
+  v = HOST_LE32(v);
+  memcpy(p, &v, sizeof(v));
+}
+
+typedef enum {
+  REGION_FLASH,
+  REGION_SRAM,
+  REGION_EXT_RAM,
+  MEM_REGIONS
+} Mem_Region_Id;
+
+// A guest address range backed by [offset, offset + size) of the instance's memory
+typedef struct {
+  uint32_t base;
+  uint32_t size; // 0 = not mapped
+  uint32_t offset;
+} Mem_Region;
+
+
+void print_memory(uint32_t addr, uint32_t len);
 
 bool mem_read8(uint32_t addr, uint8_t  *value);
 bool mem_read16(uint32_t addr, uint16_t *value);
@@ -40,8 +106,23 @@ bool mem_write16(uint32_t addr, uint16_t value);
 bool mem_write32(uint32_t addr, uint32_t value);
 
 uint8_t* translate_address(uint32_t addr);
+uint8_t* translate_range(uint32_t addr, uint32_t size);
+uint8_t* translate_guest(uint32_t addr, uint32_t size);
+uint8_t* translate_span(uint32_t addr, uint32_t *avail);
+uint8_t* translate_write(uint32_t addr, uint32_t size);
+uint8_t* translate_guest_write(uint32_t addr, uint32_t size);
+
+bool mem_read_block(uint32_t addr, void *buf, uint32_t len);
+bool mem_write_block(uint32_t addr, const void *buf, uint32_t len);
+bool mem_copy(uint32_t dst, uint32_t src, uint32_t len);
+bool mem_fill(uint32_t addr, uint32_t pattern, uint32_t len);
+bool mem_compare(uint32_t addr, const void *buf, uint32_t len, uint32_t *diff);
+
+bool load_binary(const char *path);
+bool reload_image(CortexM0_CPU *cpu, const void *image, uint32_t len, uint32_t *changed_pages);
+bool reload_binary(CortexM0_CPU *cpu, const char *path, uint32_t *changed_pages);
 
 
 
 
-#endif // MEMORY_FILE_H
\ No newline at end of file
+#endif // MEMORY_FILE_H
@@ -0,0 +1,30 @@
+#ifndef MMIO_H
+#define MMIO_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PERIPH_BASE 0x40000000
+#define MAX_MMIO_REGIONS 8
+
+// Register handlers receive the offset from the region base and the access size
+typedef bool (*Mmio_Read)(void *ctx, uint32_t offset, uint32_t size, uint32_t *value);
+typedef bool (*Mmio_Write)(void *ctx, uint32_t offset, uint32_t size, uint32_t value);
+
+typedef struct {
+  uint32_t base;
+  uint32_t size;
+  Mmio_Read read;
+  Mmio_Write write;
+  void *ctx;
+} Mmio_Region;
+
+
+bool mmio_register(uint32_t base, uint32_t size, Mmio_Read read, Mmio_Write write, void *ctx);
+void mmio_unregister(uint32_t base);
+bool mmio_read(uint32_t addr, uint32_t size, uint32_t *value);
+bool mmio_write(uint32_t addr, uint32_t size, uint32_t value);
+
+
+#endif // MMIO_H
@@ -0,0 +1,50 @@
+#ifndef PACING_H
+#define PACING_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+#include "execute.h"
+#include "latency.h"
+
+#define PACE_DEFAULT_HZ 48000000
+#define PACE_PERIOD_NS 100000    // Wall time covered by one batch
+#define PACE_MAX_LAG_NS 10000000 // Lag beyond this is dropped instead of caught up
+
+/*
+ * Runs an instance at a fixed core clock instead of as fast as possible.
+ *
+ * Instructions run in batches of `quantum`; after each one the thread sleeps
+ * with clock_nanosleep() until the absolute wall time at which the guest
+ * clock reaches the new cycle count. Deadlines come from a fixed origin, so
+ * wake-up errors do not accumulate. A batch that finishes late starts the
+ * next one at once, which catches up within a few batches; once the lag
+ * exceeds max_lag_ns (the host was descheduled or stopped) the origin moves
+ * to the present and the lost time is counted instead of replayed at full
+ * speed.
+ */
+typedef struct {
+  uint64_t hz;         // Guest core clock
+  uint64_t quantum;    // Instructions per batch
+  uint64_t max_lag_ns;
+  uint64_t origin_ns;  // Wall time at which the guest was at origin_cycles
+  uint64_t origin_cycles;
+
+  uint64_t batches;
+  uint64_t overruns;   // Batches that finished after their deadline
+  uint64_t overrun_max_ns;
+  uint64_t resyncs;    // Times the lag exceeded max_lag_ns
+  uint64_t dropped_ns; // Wall time given up by resyncs
+  Latency_Hist jitter; // Wake-up time past the deadline, in ns
+  uint64_t wall_ns;    // Wall and guest time covered by pacer_run() so far
+  uint64_t guest_ns;
+} Pacer;
+
+
+void pacer_init(Pacer *p, uint64_t hz);
+Stop_Reason pacer_run(Pacer *p, CortexM0_CPU *cpu, uint64_t max);
+void print_pacer_report(const Pacer *p);
+
+
+#endif // PACING_H
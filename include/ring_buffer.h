@@ -0,0 +1,132 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#define RING_SIZE 4096 // Must be a power of two
+#define RING_MASK (RING_SIZE - 1)
+
+/*
+ * Lock-free single-producer/single-consumer byte ring.
+ *
+ * head is only written by the producer and tail only by the consumer; each
+ * side publishes its index with a release store and reads the other side's
+ * index with an acquire load, so no locks or syscalls are needed.
+ */
+typedef struct {
+  _Alignas(64) _Atomic size_t head; // Next slot to write (producer)
+  _Alignas(64) _Atomic size_t tail; // Next slot to read (consumer)
+  _Alignas(64) uint8_t data[RING_SIZE];
+} Ring_Buffer;
+
+
+// Busy-wait hint for a producer waiting on a full ring
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+static inline void ring_init(Ring_Buffer *ring)
+{
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+}
+
+static inline size_t ring_used(Ring_Buffer *ring)
+{
+  return atomic_load_explicit(&ring->head, memory_order_acquire) -
+         atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+/**
+ * @brief Producer side: appends one byte.
+ *
+ * @return false if the ring is full.
+ */
+static inline bool ring_put(Ring_Buffer *ring, uint8_t byte)
+{
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == RING_SIZE)
+  {
+    return false;
+  }
+  ring->data[head & RING_MASK] = byte;
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return true;
+}
+
+/**
+ * @brief Consumer side: removes one byte.
+ *
+ * @return false if the ring is empty.
+ */
+static inline bool ring_get(Ring_Buffer *ring, uint8_t *byte)
+{
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  if (atomic_load_explicit(&ring->head, memory_order_acquire) == tail)
+  {
+    return false;
+  }
+  *byte = ring->data[tail & RING_MASK];
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+/**
+ * @brief Producer side: appends up to len bytes in at most two copies.
+ *
+ * @return Number of bytes appended.
+ */
+static inline size_t ring_write(Ring_Buffer *ring, const uint8_t *buf, size_t len)
+{
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t space = RING_SIZE - (head - atomic_load_explicit(&ring->tail, memory_order_acquire));
+  if (len > space)
+  {
+    len = space;
+  }
+  size_t first = RING_SIZE - (head & RING_MASK);
+  if (first > len)
+  {
+    first = len;
+  }
+  memcpy(&ring->data[head & RING_MASK], buf, first);
+  memcpy(ring->data, buf + first, len - first);
+  atomic_store_explicit(&ring->head, head + len, memory_order_release);
+  return len;
+}
+
+/**
+ * @brief Consumer side: removes up to len bytes in at most two copies.
+ *
+ * @return Number of bytes removed.
+ */
+static inline size_t ring_read(Ring_Buffer *ring, uint8_t *buf, size_t len)
+{
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  size_t avail = atomic_load_explicit(&ring->head, memory_order_acquire) - tail;
+  if (len > avail)
+  {
+    len = avail;
+  }
+  size_t first = RING_SIZE - (tail & RING_MASK);
+  if (first > len)
+  {
+    first = len;
+  }
+  memcpy(buf, &ring->data[tail & RING_MASK], first);
+  memcpy(buf + first, ring->data, len - first);
+  atomic_store_explicit(&ring->tail, tail + len, memory_order_release);
+  return len;
+}
+
+
+#endif // RING_BUFFER_H
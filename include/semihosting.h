@@ -0,0 +1,40 @@
+#ifndef SEMIHOSTING_H
+#define SEMIHOSTING_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "cpu.h"
+#include "execute.h"
+
+#define SEMIHOSTING_BKPT 0xAB
+
+// Operation numbers passed in R0
+#define SYS_OPEN   0x01
+#define SYS_CLOSE  0x02
+#define SYS_WRITE0 0x04
+#define SYS_WRITE  0x05
+#define SYS_READ   0x06
+#define SYS_CLOCK  0x10
+#define SYS_EXIT   0x18
+
+#define ADP_STOPPED_APPLICATION_EXIT 0x20026
+
+#define SEMIHOST_MAX_FILES 16
+#define SEMIHOST_BUFFER_SIZE (64 * 1024) // Host-side buffer per open file
+
+typedef struct {
+  FILE *file;
+  uint8_t *buffer; // Pending writes, flushed with one fwrite()
+  size_t used;
+  bool is_console;
+} Semihost_File;
+
+
+Stop_Reason semihosting_call(CortexM0_CPU *cpu);
+void semihosting_flush(void);
+void semihosting_close_all(void);
+
+
+#endif // SEMIHOSTING_H
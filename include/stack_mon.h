@@ -0,0 +1,51 @@
+#ifndef STACK_MON_H
+#define STACK_MON_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+#include "exception.h"
+
+#define STACK_CANARY 0xCDCDCDCDu // Fill word for stack_canary_fill()
+
+/*
+ * Stack usage per exception context.
+ *
+ * SP only moves down through pushes and exception entry, so the monitor
+ * updates on a new low only: the common push costs one compare. Handlers
+ * are not preempted, so one saved Thread low is enough.
+ */
+typedef struct {
+  uint32_t initial_sp; // SP at the last reset
+  uint32_t low;        // Lowest SP of the current context
+  uint32_t thread_low; // Thread mode's lowest SP while a handler runs
+  uint32_t min_sp;     // Lowest SP in any context
+  uint32_t entry_sp;   // SP before the running handler's frame was stacked
+  uint8_t handler;     // Exception number of the running handler (0 = Thread)
+  uint32_t peak[VECTOR_TABLE_SIZE]; // Deepest use per exception number (0 = Thread)
+  uint32_t limit;      // Stop when SP would go below this address (0 = off)
+  bool limit_hit;      // The last HardFault stop was the SP limit
+  uint32_t canary_start, canary_end; // SRAM range filled by stack_canary_fill()
+} Stack_Monitor;
+
+typedef struct {
+  uint32_t peak[VECTOR_TABLE_SIZE]; // Bytes, per exception number (0 = Thread)
+  uint32_t max_depth;       // Deepest stack below the initial SP, in bytes
+  uint32_t sram_high_water; // Highest canary-filled address written (0 = none)
+  uint32_t headroom;        // Untouched canary bytes above the limit (0 without one)
+} Stack_Report;
+
+
+void stack_mon_reset(Stack_Monitor *mon, uint32_t sp);
+bool stack_mon_new_low(CortexM0_CPU *cpu, uint32_t sp);
+bool stack_mon_enter(CortexM0_CPU *cpu, uint32_t sp, uint8_t exception_number);
+void stack_mon_exit(void);
+
+void stack_set_limit(uint32_t addr);
+bool stack_canary_fill(uint32_t start, uint32_t end);
+void stack_report(Stack_Report *out);
+void print_stack_report(void);
+
+
+#endif // STACK_MON_H
@@ -0,0 +1,44 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "memory_file.h"
+
+/*
+ * Per-instance execution counters.
+ *
+ * Counters are plain integers updated by the thread running the instance;
+ * take snapshots from that thread or while the instance is stopped. Build
+ * with -DVMCU_NO_STATS to remove every update from the hot paths.
+ */
+typedef struct {
+  _Alignas(64) uint64_t instructions; // Filled in by stats_snapshot(): sum of the classes below
+  uint64_t alu;                       // Shifts, add/sub, moves and data processing
+  uint64_t load_store;                // Single, multiple and stack transfers
+  uint64_t branch;                    // B, BL, BX, BLX
+  uint64_t bcond_taken;
+  uint64_t bcond_not_taken;
+  uint64_t other;                     // BKPT / semihosting
+  uint64_t region_accesses[MEM_REGIONS]; // Guest fetches, loads/stores and block transfers per region
+  uint64_t mmio_accesses;
+  uint64_t hardfaults;
+  uint64_t exceptions;                // Exception entries, HardFault excluded
+  uint32_t stack_depth;               // Filled in by stats_snapshot() from the stack monitor
+} Mcu_Stats;
+
+#ifdef VMCU_NO_STATS
+#define STATS_INC(field) ((void)0)
+#else
+// Only valid where mcu.h is included
+#define STATS_INC(field) (mcu->stats.field++)
+#endif
+
+
+void stats_snapshot(Mcu_Stats *out);
+void stats_reset(void);
+size_t stats_json(const Mcu_Stats *stats, char *buf, size_t len);
+
+
+#endif // STATS_H
@@ -7,5 +7,28 @@
 
 
 void test_Bcond_EQ(CortexM0_CPU *cpu);
+void test_breakpoint_stops_run(CortexM0_CPU *cpu);
+void test_watchpoint_stops_run(CortexM0_CPU *cpu);
+void test_gdb_stub(CortexM0_CPU *cpu);
+void test_uart(CortexM0_CPU *cpu);
+void test_semihosting(CortexM0_CPU *cpu);
+void test_dma_interrupt(CortexM0_CPU *cpu);
+void test_block_transfer(CortexM0_CPU *cpu);
+void test_cosim(CortexM0_CPU *cpu);
+void test_shared_flash(CortexM0_CPU *cpu);
+void test_sparse_memory(CortexM0_CPU *cpu);
+void test_vmcu_api(CortexM0_CPU *cpu);
+void test_stats(CortexM0_CPU *cpu);
+void test_stack_monitor(CortexM0_CPU *cpu);
+void test_latency(CortexM0_CPU *cpu);
+void test_pacing(CortexM0_CPU *cpu);
+void test_trace(CortexM0_CPU *cpu);
+void test_batch_cache(CortexM0_CPU *cpu);
+void test_mem_ops(CortexM0_CPU *cpu);
+void test_coverage(CortexM0_CPU *cpu);
+void test_reload_image(CortexM0_CPU *cpu);
+void test_alu_conformance(CortexM0_CPU *cpu);
 
-#endif // TEST_MOD_H
\ No newline at end of file
+void run_all_tests(void);
+
+#endif // TEST_MOD_H
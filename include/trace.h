@@ -0,0 +1,66 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define TRACE_CHUNK_SIZE (256 * 1024) // Raw bytes per compressed block
+#define TRACE_CHUNKS 8                // Chunks in flight between a run and its writer
+#define TRACE_MAX_RECORD 16
+
+/*
+ * Binary execution trace of one instance.
+ *
+ * The run loop appends varint records to the current chunk. Full chunks are
+ * handed to a writer thread, which compresses them with lz_compress() and
+ * appends them to the file, so the emulating thread never compresses or
+ * blocks on I/O unless every chunk is still waiting to be written.
+ *
+ * Records (the low two bits of the first varint give the kind):
+ *   jump:  n << 2 | 0, zigzag(pc - expected)  after n instructions, PC is not
+ *                                             the expected pc + 2 of the last
+ *   write: (n << 2 | log2 size) << 2 | 1, zigzag(addr - previous addr), value
+ *   read:  (n << 2 | log2 size) << 2 | 2, ...  access by the (n+1)th instruction
+ *   end:   n << 2 | 3                          n more instructions, then stop
+ *
+ * A conditional branch shows up as a jump only when taken, so no separate
+ * taken bits are needed. Decoding starts at PC 0; the first record jumps to
+ * the first traced instruction. The file is "VMCUTRC1" followed by blocks
+ * of raw length, compressed length (equal when stored raw) and data, each
+ * holding whole records.
+ */
+typedef struct Trace {
+  // Producer side, touched on every traced instruction
+  _Alignas(64) uint8_t *pos;
+  uint8_t *end;
+  uint32_t count;     // Instructions since the last record
+  uint32_t next_pc;   // Expected PC of the next instruction
+  uint32_t last_addr; // Address of the last memory record
+  uint64_t filled;    // Chunks handed to the writer
+
+  // Shared with the writer thread
+  _Alignas(64) pthread_mutex_t lock;
+  pthread_cond_t cond;
+  uint64_t written;   // Chunks the writer has finished
+  bool stopping;
+  bool failed;
+  uint32_t lengths[TRACE_CHUNKS];
+  uint8_t *chunks[TRACE_CHUNKS];
+  FILE *file;
+  pthread_t writer;
+  uint64_t raw_bytes, file_bytes;
+} Trace;
+
+#define TRACE_HEADER "VMCUTRC1"
+
+
+bool trace_start(const char *path);
+bool trace_stop(void);
+void trace_jump(Trace *t, uint32_t pc);
+void trace_mem(Trace *t, bool write, uint32_t addr, uint32_t size, uint32_t value);
+bool trace_decode(const char *path, FILE *out);
+
+
+#endif // TRACE_H
@@ -0,0 +1,49 @@
+#ifndef UART_H
+#define UART_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "ring_buffer.h"
+
+#define UART_DEFAULT_BASE 0x40004400
+#define UART_REG_SIZE 0x1C
+
+// Register offsets (STM32 USART layout)
+#define UART_SR 0x00
+#define UART_DR 0x04
+
+// Status register bits
+#define UART_SR_RXNE (1 << 5) // Receive data register not empty
+#define UART_SR_TC   (1 << 6) // Transmission complete
+#define UART_SR_TXE  (1 << 7) // Transmit data register empty
+
+#define UART_IO_BATCH 4096 // Largest single write()/read() done by the host thread
+
+// Receives transmitted bytes instead of the host thread (e.g. a simulated link)
+typedef void (*Uart_Tx_Hook)(void *ctx, uint8_t byte);
+
+typedef struct {
+  uint32_t base;
+  int tx_fd;           // Host side of TX (-1 = discard)
+  int rx_fd;           // Host side of RX (-1 = no input)
+  Ring_Buffer tx;      // Emulator → host
+  Ring_Buffer rx;      // Host → emulator
+  pthread_t thread;
+  _Atomic bool stop;
+  bool running;
+  Uart_Tx_Hook tx_hook; // Set with uart_set_tx_hook()
+  void *tx_hook_ctx;
+  uint64_t polls;       // I/O thread wake-ups: about one per ms while idle, far more if it spins
+} Uart;
+
+
+bool uart_init(Uart *uart, uint32_t base);
+bool uart_attach(Uart *uart, int tx_fd, int rx_fd);
+void uart_detach(Uart *uart);
+void uart_set_tx_hook(Uart *uart, Uart_Tx_Hook hook, void *ctx);
+int uart_open_host(const char *spec, int *tx_fd, int *rx_fd);
+
+
+#endif // UART_H
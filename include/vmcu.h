@@ -0,0 +1,102 @@
+#ifndef VMCU_H
+#define VMCU_H
+
+/*
+ * libvmcu: embeddable Cortex-M0 virtual MCU.
+ *
+ * This header is the stable interface of libvmcu.a / libvmcu.so and depends
+ * on nothing else in include/. An instance may be driven from any thread,
+ * but only from one thread at a time.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define VMCU_API_VERSION 1
+
+// libvmcu is built with hidden visibility; only declarations marked VMCU_API are exported
+#if defined(__GNUC__)
+#define VMCU_API __attribute__((visibility("default")))
+#else
+#define VMCU_API
+#endif
+
+// Register numbers for vmcu_get_reg() / vmcu_set_reg()
+#define VMCU_REG_SP   13
+#define VMCU_REG_LR   14
+#define VMCU_REG_PC   15
+#define VMCU_REG_XPSR 16
+
+typedef struct Mcu Vmcu;
+
+// Same values as the emulator's internal stop reasons
+typedef enum {
+  VMCU_STOP_BUDGET,     // Budget exhausted
+  VMCU_STOP_BREAKPOINT, // PC reached a breakpoint
+  VMCU_STOP_WATCHPOINT, // A write hit a watchpoint
+  VMCU_STOP_HARDFAULT,  // Invalid access, bad PC or unimplemented instruction
+  VMCU_STOP_BKPT,       // BKPT instruction executed
+  VMCU_STOP_EXIT,       // Guest called semihosting SYS_EXIT
+  VMCU_STOP_STACK_LIMIT, // A push would move SP below the stack limit
+} Vmcu_Stop;
+
+// Exception entry latency in cycles; percentiles are bounds of power-of-two buckets
+typedef struct {
+  uint64_t count;
+  uint64_t mean;
+  uint64_t p50, p90, p99, p999;
+  uint64_t worst;
+  uint32_t worst_pc; // PC interrupted in the worst case
+} Vmcu_Latency;
+
+// Region sizes in bytes; NULL config or zero Flash/SRAM sizes use the defaults
+typedef struct {
+  uint32_t flash_size;
+  uint32_t sram_size;
+  uint32_t ext_ram_size; // External RAM at 0x60000000, 0 for none
+} Vmcu_Config;
+
+
+VMCU_API int vmcu_api_version(void);
+
+VMCU_API Vmcu *vmcu_create(const Vmcu_Config *config);
+VMCU_API void vmcu_destroy(Vmcu *vm);
+
+VMCU_API bool vmcu_load_file(Vmcu *vm, const char *path);
+VMCU_API bool vmcu_load_image(Vmcu *vm, const void *image, uint32_t len);
+VMCU_API bool vmcu_reload_image(Vmcu *vm, const void *image, uint32_t len, uint32_t *changed_pages);
+VMCU_API void vmcu_reset(Vmcu *vm);
+
+VMCU_API Vmcu_Stop vmcu_run_for(Vmcu *vm, uint64_t instructions);
+VMCU_API uint64_t vmcu_cycles(const Vmcu *vm);
+VMCU_API const char *vmcu_stop_name(Vmcu_Stop stop);
+
+VMCU_API uint32_t vmcu_get_reg(const Vmcu *vm, unsigned reg);
+VMCU_API void vmcu_set_reg(Vmcu *vm, unsigned reg, uint32_t value);
+VMCU_API bool vmcu_read_mem(Vmcu *vm, uint32_t addr, void *buf, uint32_t len);
+VMCU_API bool vmcu_write_mem(Vmcu *vm, uint32_t addr, const void *buf, uint32_t len);
+
+VMCU_API bool vmcu_set_irq(Vmcu *vm, unsigned irq);
+VMCU_API bool vmcu_set_breakpoint(Vmcu *vm, uint32_t addr, bool enable);
+
+VMCU_API size_t vmcu_stats_json(Vmcu *vm, char *buf, size_t len);
+VMCU_API void vmcu_stats_reset(Vmcu *vm);
+
+VMCU_API void vmcu_set_stack_limit(Vmcu *vm, uint32_t addr);
+VMCU_API uint32_t vmcu_stack_peak(Vmcu *vm, int exception);
+
+VMCU_API bool vmcu_trace_start(Vmcu *vm, const char *path);
+VMCU_API bool vmcu_trace_stop(Vmcu *vm);
+
+VMCU_API bool vmcu_coverage_start(Vmcu *vm);
+VMCU_API const uint64_t *vmcu_coverage_map(Vmcu *vm, size_t *words);
+VMCU_API void vmcu_coverage_merge(uint64_t *dst, const uint64_t *src, size_t words);
+VMCU_API bool vmcu_coverage_save(Vmcu *vm, const char *path);
+
+VMCU_API void vmcu_set_exception_cycles(Vmcu *vm, uint32_t entry, uint32_t ret);
+VMCU_API bool vmcu_exception_latency(Vmcu *vm, unsigned exception, Vmcu_Latency *out);
+VMCU_API void vmcu_latency_reset(Vmcu *vm);
+
+
+#endif // VMCU_H
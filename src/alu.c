@@ -43,11 +43,11 @@ void SUB(CortexM0_CPU *cpu, uint8_t Rd, uint8_t Rn, uint8_t Rm) {
   uint32_t op1 = cpu->R[Rn];
   uint32_t op2 = cpu->R[Rm];
   uint32_t result = op1 - op2;
-  printf("SUB operation: %0x - %0x = %0x \n", op1, op2, result);
+  TRACE("SUB operation: %0x - %0x = %0x \n", op1, op2, result);
   // Carry is inverted for SUB in ARM
   _Bool carry = !(op1 < op2);
-  // An overflow is set if the ops have the same sign, that is different than the result sign
-  _Bool overflow = (((op1 & 0x80000000) == (op2 & 0x80000000)) && ((result&0x80000000) != (op1 & 0x80000000)));
+  // An overflow is set if the ops have different signs and the result sign differs from op1
+  _Bool overflow = (((op1 ^ op2) & (op1 ^ result)) >> 31) & 1;
   cpu->R[Rd] = result;
   update_flags(cpu, result, carry, overflow);
 }
@@ -68,10 +68,10 @@ void CMP(CortexM0_CPU *cpu, uint8_t Rn, uint8_t Rm) {
   uint32_t op1 = cpu->R[Rn];
   uint32_t op2 = cpu->R[Rm];
   uint32_t result = op1 - op2;
-  printf("here is the operation: %d - %d = %d \n", op1, op2, result);
+  TRACE("here is the operation: %d - %d = %d \n", op1, op2, result);
   // check for carry
   _Bool carry = !(op1 < op2);
-  _Bool overflow = (((op1 & 0x80000000) == (op2 & 0x80000000)) && ((result&0x80000000) != (op1 & 0x80000000)));
+  _Bool overflow = (((op1 ^ op2) & (op1 ^ result)) >> 31) & 1;
   update_flags(cpu, result, carry, overflow);
 }
 
@@ -0,0 +1,269 @@
+#include "batch.h"
+#include "mcu.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define BATCH_RECORD_MAGIC "VMCURES1"
+
+typedef struct {
+  uint64_t a, b;
+} Batch_Key;
+
+// Cache file header, followed by output_len bytes of UART output
+typedef struct {
+  char magic[8];
+  uint32_t reason;
+  int32_t exit_code;
+  uint32_t R[16];
+  uint32_t xpsr;
+  uint32_t reserved;
+  uint64_t cycles;
+  uint64_t output_len;
+} Batch_Record;
+
+typedef struct {
+  uint8_t *buf;
+  size_t len, cap;
+} Batch_Output;
+
+static inline uint64_t key_mix(uint64_t h, uint64_t w)
+{
+  h ^= w * 0x9E3779B97F4A7C15ull;
+  h = (h << 31) | (h >> 33);
+  return h * 0xC2B2AE3D27D4EB4Full;
+}
+
+// Two lanes with different seeds give a 128-bit key
+static void key_add(Batch_Key *key, const void *data, size_t len)
+{
+  const uint8_t *p = data;
+  for (; len >= 8; p += 8, len -= 8)
+  {
+    uint64_t w;
+    memcpy(&w, p, 8);
+    key->a = key_mix(key->a, w);
+    key->b = key_mix(key->b, w ^ 0x632BE59BD9B4E019ull);
+  }
+  uint64_t tail = 0x80; // Marks the end, so trailing zeros still count
+  for (size_t i = len; i > 0; i--)
+  {
+    tail = (tail << 8) | p[i - 1];
+  }
+  key->a = key_mix(key->a, tail);
+  key->b = key_mix(key->b, tail ^ 0x632BE59BD9B4E019ull);
+}
+
+static void key_add_u64(Batch_Key *key, uint64_t v)
+{
+  key_add(key, &v, sizeof(v));
+}
+
+/**
+ * @brief Hashes everything that determines the outcome of a run: the
+ *        memory map and contents, the CPU state, the UART and the job.
+ */
+static Batch_Key batch_key(const CortexM0_CPU *cpu, const Uart *uart, const Batch_Job *job)
+{
+  Batch_Key key = {0x243F6A8885A308D3ull, 0x13198A2E03707344ull};
+  key_add_u64(&key, BATCH_CACHE_VERSION);
+  key_add_u64(&key, BATCH_QUANTUM);
+  for (int i = 0; i < MEM_REGIONS; i++)
+  {
+    const Mem_Region *r = &mcu->regions[i];
+    key_add_u64(&key, (uint64_t)r->base << 32 | r->size);
+    key_add(&key, mcu->memory + r->offset, r->size);
+  }
+  key_add(&key, cpu->R, sizeof(cpu->R));
+  key_add_u64(&key, (uint64_t)cpu->APSR.all << 32 | cpu->ipsr);
+  key_add_u64(&key, cpu->cycles);
+  key_add_u64(&key, mcu->nvic_pending);
+  // Debug state that can stop the run early
+  key_add_u64(&key, mcu->stack_mon.limit);
+  for (int i = 0; i < MEM_REGIONS; i++)
+  {
+    const Mem_Region *r = &mcu->regions[i];
+    key_add(&key, mcu->bp_bitmap + r->offset / 16, BP_BITMAP_BYTES(r->size));
+  }
+  key_add_u64(&key, mcu->watchpoint_count);
+  for (uint32_t i = 0; i < mcu->watchpoint_count; i++)
+  {
+    key_add_u64(&key, (uint64_t)mcu->watchpoints[i].addr << 32 | mcu->watchpoints[i].len);
+  }
+  key_add_u64(&key, (uint64_t)mcu->latency.entry_cycles << 32 | mcu->latency.return_cycles);
+  key_add_u64(&key, uart->base);
+  key_add_u64(&key, job->cycles);
+  key_add_u64(&key, job->input_len);
+  key_add(&key, job->input, job->input_len);
+  return key;
+}
+
+static char *batch_cache_path(const char *dir, Batch_Key key)
+{
+  size_t len = strlen(dir) + 40;
+  char *path = malloc(len);
+  if (path)
+  {
+    snprintf(path, len, "%s/%016llx%016llx.run", dir, (unsigned long long)key.a,
+             (unsigned long long)key.b);
+  }
+  return path;
+}
+
+static bool batch_cache_load(const char *path, Batch_Result *result)
+{
+  FILE *f = fopen(path, "rb");
+  if (f == NULL)
+  {
+    return false;
+  }
+  Batch_Record rec;
+  bool ok = fread(&rec, sizeof(rec), 1, f) == 1 &&
+            memcmp(rec.magic, BATCH_RECORD_MAGIC, 8) == 0 && rec.output_len <= SIZE_MAX;
+  uint8_t *output = ok ? malloc(rec.output_len ? rec.output_len : 1) : NULL;
+  ok = output && fread(output, 1, rec.output_len, f) == rec.output_len;
+  fclose(f);
+  if (!ok)
+  {
+    free(output);
+    return false;
+  }
+  result->reason = (Stop_Reason)rec.reason;
+  result->exit_code = rec.exit_code;
+  memcpy(result->R, rec.R, sizeof(result->R));
+  result->xpsr = rec.xpsr;
+  result->cycles = rec.cycles;
+  result->output = output;
+  result->output_len = rec.output_len;
+  result->cached = true;
+  return true;
+}
+
+// Writes a temporary file and renames it, so readers never see a partial record
+static void batch_cache_store(const char *dir, const char *path, const Batch_Result *result)
+{
+  mkdir(dir, 0777); // May already exist
+  Batch_Record rec = {
+    .reason = result->reason,
+    .exit_code = result->exit_code,
+    .xpsr = result->xpsr,
+    .cycles = result->cycles,
+    .output_len = result->output_len,
+  };
+  memcpy(rec.magic, BATCH_RECORD_MAGIC, 8);
+  memcpy(rec.R, result->R, sizeof(rec.R));
+
+  size_t len = strlen(path) + 32;
+  char *tmp = malloc(len);
+  if (tmp == NULL)
+  {
+    return;
+  }
+  snprintf(tmp, len, "%s.%ld.tmp", path, (long)getpid());
+  FILE *f = fopen(tmp, "wb");
+  bool ok = f && fwrite(&rec, sizeof(rec), 1, f) == 1 &&
+            fwrite(result->output, 1, result->output_len, f) == result->output_len;
+  if (f && fclose(f) != 0)
+  {
+    ok = false;
+  }
+  if (!ok || rename(tmp, path) != 0)
+  {
+    printf("Cannot write result cache %s\n", path);
+    unlink(tmp);
+  }
+  free(tmp);
+}
+
+static void batch_capture(void *ctx, uint8_t byte)
+{
+  Batch_Output *out = ctx;
+  if (out->len == out->cap)
+  {
+    size_t cap = out->cap ? out->cap * 2 : 4096;
+    uint8_t *buf = realloc(out->buf, cap);
+    if (buf == NULL)
+    {
+      return; // Output is lost, but the run goes on
+    }
+    out->buf = buf;
+    out->cap = cap;
+  }
+  out->buf[out->len++] = byte;
+}
+
+/**
+ * @brief Runs the selected instance to a stop or the end of the budget,
+ *        or replays a cached result of an identical run.
+ *
+ * Must be called on a freshly reset instance: cycle counter at 0, no
+ * interrupt pending and no peripheral event (DMA completion, co-simulation
+ * delivery) scheduled, since peripheral state is not part of the cache key.
+ *
+ * The key covers the memory contents (Flash image and initial RAM), the CPU
+ * state including the cycle counter, pending interrupts, the stack limit,
+ * breakpoints and watchpoints, the UART base, the budget and the input bytes. UART output is
+ * captured instead of going to the host. Input is offered to the receiver
+ * every BATCH_QUANTUM instructions, so a run is repeatable. Runs whose
+ * semihosting calls touch host files, the console or the clock are not
+ * cached, as their outcome does not depend on the key alone.
+ *
+ * @param uart Initialised UART of the instance (not attached to the host).
+ * @return false if the result could not be produced (out of memory).
+ */
+bool batch_run(CortexM0_CPU *cpu, Uart *uart, const Batch_Job *job, Batch_Result *result)
+{
+  assert(cpu->cycles == 0 && mcu->nvic_pending == 0 && mcu->event_count == 0 &&
+         "batch_run: instance is not freshly reset");
+  memset(result, 0, sizeof(*result));
+  Batch_Key key = batch_key(cpu, uart, job);
+  char *path = job->cache_dir ? batch_cache_path(job->cache_dir, key) : NULL;
+  if (path && batch_cache_load(path, result))
+  {
+    free(path);
+    return true;
+  }
+
+  Batch_Output out = {0};
+  Uart_Tx_Hook old_hook = uart->tx_hook;
+  void *old_ctx = uart->tx_hook_ctx;
+  uart_set_tx_hook(uart, batch_capture, &out);
+  mcu->semihost_host_io = false;
+
+  Stop_Reason reason = STOP_NONE;
+  size_t fed = 0;
+  for (uint64_t left = job->cycles; left > 0 && reason == STOP_NONE;)
+  {
+    fed += ring_write(&uart->rx, job->input + fed, job->input_len - fed);
+    uint64_t n = left < BATCH_QUANTUM ? left : BATCH_QUANTUM;
+    reason = cpu_run(cpu, n);
+    left -= n;
+  }
+  semihosting_flush();
+  uart_set_tx_hook(uart, old_hook, old_ctx);
+
+  result->reason = reason;
+  result->exit_code = mcu->semihost_exit_code;
+  memcpy(result->R, cpu->R, sizeof(result->R));
+  result->xpsr = get_xpsr(cpu) | cpu->ipsr;
+  result->cycles = cpu->cycles;
+  result->output = out.buf;
+  result->output_len = out.len;
+  if (path && !mcu->semihost_host_io)
+  {
+    batch_cache_store(job->cache_dir, path, result);
+  }
+  bool ok = job->cache_dir == NULL || path != NULL;
+  free(path);
+  return ok;
+}
+
+void batch_result_free(Batch_Result *result)
+{
+  free(result->output);
+  result->output = NULL;
+  result->output_len = 0;
+}
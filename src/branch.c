@@ -11,7 +11,7 @@
  * @param signed_immediate The signed offset to branch to.
  */
 void B(CortexM0_CPU *cpu, int32_t signed_immediate) {
-  printf("Branching by offset: %d\n", signed_immediate);
+  TRACE("Branching by offset: %d\n", signed_immediate);
   cpu->R[15] += signed_immediate;
 }
 
@@ -110,7 +110,7 @@ void BLX(CortexM0_CPU *cpu, uint8_t Rm, uint8_t inst_size)
 {
   assert((inst_size == 2) || (inst_size == 4));
 
-  cpu->R[14] = cpu->R[15]+ inst_size; 
+  cpu->R[14] = (cpu->R[15] + inst_size) | 1U; // Return address keeps the Thumb bit
   uint32_t target = cpu->R[Rm];
 
   // Check Thumb bit (bit0 must be 1)
@@ -0,0 +1,355 @@
+#include "conformance.h"
+#include "alu.h"
+#include "mem_ops.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * Conformance sweep of the ALU and shift handlers.
+ *
+ * Every case runs through the real handler on a scratch CPU and through a
+ * reference written straight from the ARMv6-M pseudocode (AddWithCarry(),
+ * LSL_C(), LSR_C(), DecodeImmShift()), which shares no code with alu.c or
+ * cpu.c. Both produce a 64-bit outcome per case into arrays, and whole
+ * batches are compared with mem_ops_mismatch(), so the check costs little
+ * next to the handler calls.
+ *
+ * Each operation first sweeps every 16-bit operand value exhaustively:
+ * every pair of values for two-operand instructions (2^32 cases) and every
+ * value with every shift amount for shifts. A value fills both halves of
+ * the register, so carries cross bit 15 into the upper half and the top bit
+ * of the value is also the sign bit. Random cases follow. Case i of an
+ * operation is a pure function of the seed and i, so threads can take
+ * chunks in any order.
+ */
+
+typedef struct {
+  uint32_t a[CONFORMANCE_BATCH];
+  uint32_t b[CONFORMANCE_BATCH];
+  uint32_t rd[CONFORMANCE_BATCH]; // Incoming destination register
+  uint8_t nzcv[CONFORMANCE_BATCH];
+  uint64_t expected[CONFORMANCE_BATCH];
+  uint64_t got[CONFORMANCE_BATCH];
+} Conf_Batch;
+
+typedef struct {
+  const Conformance_Config *config;
+  uint64_t chunks[CONF_OPS];  // Chunks per operation
+  uint64_t first[CONF_OPS + 1]; // Global index of each operation's first chunk
+  _Atomic uint64_t next;      // Next global chunk to take
+  _Atomic uint64_t mismatches[CONF_OPS];
+  pthread_mutex_t lock;       // Guards the first-mismatch fields of report
+  Conformance_Report *report;
+} Conf_Sweep;
+
+static const char *const op_names[CONF_OPS] = {
+  "ADDS", "SUBS", "CMP", "ANDS", "ORRS", "EORS", "TST", "LSLS #imm", "LSRS #imm",
+};
+
+const char *conformance_op_name(Conf_Op op)
+{
+  return op < CONF_OPS ? op_names[op] : "?";
+}
+
+static bool is_shift(Conf_Op op)
+{
+  return op == CONF_LSL || op == CONF_LSR;
+}
+
+static unsigned exhaustive_bits(const Conformance_Config *config)
+{
+  return config->exhaustive_bits ? config->exhaustive_bits : 16;
+}
+
+static uint64_t exhaustive_cases(const Conformance_Config *config, Conf_Op op)
+{
+  unsigned bits = exhaustive_bits(config);
+  return is_shift(op) ? 32ull << bits : 1ull << 2 * bits;
+}
+
+static uint64_t mix64(uint64_t x)
+{
+  x += 0x9E3779B97F4A7C15ull;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+  return x ^ (x >> 31);
+}
+
+// Swept value to operand: left-aligned in 16 bits, then copied to both halves
+static uint32_t spread_value(const Conformance_Config *config, uint32_t v)
+{
+  uint32_t half = v << (16 - exhaustive_bits(config));
+  return half << 16 | half;
+}
+
+// Random operand biased towards values near 0, the sign boundary and all ones.
+// Table-driven rather than a switch: the shape is random, so branches would miss.
+static uint32_t random_operand(uint32_t v, uint32_t shape)
+{
+  static const uint32_t keep[8] = {0xFF, 0xFF, 0xFF, 0xFF, ~0u, ~0u, ~0u, ~0u};
+  static const uint32_t flip[8] = {0, 0x80000000u, 0x7FFFFFFFu, ~0u, 0, 0, 0, 0};
+  return (v & keep[shape & 7]) ^ flip[shape & 7];
+}
+
+static void make_case(const Conformance_Config *config, Conf_Op op, uint64_t i, Conf_Batch *batch,
+                      size_t k)
+{
+  uint64_t r = mix64(config->seed ^ ((uint64_t)op << 56) ^ i);
+  batch->nzcv[k] = (uint8_t)(r >> 60);
+  batch->rd[k] = (uint32_t)r;
+  if (i < exhaustive_cases(config, op))
+  {
+    if (is_shift(op))
+    {
+      batch->a[k] = spread_value(config, (uint32_t)(i >> 5));
+      batch->b[k] = i & 31;
+    }
+    else
+    {
+      unsigned bits = exhaustive_bits(config);
+      batch->a[k] = spread_value(config, (uint32_t)(i >> bits));
+      batch->b[k] = spread_value(config, (uint32_t)i & ((1u << bits) - 1));
+    }
+    return;
+  }
+  uint64_t operands = mix64(r);
+  uint32_t shapes = (uint32_t)(r >> 32);
+  batch->a[k] = random_operand((uint32_t)operands, shapes);
+  batch->b[k] = is_shift(op) ? (uint32_t)(operands >> 32) & 31
+                             : random_operand((uint32_t)(operands >> 32), shapes >> 3);
+}
+
+static uint64_t outcome(uint32_t rd, bool n, bool z, bool c, bool v)
+{
+  return (uint64_t)(n << 3 | z << 2 | c << 1 | v) << 32 | rd;
+}
+
+/**
+ * @brief AddWithCarry() from the ARMv6-M pseudocode.
+ *
+ * Carry and overflow are whether the 32-bit result differs from the
+ * unbounded unsigned and signed sums, as the pseudocode defines them.
+ */
+void arm_add_with_carry(uint32_t x, uint32_t y, bool carry_in, uint32_t *result, bool *carry_out,
+                        bool *overflow)
+{
+  uint64_t unsigned_sum = (uint64_t)x + y + carry_in;
+  int64_t signed_sum = (int64_t)(int32_t)x + (int32_t)y + carry_in;
+  *result = (uint32_t)unsigned_sum;
+  *carry_out = (uint64_t)*result != unsigned_sum;
+  *overflow = (int64_t)(int32_t)*result != signed_sum;
+}
+
+static uint64_t reference(Conf_Op op, uint32_t a, uint32_t b, uint32_t rd, uint8_t nzcv)
+{
+  bool c_in = nzcv & 2, v_in = nzcv & 1;
+  uint32_t result = rd;
+  bool carry = c_in, overflow = v_in;
+  switch (op)
+  {
+  case CONF_ADD: arm_add_with_carry(a, b, false, &result, &carry, &overflow); break;
+  case CONF_SUB: arm_add_with_carry(a, ~b, true, &result, &carry, &overflow); break;
+  case CONF_CMP: arm_add_with_carry(a, ~b, true, &result, &carry, &overflow); break;
+  case CONF_AND: case CONF_TST: result = a & b; break;
+  case CONF_ORR: result = a | b; break;
+  case CONF_EOR: result = a ^ b; break;
+  case CONF_LSL: // DecodeImmShift: LSL #0 is a plain move; LSL_C(x, n) otherwise
+    if (b != 0)
+    {
+      uint64_t extended = (uint64_t)a << b;
+      result = (uint32_t)extended;
+      carry = (extended >> 32) & 1;
+    }
+    else
+    {
+      result = a;
+    }
+    break;
+  case CONF_LSR: // DecodeImmShift: LSR #0 encodes LSR #32; LSR_C(x, n)
+  {
+    uint32_t n = b ? b : 32;
+    uint64_t extended = a;
+    result = (uint32_t)(extended >> n);
+    carry = (extended >> (n - 1)) & 1;
+    break;
+  }
+  default: break;
+  }
+  bool flags_only = op == CONF_CMP || op == CONF_TST;
+  return outcome(flags_only ? rd : result, result >> 31, result == 0, carry, overflow);
+}
+
+static uint64_t emulate(CortexM0_CPU *cpu, Conf_Op op, uint32_t a, uint32_t b, uint32_t rd,
+                        uint8_t nzcv)
+{
+  cpu->R[0] = rd;
+  cpu->R[1] = a;
+  cpu->R[2] = b;
+  cpu->APSR.all = 0;
+  cpu->APSR.Bits.APSR_N = nzcv >> 3;
+  cpu->APSR.Bits.APSR_Z = nzcv >> 2;
+  cpu->APSR.Bits.APSR_C = nzcv >> 1;
+  cpu->APSR.Bits.APSR_V = nzcv;
+  switch (op)
+  {
+  case CONF_ADD: ADD(cpu, 0, 1, 2); break;
+  case CONF_SUB: SUB(cpu, 0, 1, 2); break;
+  case CONF_CMP: CMP(cpu, 1, 2); break;
+  case CONF_AND: AND(cpu, 1, 2, 0); break;
+  case CONF_ORR: ORR(cpu, 1, 2, 0); break;
+  case CONF_EOR: EOR(cpu, 1, 2, 0); break;
+  case CONF_TST: TST(cpu, 1, 2); break;
+  case CONF_LSL: LSL(cpu, 0, 1, b); break;
+  case CONF_LSR: LSR(cpu, 0, 1, b); break;
+  default: break;
+  }
+  return outcome(cpu->R[0], cpu->APSR.Bits.APSR_N, cpu->APSR.Bits.APSR_Z, cpu->APSR.Bits.APSR_C,
+                 cpu->APSR.Bits.APSR_V);
+}
+
+static void record_mismatch(Conf_Sweep *sweep, Conf_Op op, const Conf_Batch *batch, size_t k)
+{
+  if (atomic_fetch_add_explicit(&sweep->mismatches[op], 1, memory_order_relaxed) != 0)
+  {
+    return;
+  }
+  pthread_mutex_lock(&sweep->lock);
+  Conformance_Report *r = &sweep->report[op];
+  r->a = batch->a[k];
+  r->b = batch->b[k];
+  r->nzcv_in = batch->nzcv[k];
+  r->expected = (uint32_t)batch->expected[k];
+  r->got = (uint32_t)batch->got[k];
+  r->expected_nzcv = (uint8_t)(batch->expected[k] >> 32);
+  r->got_nzcv = (uint8_t)(batch->got[k] >> 32);
+  pthread_mutex_unlock(&sweep->lock);
+}
+
+static void run_chunk(Conf_Sweep *sweep, Conf_Op op, uint64_t start, uint64_t end, Conf_Batch *batch)
+{
+  CortexM0_CPU cpu;
+  memset(&cpu, 0, sizeof(cpu));
+  for (uint64_t i = start; i < end; i += CONFORMANCE_BATCH)
+  {
+    size_t n = end - i < CONFORMANCE_BATCH ? end - i : CONFORMANCE_BATCH;
+    for (size_t k = 0; k < n; k++)
+    {
+      make_case(sweep->config, op, i + k, batch, k);
+    }
+    for (size_t k = 0; k < n; k++)
+    {
+      batch->expected[k] = reference(op, batch->a[k], batch->b[k], batch->rd[k], batch->nzcv[k]);
+    }
+    for (size_t k = 0; k < n; k++)
+    {
+      batch->got[k] = emulate(&cpu, op, batch->a[k], batch->b[k], batch->rd[k], batch->nzcv[k]);
+    }
+    size_t bytes = n * sizeof(uint64_t);
+    size_t at = mem_ops_mismatch((const uint8_t *)batch->expected, (const uint8_t *)batch->got, bytes);
+    while (at < bytes)
+    {
+      size_t k = at / sizeof(uint64_t);
+      record_mismatch(sweep, op, batch, k);
+      size_t from = (k + 1) * sizeof(uint64_t);
+      at = from + mem_ops_mismatch((const uint8_t *)batch->expected + from,
+                                   (const uint8_t *)batch->got + from, bytes - from);
+    }
+  }
+}
+
+static void *conformance_thread(void *arg)
+{
+  Conf_Sweep *sweep = arg;
+  Conf_Batch *batch = malloc(sizeof(*batch));
+  if (batch == NULL)
+  {
+    return arg; // Reported as a failed thread
+  }
+  for (;;)
+  {
+    uint64_t chunk = atomic_fetch_add_explicit(&sweep->next, 1, memory_order_relaxed);
+    if (chunk >= sweep->first[CONF_OPS])
+    {
+      break;
+    }
+    int op = 0;
+    while (chunk >= sweep->first[op + 1])
+    {
+      op++;
+    }
+    uint64_t total = exhaustive_cases(sweep->config, op) + sweep->config->random_cases;
+    uint64_t start = (chunk - sweep->first[op]) * CONFORMANCE_CHUNK;
+    uint64_t end = start + CONFORMANCE_CHUNK < total ? start + CONFORMANCE_CHUNK : total;
+    run_chunk(sweep, op, start, end, batch);
+  }
+  free(batch);
+  return NULL;
+}
+
+/**
+ * @brief Runs the sweep on several threads and fills one report per operation.
+ *
+ * @return true if every case matched the reference (and every thread ran).
+ */
+bool conformance_run(const Conformance_Config *config, Conformance_Report report[CONF_OPS])
+{
+  Conf_Sweep sweep;
+  memset(&sweep, 0, sizeof(sweep));
+  memset(report, 0, CONF_OPS * sizeof(*report));
+  sweep.config = config;
+  sweep.report = report;
+  pthread_mutex_init(&sweep.lock, NULL);
+  for (int op = 0; op < CONF_OPS; op++)
+  {
+    report[op].cases = exhaustive_cases(config, op) + config->random_cases;
+    sweep.chunks[op] = (report[op].cases + CONFORMANCE_CHUNK - 1) / CONFORMANCE_CHUNK;
+    sweep.first[op + 1] = sweep.first[op] + sweep.chunks[op];
+  }
+
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned threads = config->threads ? config->threads : (online > 0 ? (unsigned)online : 1);
+  pthread_t *tids = calloc(threads, sizeof(*tids));
+  unsigned started = 0;
+  while (tids && started < threads &&
+         pthread_create(&tids[started], NULL, conformance_thread, &sweep) == 0)
+  {
+    started++;
+  }
+  bool ok = started > 0;
+  for (unsigned t = 0; t < started; t++)
+  {
+    void *failed;
+    pthread_join(tids[t], &failed);
+    ok = ok && failed == NULL;
+  }
+  free(tids);
+  pthread_mutex_destroy(&sweep.lock);
+
+  for (int op = 0; op < CONF_OPS; op++)
+  {
+    report[op].mismatches = atomic_load(&sweep.mismatches[op]);
+    ok = ok && report[op].mismatches == 0;
+  }
+  return ok;
+}
+
+void print_conformance_report(const Conformance_Report report[CONF_OPS])
+{
+  for (int op = 0; op < CONF_OPS; op++)
+  {
+    const Conformance_Report *r = &report[op];
+    printf("  %-10s %12llu cases  %s\n", conformance_op_name(op), (unsigned long long)r->cases,
+           r->mismatches ? "FAIL" : "ok");
+    if (r->mismatches)
+    {
+      printf("    %llu mismatches, e.g. a=0x%08X b=0x%08X NZCV in=%X: expected 0x%08X NZCV=%X, "
+             "got 0x%08X NZCV=%X\n",
+             (unsigned long long)r->mismatches, r->a, r->b, r->nzcv_in, r->expected,
+             r->expected_nzcv, r->got, r->got_nzcv);
+    }
+  }
+}
@@ -0,0 +1,575 @@
+#define _GNU_SOURCE
+#include "cosim.h"
+#include "execute.h"
+#include "events.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/mman.h>
+
+/*
+ * Conservative time windows: every link delivers a byte at least `quantum`
+ * cycles after it was sent, so a byte sent inside a window can only arrive
+ * in a later one. Nodes therefore run a whole window without looking at each
+ * other and only meet at the window boundary, where everything sent so far
+ * has been published to the link rings.
+ */
+
+/**
+ * @brief Producer side: appends a frame to a link.
+ *
+ * @return false if the link is full; the frame is dropped and counted.
+ */
+static bool link_push(Cosim_Link *link, Cosim_Frame frame)
+{
+  size_t head = atomic_load_explicit(&link->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&link->tail, memory_order_acquire) == COSIM_LINK_SLOTS)
+  {
+    link->dropped++;
+    return false;
+  }
+  link->slots[head & (COSIM_LINK_SLOTS - 1)] = frame;
+  atomic_store_explicit(&link->head, head + 1, memory_order_release);
+  return true;
+}
+
+// Consumer side: oldest frame on the link, or NULL if it is empty
+static const Cosim_Frame *link_peek(Cosim_Link *link)
+{
+  size_t tail = atomic_load_explicit(&link->tail, memory_order_relaxed);
+  if (atomic_load_explicit(&link->head, memory_order_acquire) == tail)
+  {
+    return NULL;
+  }
+  return &link->slots[tail & (COSIM_LINK_SLOTS - 1)];
+}
+
+static void link_pop(Cosim_Link *link)
+{
+  size_t tail = atomic_load_explicit(&link->tail, memory_order_relaxed);
+  atomic_store_explicit(&link->tail, tail + 1, memory_order_release);
+}
+
+static void cosim_deliver(void *ctx, uint64_t now);
+
+/**
+ * @brief Schedules delivery of the earliest frame due in the current window.
+ *
+ * Frames due later were possibly sent in the window that peers are running
+ * right now; they are picked up at the start of the window they fall in.
+ * If the node's event table is full the frames stay on their links, are
+ * delivered (late) at the start of the next window and counted in late.
+ */
+static void cosim_schedule_delivery(Cosim_Node *node)
+{
+  uint64_t next = NO_EVENT;
+  for (uint32_t i = 0; i < node->in_count; i++)
+  {
+    const Cosim_Frame *frame = link_peek(node->in[i]);
+    if (frame && frame->time < next)
+    {
+      next = frame->time;
+    }
+  }
+  if (next < node->quantum_end && !event_schedule(next, cosim_deliver, node))
+  {
+    node->late++;
+  }
+}
+
+// Moves every frame due before cycle until into the UART receiver
+static void cosim_receive(Cosim_Node *node, uint64_t until)
+{
+  for (uint32_t i = 0; i < node->in_count; i++)
+  {
+    const Cosim_Frame *frame;
+    while ((frame = link_peek(node->in[i])) != NULL && frame->time < until)
+    {
+      ring_put(&node->uart.rx, frame->byte); // A full receiver drops the byte (overrun)
+      link_pop(node->in[i]);
+    }
+  }
+}
+
+/**
+ * @brief Event handler: moves every frame that has arrived into the UART receiver.
+ */
+static void cosim_deliver(void *ctx, uint64_t now)
+{
+  Cosim_Node *node = ctx;
+  cosim_receive(node, now + 1);
+  cosim_schedule_delivery(node);
+}
+
+/**
+ * @brief UART TX hook: sends the byte on every outgoing link of the node.
+ */
+static void cosim_transmit(void *ctx, uint8_t byte)
+{
+  Cosim_Node *node = ctx;
+  uint64_t now = event_now();
+  for (uint32_t i = 0; i < node->out_count; i++)
+  {
+    link_push(node->out[i], (Cosim_Frame){now + node->out[i]->latency, byte});
+  }
+}
+
+/**
+ * @brief Runs the selected node up to (but not including) cycle end.
+ *
+ * A node that stopped (BKPT, exit, HardFault) stays halted and only drains
+ * its links so the senders never see them fill up.
+ */
+static void cosim_window(Cosim_Node *node, uint64_t end)
+{
+  CortexM0_CPU *cpu = &node->mcu->cpu;
+  node->quantum_end = end;
+
+  if (node->halted)
+  {
+    for (uint32_t i = 0; i < node->in_count; i++)
+    {
+      const Cosim_Frame *frame;
+      while ((frame = link_peek(node->in[i])) != NULL && frame->time < end)
+      {
+        link_pop(node->in[i]);
+      }
+    }
+    return;
+  }
+
+  cosim_receive(node, cpu->cycles); // Overdue only if their event could not be scheduled
+  cosim_schedule_delivery(node);
+  if (cpu->cycles < end)
+  {
+    Stop_Reason reason = cpu_run(cpu, end - cpu->cycles);
+    if (reason != STOP_NONE)
+    {
+      node->halted = true;
+      node->reason = reason;
+      semihosting_flush();
+    }
+  }
+}
+
+static void *cosim_thread(void *arg)
+{
+  Cosim_Node *node = arg;
+  Cosim *sim = node->sim;
+
+  int state;
+  while ((state = atomic_load_explicit(&sim->start_gate, memory_order_acquire)) == 0)
+  {
+    sched_yield();
+  }
+  if (state < 0)
+  {
+    return NULL; // Another thread could not be started
+  }
+
+  if (node->cpu >= 0)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(node->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+  mcu_select(node->mcu);
+  for (uint64_t t = sim->now; t < sim->end_cycle; t += sim->quantum)
+  {
+    cosim_window(node, t + sim->quantum < sim->end_cycle ? t + sim->quantum : sim->end_cycle);
+    pthread_barrier_wait(&sim->barrier);
+  }
+  mcu_select(NULL);
+  return NULL;
+}
+
+/**
+ * @brief Creates node_count MCUs with the default memory map, each with a
+ *        UART at uart_base.
+ */
+bool cosim_init(Cosim *sim, uint32_t node_count, uint32_t uart_base)
+{
+  return cosim_init_config(sim, node_count, uart_base, NULL);
+}
+
+/**
+ * @brief Creates node_count MCUs with the given memory map (NULL for the
+ *        default), each with a UART at uart_base.
+ *
+ * The UARTs transmit onto the node's links (see cosim_connect()) instead of
+ * a host descriptor. The calling thread's selected instance is preserved.
+ *
+ * @return false if an allocation or mapping fails.
+ */
+bool cosim_init_config(Cosim *sim, uint32_t node_count, uint32_t uart_base, const Mcu_Config *config)
+{
+  memset(sim, 0, sizeof(*sim));
+  if (node_count == 0 || node_count > COSIM_MAX_NODES)
+  {
+    printf("Co-simulation supports 1 to %d nodes\n", COSIM_MAX_NODES);
+    return false;
+  }
+  size_t size = (node_count * sizeof(Cosim_Node) + 63) & ~(size_t)63;
+  sim->nodes = aligned_alloc(64, size);
+  if (sim->nodes == NULL)
+  {
+    return false;
+  }
+  memset(sim->nodes, 0, size);
+  sim->quantum = NO_EVENT;
+  sim->placed = true; // Nothing to apply until cosim_set_placement()
+
+  Mcu *prev = mcu;
+  for (uint32_t i = 0; i < node_count; i++)
+  {
+    Cosim_Node *node = &sim->nodes[i];
+    node->mcu = mcu_create_config(config);
+    if (node->mcu == NULL)
+    {
+      break;
+    }
+    sim->node_count++;
+    node->index = i;
+    node->cpu = -1;
+    node->sim = sim;
+    mcu_select(node->mcu);
+    if (!uart_init(&node->uart, uart_base))
+    {
+      break;
+    }
+    uart_set_tx_hook(&node->uart, cosim_transmit, node);
+  }
+  mcu_select(prev);
+
+  if (sim->node_count != node_count)
+  {
+    cosim_destroy(sim);
+    return false;
+  }
+  return true;
+}
+
+void cosim_destroy(Cosim *sim)
+{
+  Mcu *prev = mcu;
+  for (uint32_t i = 0; i < sim->node_count; i++)
+  {
+    mcu_select(sim->nodes[i].mcu);
+    uart_detach(&sim->nodes[i].uart);
+    mcu_destroy(sim->nodes[i].mcu); // Selects the default instance
+  }
+  mcu_select(prev);
+  for (uint32_t i = 0; i < sim->link_count; i++)
+  {
+    munmap(sim->links[i], sizeof(Cosim_Link));
+  }
+  free(sim->nodes);
+  memset(sim, 0, sizeof(*sim));
+}
+
+/**
+ * @brief Adds a one-way serial link from node from's UART TX to node to's UART RX.
+ *
+ * Several links may leave one node (its bytes go to all of them, like a shared
+ * line) and several may enter one node (their bytes are merged by arrival
+ * cycle). The smallest latency sets the synchronisation window.
+ *
+ * @param latency Cycles from the DR write to the byte appearing at the receiver.
+ * @return false for an invalid node, a zero latency or too many links.
+ */
+bool cosim_connect(Cosim *sim, uint32_t from, uint32_t to, uint64_t latency)
+{
+  if (from >= sim->node_count || to >= sim->node_count || latency == 0 ||
+      sim->nodes[from].out_count == COSIM_MAX_PORTS || sim->nodes[to].in_count == COSIM_MAX_PORTS)
+  {
+    return false;
+  }
+  // A mapping of its own, so COSIM_LOCAL_MEMORY can move it to the receiver
+  Cosim_Link *link = mmap(NULL, sizeof(Cosim_Link), PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (link == MAP_FAILED)
+  {
+    return false;
+  }
+  atomic_init(&link->head, 0);
+  atomic_init(&link->tail, 0);
+  link->latency = latency;
+  link->dropped = 0;
+
+  sim->links[sim->link_count++] = link;
+  sim->nodes[from].out[sim->nodes[from].out_count++] = link;
+  sim->nodes[to].in[sim->nodes[to].in_count++] = link;
+  if (latency < sim->quantum)
+  {
+    sim->quantum = latency;
+  }
+  return true;
+}
+
+// Resets a node from its freshly loaded vector table; R0 holds the node index
+static void cosim_reset_node(Cosim_Node *node)
+{
+  cpu_reset(&node->mcu->cpu);
+  node->mcu->cpu.R[0] = node->index;
+  node->halted = false;
+  node->reason = STOP_NONE;
+}
+
+/**
+ * @brief Copies a raw image to the start of a node's Flash and resets the node.
+ */
+bool cosim_load_image(Cosim *sim, uint32_t node, const void *image, uint32_t len)
+{
+  if (node >= sim->node_count)
+  {
+    return false;
+  }
+  Mcu *prev = mcu;
+  mcu_select(sim->nodes[node].mcu);
+  bool ok = mem_write_block(FLASH_BASE, image, len);
+  if (ok)
+  {
+    load_vector_table((uint32_t *)Flash);
+    cosim_reset_node(&sim->nodes[node]);
+  }
+  mcu_select(prev);
+  return ok;
+}
+
+/**
+ * @brief Maps one Flash image into every node and resets them.
+ *
+ * The nodes share the image's pages until they write to Flash.
+ */
+bool cosim_load_shared(Cosim *sim, const Flash_Image *image)
+{
+  Mcu *prev = mcu;
+  bool ok = true;
+  for (uint32_t i = 0; i < sim->node_count && ok; i++)
+  {
+    mcu_select(sim->nodes[i].mcu);
+    ok = mcu_map_flash(mcu, image);
+    if (ok)
+    {
+      load_vector_table((uint32_t *)Flash);
+      cosim_reset_node(&sim->nodes[i]);
+    }
+  }
+  mcu_select(prev);
+  return ok;
+}
+
+/*
+ * Built-in workload: node 0 sends a zero byte, then every node polls its
+ * UART, increments each byte it receives and sends it on. R6 counts the
+ * bytes a node has received, R0 holds the last value it sent.
+ */
+static const uint16_t token_ring_code[] = {
+  0x2140, // MOVS r1, #0x40
+  0x0609, // LSLS r1, r1, #24
+  0x2244, // MOVS r2, #0x44
+  0x0212, // LSLS r2, r2, #8
+  0x1889, // ADDS r1, r1, r2     ; r1 = UART_DEFAULT_BASE
+  0x2204, // MOVS r2, #UART_DR
+  0x2300, // MOVS r3, #UART_SR
+  0x2520, // MOVS r5, #UART_SR_RXNE
+  0x2701, // MOVS r7, #1
+  0x2600, // MOVS r6, #0
+  0x4298, // CMP r0, r3          ; node 0 starts the token
+  0xD100, // BNE poll
+  0x508B, // STR r3, [r1, r2]
+  0x58CC, // poll: LDR r4, [r1, r3]
+  0x422C, // TST r4, r5
+  0xD0FC, // BEQ poll
+  0x5888, // LDR r0, [r1, r2]
+  0x19C0, // ADDS r0, r0, r7
+  0x19F6, // ADDS r6, r6, r7
+  0x5088, // STR r0, [r1, r2]
+  0xE7F7, // B poll
+};
+
+#define TOKEN_RING_ENTRY 0xC0 // First word after the vector table
+
+/**
+ * @brief Loads the built-in token-passing program into every node.
+ *
+ * Intended for a ring topology with the UARTs at UART_DEFAULT_BASE. The
+ * nodes share one Flash image.
+ */
+bool cosim_load_token_ring(Cosim *sim)
+{
+  uint8_t image[TOKEN_RING_ENTRY + sizeof(token_ring_code)] = {0};
+  uint32_t vectors[2] = {SRAM_BASE + SRAM_SIZE, TOKEN_RING_ENTRY | 1};
+  memcpy(image, vectors, sizeof(vectors));
+  memcpy(image + TOKEN_RING_ENTRY, token_ring_code, sizeof(token_ring_code));
+
+  Flash_Image flash;
+  if (!flash_image_create(&flash, image, sizeof(image)))
+  {
+    return false;
+  }
+  bool ok = cosim_load_shared(sim, &flash);
+  flash_image_release(&flash);
+  return ok;
+}
+
+// NUMA node of a host CPU, from sysfs (0 without NUMA information)
+static int cpu_numa_node(int cpu)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  DIR *dir = opendir(path);
+  int node = 0;
+  struct dirent *e;
+  while (dir && (e = readdir(dir)) != NULL)
+  {
+    if (strncmp(e->d_name, "node", 4) == 0 && e->d_name[4] >= '0' && e->d_name[4] <= '9')
+    {
+      node = atoi(e->d_name + 4);
+      break;
+    }
+  }
+  if (dir)
+  {
+    closedir(dir);
+  }
+  return node;
+}
+
+/*
+ * Gives node i the CPU at position i * cpus / nodes of the allowed CPUs
+ * sorted by NUMA node: nodes spread over every CPU, and neighbours in a
+ * ring or chain (the usual topologies) land on the same NUMA node, so most
+ * links stay local too. Memory is then bound to the CPU's node; links are
+ * bound to the receiver, which polls them at every window.
+ */
+static void cosim_place(Cosim *sim)
+{
+  static int cpus[CPU_SETSIZE], numa[CPU_SETSIZE];
+  cpu_set_t allowed;
+  int count = 0;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+  {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+      if (!CPU_ISSET(cpu, &allowed))
+      {
+        continue;
+      }
+      int node = cpu_numa_node(cpu), k = count++;
+      for (; k > 0 && numa[k - 1] > node; k--) // Stable insertion by node
+      {
+        cpus[k] = cpus[k - 1];
+        numa[k] = numa[k - 1];
+      }
+      cpus[k] = cpu;
+      numa[k] = node;
+    }
+  }
+
+  bool pin = sim->placement & (COSIM_PIN | COSIM_LOCAL_MEMORY);
+  bool local = sim->placement & COSIM_LOCAL_MEMORY;
+  bool huge = sim->placement & COSIM_HUGE_PAGES;
+  for (uint32_t i = 0; i < sim->node_count; i++)
+  {
+    Cosim_Node *node = &sim->nodes[i];
+    int k = count ? (int)((uint64_t)i * count / sim->node_count) : -1;
+    node->cpu = pin && k >= 0 ? cpus[k] : -1;
+    int target = local && k >= 0 ? numa[k] : -1;
+    if (!mcu_place(node->mcu, target, huge) && target >= 0)
+    {
+      sim->unbound = true;
+    }
+    for (uint32_t j = 0; j < node->in_count && target >= 0; j++)
+    {
+      if (!mcu_bind_memory(node->in[j], sizeof(Cosim_Link), target))
+      {
+        sim->unbound = true;
+      }
+    }
+  }
+  sim->placed = true;
+}
+
+/**
+ * @brief Chooses how parallel runs place node threads and memory.
+ *
+ * flags combines COSIM_PIN, COSIM_LOCAL_MEMORY and COSIM_HUGE_PAGES (0, the
+ * default, lets threads float and leaves memory where it was first touched).
+ * The placement is applied once, when the next parallel cosim_run() starts;
+ * if the kernel refuses to move memory, `unbound` is set and the run goes on.
+ */
+void cosim_set_placement(Cosim *sim, unsigned flags)
+{
+  sim->placement = flags;
+  sim->placed = false;
+}
+
+/**
+ * @brief Advances every node by the given number of cycles.
+ *
+ * In parallel mode each node runs on its own host thread and the threads
+ * meet at a barrier once per window; otherwise the nodes take turns on the
+ * calling thread, window by window. Both modes produce the same result as
+ * long as no link overflows. Images must be loaded before the first run.
+ *
+ * @return false if the host threads could not be started.
+ */
+bool cosim_run(Cosim *sim, uint64_t cycles, bool parallel)
+{
+  if (sim->node_count == 0)
+  {
+    return true;
+  }
+  sim->end_cycle = sim->now + cycles;
+  if (sim->quantum == NO_EVENT)
+  {
+    sim->quantum = cycles ? cycles : 1; // No links: nothing to synchronise
+  }
+
+  if (!parallel)
+  {
+    Mcu *prev = mcu;
+    for (uint64_t t = sim->now; t < sim->end_cycle; t += sim->quantum)
+    {
+      uint64_t end = t + sim->quantum < sim->end_cycle ? t + sim->quantum : sim->end_cycle;
+      for (uint32_t i = 0; i < sim->node_count; i++)
+      {
+        mcu_select(sim->nodes[i].mcu);
+        cosim_window(&sim->nodes[i], end);
+      }
+    }
+    mcu_select(prev);
+    sim->now = sim->end_cycle;
+    return true;
+  }
+
+  if (!sim->placed)
+  {
+    cosim_place(sim);
+  }
+  pthread_barrier_init(&sim->barrier, NULL, sim->node_count);
+  atomic_init(&sim->start_gate, 0);
+  uint32_t started = 0;
+  while (started < sim->node_count &&
+         pthread_create(&sim->nodes[started].thread, NULL, cosim_thread, &sim->nodes[started]) == 0)
+  {
+    started++;
+  }
+  atomic_store_explicit(&sim->start_gate, started == sim->node_count ? 1 : -1, memory_order_release);
+  for (uint32_t i = 0; i < started; i++)
+  {
+    pthread_join(sim->nodes[i].thread, NULL);
+  }
+  pthread_barrier_destroy(&sim->barrier);
+  if (started != sim->node_count)
+  {
+    printf("Cannot start co-simulation threads\n");
+    return false;
+  }
+  sim->now = sim->end_cycle;
+  return true;
+}
@@ -0,0 +1,834 @@
+#include "coverage.h"
+#include "mcu.h"
+#include "mem_ops.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+/**
+ * @brief Starts collecting coverage of the selected instance's Flash.
+ *
+ * Every later cpu_run() on the instance records the blocks it executes
+ * until coverage_stop().
+ *
+ * @return false if coverage is already being collected or allocation fails.
+ */
+bool coverage_start(void)
+{
+  if (mcu->coverage)
+  {
+    printf("Coverage is already being collected\n");
+    return false;
+  }
+  const Mem_Region *flash = &mcu->regions[REGION_FLASH];
+  Coverage *c = calloc(1, sizeof(*c));
+  if (c == NULL)
+  {
+    return false;
+  }
+  c->flash_base = flash->base;
+  c->flash_size = flash->size;
+  c->words = (flash->size / 2 + COV_HALFWORDS_PER_WORD - 1) / COV_HALFWORDS_PER_WORD;
+  c->map = calloc(c->words ? c->words : 1, sizeof(uint64_t));
+  if (c->map == NULL)
+  {
+    free(c);
+    return false;
+  }
+  c->entry = c->next = 1; // Never a valid PC, so the first run starts a block
+  mcu->coverage = c;
+  return true;
+}
+
+void coverage_stop(void)
+{
+  if (mcu->coverage)
+  {
+    free(mcu->coverage->map);
+    free(mcu->coverage);
+    mcu->coverage = NULL;
+  }
+}
+
+/**
+ * @brief Forgets the coverage of the halfwords in [start, end), whose code
+ *        was replaced (see reload_image()).
+ */
+void coverage_invalidate(Coverage *c, uint32_t start, uint32_t end)
+{
+  uint32_t limit = c->flash_size >> 1;
+  for (uint32_t h = (start - c->flash_base) >> 1; h < ((end - c->flash_base) >> 1) && h < limit; h++)
+  {
+    c->map[h / COV_HALFWORDS_PER_WORD] &= ~(0xFull << (h % COV_HALFWORDS_PER_WORD * 4));
+  }
+  c->entry = c->next = 1; // The block in progress may lie in the old code
+}
+
+/**
+ * @brief ORs one coverage map into another of the same image.
+ */
+void coverage_merge(uint64_t *dst, const uint64_t *src, size_t words)
+{
+  mem_ops_or((uint8_t *)dst, (const uint8_t *)src, words * sizeof(uint64_t));
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    p[i] = (uint8_t)(v >> (8 * i));
+  }
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * @brief Merges the selected instance's coverage into a file.
+ *
+ * The file is created if needed; a file written for another Flash map is
+ * replaced. It is locked while it is updated, so runs in parallel processes
+ * can all save into the same file.
+ *
+ * @return false if no coverage is being collected or the file cannot be written.
+ */
+bool coverage_save(const char *path)
+{
+  const Coverage *c = mcu->coverage;
+  if (c == NULL)
+  {
+    return false;
+  }
+  int fd = open(path, O_RDWR | O_CREAT, 0666);
+  if (fd < 0 || flock(fd, LOCK_EX) != 0)
+  {
+    printf("Cannot open coverage file %s\n", path);
+    if (fd >= 0) close(fd);
+    return false;
+  }
+  size_t bytes = c->words * sizeof(uint64_t);
+  uint64_t *map = malloc(bytes ? bytes : 1);
+  uint8_t header[16];
+  bool ok = map != NULL;
+  if (ok)
+  {
+    memcpy(map, c->map, bytes);
+    uint64_t *old = malloc(bytes ? bytes : 1);
+    if (old && pread(fd, header, sizeof(header), 0) == sizeof(header) &&
+        memcmp(header, COVERAGE_HEADER, 8) == 0 && get_u32(header + 8) == c->flash_base &&
+        get_u32(header + 12) == c->flash_size && pread(fd, old, bytes, sizeof(header)) == (ssize_t)bytes)
+    {
+      coverage_merge(map, old, c->words);
+    }
+    free(old);
+    memcpy(header, COVERAGE_HEADER, 8);
+    put_u32(header + 8, c->flash_base);
+    put_u32(header + 12, c->flash_size);
+    ok = pwrite(fd, header, sizeof(header), 0) == sizeof(header) &&
+         pwrite(fd, map, bytes, sizeof(header)) == (ssize_t)bytes &&
+         ftruncate(fd, sizeof(header) + bytes) == 0;
+  }
+  free(map);
+  if (close(fd) != 0 || !ok) // Closing releases the lock
+  {
+    printf("Cannot write coverage file %s\n", path);
+    return false;
+  }
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ * lcov export: ELF sections, ARM mapping symbols and the DWARF line table
+ * ------------------------------------------------------------------------- */
+
+// Local DWARF constants, so the build needs no dwarf.h
+enum {
+  DW_FORM_block = 0x09, DW_FORM_data1 = 0x0b, DW_FORM_data2 = 0x05, DW_FORM_data4 = 0x06,
+  DW_FORM_data8 = 0x07, DW_FORM_data16 = 0x1e, DW_FORM_string = 0x08, DW_FORM_strp = 0x0e,
+  DW_FORM_udata = 0x0f, DW_FORM_line_strp = 0x1f,
+  DW_LNCT_path = 1, DW_LNCT_directory_index = 2,
+  DW_LNS_copy = 1, DW_LNS_advance_pc = 2, DW_LNS_advance_line = 3, DW_LNS_set_file = 4,
+  DW_LNS_const_add_pc = 8, DW_LNS_fixed_advance_pc = 9,
+  DW_LNE_end_sequence = 1, DW_LNE_set_address = 2,
+};
+
+typedef struct {
+  uint8_t *data;
+  size_t size;
+  const Elf32_Shdr *sections;
+  uint32_t section_count;
+  const char *section_names;
+  uint32_t section_names_size;
+} Elf_Image;
+
+typedef struct {
+  uint32_t addr;
+  bool data; // $d: literal pool or other data in a code section
+} Map_Symbol;
+
+typedef struct {
+  uint32_t addr;
+  uint32_t file; // Index into Line_Table.files
+  uint32_t line;
+  bool end;      // End of a sequence: addr is one past its last byte
+} Line_Row;
+
+typedef struct {
+  char **files;
+  uint32_t file_count;
+  Line_Row *rows;
+  size_t row_count, row_cap;
+} Line_Table;
+
+// One DA (line) or BRDA pair (Bcond) of the report
+typedef struct {
+  uint32_t file, line, addr;
+  bool branch;
+  uint8_t state; // COV_* bits
+} Lcov_Entry;
+
+static bool elf_open(const char *path, Elf_Image *elf)
+{
+  memset(elf, 0, sizeof(*elf));
+  FILE *f = fopen(path, "rb");
+  if (f == NULL)
+  {
+    printf("Cannot open %s\n", path);
+    return false;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  rewind(f);
+  elf->data = size > 0 ? malloc(size) : NULL;
+  bool ok = elf->data && fread(elf->data, 1, size, f) == (size_t)size;
+  fclose(f);
+  elf->size = ok ? (size_t)size : 0;
+
+  const Elf32_Ehdr *eh = (const Elf32_Ehdr *)elf->data;
+  ok = ok && elf->size >= sizeof(*eh) && memcmp(eh->e_ident, ELFMAG, SELFMAG) == 0 &&
+       eh->e_ident[EI_CLASS] == ELFCLASS32 && eh->e_ident[EI_DATA] == ELFDATA2LSB &&
+       eh->e_machine == EM_ARM && eh->e_shentsize == sizeof(Elf32_Shdr) &&
+       eh->e_shoff + (uint64_t)eh->e_shnum * sizeof(Elf32_Shdr) <= elf->size &&
+       eh->e_shstrndx < eh->e_shnum;
+  if (ok)
+  {
+    elf->sections = (const Elf32_Shdr *)(elf->data + eh->e_shoff);
+    elf->section_count = eh->e_shnum;
+    const Elf32_Shdr *names = &elf->sections[eh->e_shstrndx];
+    ok = names->sh_offset + (uint64_t)names->sh_size <= elf->size;
+    elf->section_names = (const char *)elf->data + names->sh_offset;
+    elf->section_names_size = names->sh_size;
+  }
+  for (uint32_t i = 0; ok && i < elf->section_count; i++)
+  {
+    const Elf32_Shdr *s = &elf->sections[i];
+    ok = s->sh_type == SHT_NOBITS || s->sh_offset + (uint64_t)s->sh_size <= elf->size;
+  }
+  if (!ok)
+  {
+    printf("%s is not a 32-bit little-endian ARM ELF file\n", path);
+    free(elf->data);
+  }
+  return ok;
+}
+
+static const Elf32_Shdr *elf_section(const Elf_Image *elf, const char *name)
+{
+  for (uint32_t i = 0; i < elf->section_count; i++)
+  {
+    if (elf->sections[i].sh_name < elf->section_names_size &&
+        strcmp(elf->section_names + elf->sections[i].sh_name, name) == 0)
+    {
+      return &elf->sections[i];
+    }
+  }
+  return NULL;
+}
+
+// Reads the code halfword at addr from an executable section
+static bool elf_code16(const Elf_Image *elf, uint32_t addr, uint16_t *value)
+{
+  for (uint32_t i = 0; i < elf->section_count; i++)
+  {
+    const Elf32_Shdr *s = &elf->sections[i];
+    if (s->sh_type == SHT_PROGBITS && (s->sh_flags & SHF_EXECINSTR) &&
+        addr - s->sh_addr < s->sh_size && s->sh_size - (addr - s->sh_addr) >= 2)
+    {
+      const uint8_t *p = elf->data + s->sh_offset + (addr - s->sh_addr);
+      *value = p[0] | (p[1] << 8);
+      return true;
+    }
+  }
+  return false;
+}
+
+static int map_symbol_cmp(const void *a, const void *b)
+{
+  uint32_t x = ((const Map_Symbol *)a)->addr, y = ((const Map_Symbol *)b)->addr;
+  return (x > y) - (x < y);
+}
+
+// Collects the $t/$a/$d mapping symbols that tell code from data
+static Map_Symbol *elf_mapping_symbols(const Elf_Image *elf, size_t *count)
+{
+  *count = 0;
+  const Elf32_Shdr *symtab = elf_section(elf, ".symtab");
+  if (symtab == NULL || symtab->sh_link >= elf->section_count)
+  {
+    return NULL;
+  }
+  const Elf32_Sym *syms = (const Elf32_Sym *)(elf->data + symtab->sh_offset);
+  size_t n = symtab->sh_size / sizeof(Elf32_Sym);
+  const Elf32_Shdr *strtab = &elf->sections[symtab->sh_link];
+  Map_Symbol *out = malloc((n ? n : 1) * sizeof(*out));
+  for (size_t i = 0; out && i < n; i++)
+  {
+    if (syms[i].st_name >= strtab->sh_size)
+    {
+      continue;
+    }
+    const char *name = (const char *)elf->data + strtab->sh_offset + syms[i].st_name;
+    if (name[0] == '$' && strchr("tad", name[1]) && name[1] && (name[2] == '\0' || name[2] == '.'))
+    {
+      out[(*count)++] = (Map_Symbol){syms[i].st_value & ~1u, name[1] == 'd'};
+    }
+  }
+  if (out)
+  {
+    qsort(out, *count, sizeof(*out), map_symbol_cmp);
+  }
+  return out;
+}
+
+static bool is_data(const Map_Symbol *syms, size_t count, uint32_t addr)
+{
+  size_t lo = 0, hi = count; // Last symbol at or below addr
+  while (lo < hi)
+  {
+    size_t mid = (lo + hi) / 2;
+    if (syms[mid].addr <= addr) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo > 0 && syms[lo - 1].data;
+}
+
+typedef struct {
+  const uint8_t *p, *end;
+  bool error;
+} Reader;
+
+static uint64_t read_uleb(Reader *r)
+{
+  uint64_t v = 0;
+  for (int shift = 0; r->p < r->end; shift += 7)
+  {
+    uint8_t b = *r->p++;
+    if (shift < 64) v |= (uint64_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) return v;
+  }
+  r->error = true;
+  return 0;
+}
+
+static int64_t read_sleb(Reader *r)
+{
+  int64_t v = 0;
+  int shift = 0;
+  for (; r->p < r->end; shift += 7)
+  {
+    uint8_t b = *r->p++;
+    if (shift < 64) v |= (int64_t)(b & 0x7F) << shift;
+    if (!(b & 0x80))
+    {
+      if (shift + 7 < 64 && (b & 0x40)) v |= -((int64_t)1 << (shift + 7));
+      return v;
+    }
+  }
+  r->error = true;
+  return 0;
+}
+
+static uint64_t read_fixed(Reader *r, int size)
+{
+  if (r->end - r->p < size)
+  {
+    r->error = true;
+    r->p = r->end;
+    return 0;
+  }
+  uint64_t v = 0;
+  for (int i = 0; i < size; i++)
+  {
+    v |= (uint64_t)r->p[i] << (8 * i);
+  }
+  r->p += size;
+  return v;
+}
+
+static const char *read_string(Reader *r)
+{
+  const char *s = (const char *)r->p;
+  const uint8_t *nul = memchr(r->p, 0, r->end - r->p);
+  if (nul == NULL)
+  {
+    r->error = true;
+    r->p = r->end;
+    return "";
+  }
+  r->p = nul + 1;
+  return s;
+}
+
+static const char *section_string(const Elf_Image *elf, const Elf32_Shdr *s, uint64_t offset)
+{
+  if (s == NULL || offset >= s->sh_size ||
+      memchr(elf->data + s->sh_offset + offset, 0, s->sh_size - offset) == NULL)
+  {
+    return "";
+  }
+  return (const char *)elf->data + s->sh_offset + offset;
+}
+
+// Reads one DWARF 5 entry attribute; strings go to *str, numbers to *num
+static void read_form(Reader *r, const Elf_Image *elf, uint64_t form, const char **str, uint64_t *num)
+{
+  switch (form)
+  {
+  case DW_FORM_string: *str = read_string(r); break;
+  case DW_FORM_line_strp: *str = section_string(elf, elf_section(elf, ".debug_line_str"), read_fixed(r, 4)); break;
+  case DW_FORM_strp: *str = section_string(elf, elf_section(elf, ".debug_str"), read_fixed(r, 4)); break;
+  case DW_FORM_udata: *num = read_uleb(r); break;
+  case DW_FORM_data1: *num = read_fixed(r, 1); break;
+  case DW_FORM_data2: *num = read_fixed(r, 2); break;
+  case DW_FORM_data4: *num = read_fixed(r, 4); break;
+  case DW_FORM_data8: *num = read_fixed(r, 8); break;
+  case DW_FORM_data16: read_fixed(r, 8); read_fixed(r, 8); break;
+  case DW_FORM_block:
+  {
+    uint64_t len = read_uleb(r);
+    if (len > (uint64_t)(r->end - r->p))
+    {
+      r->error = true;
+      len = r->end - r->p;
+    }
+    r->p += len;
+    break;
+  }
+  default: r->error = true; break;
+  }
+}
+
+// Returns the index of path in the table, adding it if it is new
+static uint32_t table_file(Line_Table *t, const char *dir, const char *name)
+{
+  char path[1024];
+  if (name[0] == '/' || dir == NULL || dir[0] == '\0')
+  {
+    snprintf(path, sizeof(path), "%s", name);
+  }
+  else
+  {
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+  }
+  for (uint32_t i = 0; i < t->file_count; i++)
+  {
+    if (strcmp(t->files[i], path) == 0)
+    {
+      return i;
+    }
+  }
+  char **files = realloc(t->files, (t->file_count + 1) * sizeof(char *));
+  char *copy = strdup(path);
+  if (files == NULL || copy == NULL)
+  {
+    if (files) t->files = files;
+    free(copy);
+    return 0;
+  }
+  t->files = files;
+  t->files[t->file_count] = copy;
+  return t->file_count++;
+}
+
+static void table_row(Line_Table *t, uint32_t addr, uint32_t file, uint32_t line, bool end)
+{
+  if (t->row_count == t->row_cap)
+  {
+    size_t cap = t->row_cap ? t->row_cap * 2 : 256;
+    Line_Row *rows = realloc(t->rows, cap * sizeof(Line_Row));
+    if (rows == NULL)
+    {
+      return;
+    }
+    t->rows = rows;
+    t->row_cap = cap;
+  }
+  t->rows[t->row_count++] = (Line_Row){addr, file, line, end};
+}
+
+/**
+ * @brief Runs one line-number program (DWARF 2 to 5) and appends its rows.
+ *
+ * @return Pointer past the unit, or NULL if it cannot be parsed.
+ */
+static const uint8_t *line_unit(const Elf_Image *elf, Line_Table *t, const uint8_t *p, const uint8_t *end)
+{
+  Reader r = {p, end, false};
+  uint64_t unit_length = read_fixed(&r, 4);
+  if (unit_length >= 0xFFFFFFF0 || unit_length > (uint64_t)(end - r.p))
+  {
+    return NULL; // 64-bit DWARF is not used for 32-bit targets
+  }
+  const uint8_t *unit_end = r.p + unit_length;
+  r.end = unit_end;
+  unsigned version = read_fixed(&r, 2);
+  if (version < 2 || version > 5)
+  {
+    return NULL;
+  }
+  if (version >= 5)
+  {
+    read_fixed(&r, 2); // Address and segment selector sizes
+  }
+  uint64_t header_length = read_fixed(&r, 4);
+  const uint8_t *program = r.p + header_length;
+  unsigned min_length = read_fixed(&r, 1);
+  if (version >= 4)
+  {
+    read_fixed(&r, 1); // Maximum operations per instruction (VLIW only)
+  }
+  bool default_stmt = read_fixed(&r, 1);
+  int line_base = (int8_t)read_fixed(&r, 1);
+  unsigned line_range = read_fixed(&r, 1);
+  unsigned opcode_base = read_fixed(&r, 1);
+  uint8_t opcode_lengths[256] = {0};
+  for (unsigned i = 1; i < opcode_base; i++)
+  {
+    opcode_lengths[i] = read_fixed(&r, 1);
+  }
+  if (r.error || line_range == 0 || program > unit_end)
+  {
+    return NULL;
+  }
+  (void)default_stmt;
+
+  // Directory and file tables; files maps the unit's file numbers to table indexes
+  const char *dirs[256] = {0};
+  uint32_t files[1024];
+  uint32_t dir_count = 0, file_count = 0;
+  if (version < 5)
+  {
+    dirs[dir_count++] = ""; // Directory 0 is the compilation directory
+    for (const char *d; *(d = read_string(&r)) && !r.error;)
+    {
+      if (dir_count < 256) dirs[dir_count++] = d;
+    }
+    files[file_count++] = 0; // File numbers start at 1
+    for (const char *name; *(name = read_string(&r)) && !r.error;)
+    {
+      uint64_t dir = read_uleb(&r);
+      read_uleb(&r); // Modification time
+      read_uleb(&r); // Length
+      if (file_count < 1024) files[file_count++] = table_file(t, dir < dir_count ? dirs[dir] : "", name);
+    }
+  }
+  else
+  {
+    for (int table = 0; table < 2 && !r.error; table++)
+    {
+      uint64_t format[16][2];
+      unsigned format_count = read_fixed(&r, 1);
+      for (unsigned i = 0; i < format_count; i++)
+      {
+        uint64_t type = read_uleb(&r), form = read_uleb(&r);
+        if (i < 16) format[i][0] = type, format[i][1] = form;
+      }
+      uint64_t count = read_uleb(&r);
+      for (uint64_t n = 0; n < count && format_count <= 16 && !r.error; n++)
+      {
+        const char *path = "";
+        uint64_t dir = 0;
+        for (unsigned i = 0; i < format_count; i++)
+        {
+          const char *s = "";
+          uint64_t v = 0;
+          read_form(&r, elf, format[i][1], &s, &v);
+          if (format[i][0] == DW_LNCT_path) path = s;
+          if (format[i][0] == DW_LNCT_directory_index) dir = v;
+        }
+        if (table == 0 && dir_count < 256)
+        {
+          dirs[dir_count++] = path;
+        }
+        else if (table == 1 && file_count < 1024)
+        {
+          files[file_count++] = table_file(t, dir < dir_count ? dirs[dir] : "", path);
+        }
+      }
+    }
+  }
+  if (r.error)
+  {
+    return NULL;
+  }
+
+  // The line-number state machine; only address, file, line and end matter here
+  r.p = program;
+  uint32_t addr = 0, file = 1, line = 1;
+  while (r.p < unit_end && !r.error)
+  {
+    uint8_t op = *r.p++;
+    if (op >= opcode_base)
+    {
+      unsigned adjusted = op - opcode_base;
+      addr += (adjusted / line_range) * min_length;
+      line += line_base + (int)(adjusted % line_range);
+      table_row(t, addr, file < file_count ? files[file] : 0, line, false);
+      continue;
+    }
+    switch (op)
+    {
+    case 0: // Extended opcode
+    {
+      uint64_t len = read_uleb(&r);
+      const uint8_t *next = r.p + len;
+      if (len == 0 || len > (uint64_t)(unit_end - r.p))
+      {
+        return NULL;
+      }
+      uint8_t sub = *r.p++;
+      if (sub == DW_LNE_end_sequence)
+      {
+        table_row(t, addr, 0, 0, true);
+        addr = 0, file = 1, line = 1;
+      }
+      else if (sub == DW_LNE_set_address)
+      {
+        addr = (uint32_t)read_fixed(&r, 4);
+      }
+      r.p = next;
+      break;
+    }
+    case DW_LNS_copy: table_row(t, addr, file < file_count ? files[file] : 0, line, false); break;
+    case DW_LNS_advance_pc: addr += read_uleb(&r) * min_length; break;
+    case DW_LNS_advance_line: line += read_sleb(&r); break;
+    case DW_LNS_set_file: file = read_uleb(&r); break;
+    case DW_LNS_const_add_pc: addr += ((255 - opcode_base) / line_range) * min_length; break;
+    case DW_LNS_fixed_advance_pc: addr += read_fixed(&r, 2); break;
+    default: // Column, statement flags, ISA and unknown opcodes: skip operands
+      for (unsigned i = 0; i < opcode_lengths[op]; i++)
+      {
+        read_uleb(&r);
+      }
+      break;
+    }
+  }
+  return r.error ? NULL : unit_end;
+}
+
+static int lcov_entry_cmp(const void *a, const void *b)
+{
+  const Lcov_Entry *x = a, *y = b;
+  if (x->file != y->file) return x->file < y->file ? -1 : 1;
+  if (x->line != y->line) return x->line < y->line ? -1 : 1;
+  if (x->branch != y->branch) return x->branch ? 1 : -1;
+  return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+static uint8_t coverage_at(const uint64_t *map, uint32_t base, uint32_t size, uint32_t addr)
+{
+  uint32_t h = (addr - base) >> 1;
+  if (addr - base >= size)
+  {
+    return 0;
+  }
+  return (map[h / COV_HALFWORDS_PER_WORD] >> ((h % COV_HALFWORDS_PER_WORD) * 4)) & 0xF;
+}
+
+static bool coverage_read(const char *path, uint64_t **map, uint32_t *base, uint32_t *size)
+{
+  FILE *f = fopen(path, "rb");
+  uint8_t header[16];
+  if (f == NULL || fread(header, 1, sizeof(header), f) != sizeof(header) ||
+      memcmp(header, COVERAGE_HEADER, 8) != 0)
+  {
+    printf("%s is not a coverage file\n", path);
+    if (f) fclose(f);
+    return false;
+  }
+  *base = get_u32(header + 8);
+  *size = get_u32(header + 12);
+  size_t words = (*size / 2 + COV_HALFWORDS_PER_WORD - 1) / COV_HALFWORDS_PER_WORD;
+  *map = malloc(words ? words * sizeof(uint64_t) : 1);
+  bool ok = *map && fread(*map, sizeof(uint64_t), words, f) == words;
+  fclose(f);
+  if (!ok)
+  {
+    printf("%s is truncated\n", path);
+    free(*map);
+  }
+  return ok;
+}
+
+static void lcov_write(FILE *out, const Line_Table *t, const Lcov_Entry *e, size_t count)
+{
+  fprintf(out, "TN:\n");
+  for (size_t i = 0; i < count;)
+  {
+    uint32_t file = e[i].file;
+    unsigned lines = 0, lines_hit = 0, branches = 0, branches_hit = 0;
+    fprintf(out, "SF:%s\n", t->files[file]);
+    while (i < count && e[i].file == file)
+    {
+      uint32_t line = e[i].line;
+      bool hit = false;
+      for (; i < count && e[i].file == file && e[i].line == line && !e[i].branch; i++)
+      {
+        hit |= e[i].state & COV_EXEC;
+      }
+      fprintf(out, "DA:%u,%d\n", line, hit);
+      lines++;
+      lines_hit += hit;
+      for (unsigned block = 0; i < count && e[i].file == file && e[i].line == line; i++, block++)
+      {
+        for (int taken = 1; taken >= 0; taken--)
+        {
+          uint8_t bit = taken ? COV_TAKEN : COV_NOT_TAKEN;
+          if (e[i].state & COV_EXEC)
+          {
+            fprintf(out, "BRDA:%u,%u,%d,%d\n", line, block, !taken, !!(e[i].state & bit));
+          }
+          else
+          {
+            fprintf(out, "BRDA:%u,%u,%d,-\n", line, block, !taken);
+          }
+          branches++;
+          branches_hit += !!(e[i].state & bit);
+        }
+      }
+    }
+    fprintf(out, "BRF:%u\nBRH:%u\nLF:%u\nLH:%u\nend_of_record\n", branches, branches_hit,
+            lines, lines_hit);
+  }
+}
+
+/**
+ * @brief Writes an lcov tracefile for a saved coverage map.
+ *
+ * Source lines come from the DWARF line table of the firmware's ELF file.
+ * A line counts as hit if any instruction generated for it was executed
+ * (hit counts are 0 or 1); every Bcond gives a taken and a not-taken
+ * branch. Data marked by $d mapping symbols (literal pools) is skipped.
+ * genhtml and other lcov consumers read the result directly.
+ *
+ * @return false if either file cannot be read.
+ */
+bool coverage_lcov(const char *cov_path, const char *elf_path, FILE *out)
+{
+  uint64_t *map;
+  uint32_t base, size;
+  if (!coverage_read(cov_path, &map, &base, &size))
+  {
+    return false;
+  }
+  Elf_Image elf;
+  if (!elf_open(elf_path, &elf))
+  {
+    free(map);
+    return false;
+  }
+  Line_Table t = {0};
+  const Elf32_Shdr *debug_line = elf_section(&elf, ".debug_line");
+  bool ok = debug_line != NULL;
+  if (ok)
+  {
+    const uint8_t *p = elf.data + debug_line->sh_offset;
+    const uint8_t *end = p + debug_line->sh_size;
+    while (p && p < end)
+    {
+      p = line_unit(&elf, &t, p, end);
+    }
+    ok = p == end;
+  }
+  if (!ok)
+  {
+    printf("%s has no usable DWARF line table (build with -g)\n", elf_path);
+  }
+
+  size_t sym_count;
+  Map_Symbol *syms = elf_mapping_symbols(&elf, &sym_count);
+  Lcov_Entry *entries = NULL;
+  size_t count = 0, cap = 0;
+  for (size_t i = 0; ok && i + 1 < t.row_count; i++)
+  {
+    const Line_Row *row = &t.rows[i];
+    if (row->end || row->line == 0)
+    {
+      continue;
+    }
+    // The row covers the instructions up to the next row of its sequence
+    Lcov_Entry line = {row->file, row->line, row->addr, false, 0};
+    bool code = false;
+    for (uint32_t addr = row->addr, next; addr < t.rows[i + 1].addr; addr = next)
+    {
+      uint16_t instr;
+      next = addr + 2;
+      if (is_data(syms, sym_count, addr) || !elf_code16(&elf, addr, &instr))
+      {
+        continue;
+      }
+      if ((instr >> 11) >= 0x1D) // First half of a 32-bit instruction
+      {
+        next = addr + 4;
+      }
+      uint8_t state = coverage_at(map, base, size, addr);
+      code = true;
+      line.state |= state & COV_EXEC;
+      if ((instr & 0xF000) == 0xD000 && ((instr >> 8) & 0xF) < 0xE)
+      {
+        if (count == cap)
+        {
+          cap = cap ? cap * 2 : 1024;
+          Lcov_Entry *grown = realloc(entries, cap * sizeof(*entries));
+          if (grown == NULL) { ok = false; break; }
+          entries = grown;
+        }
+        entries[count++] = (Lcov_Entry){row->file, row->line, addr, true, state};
+      }
+    }
+    if (ok && code)
+    {
+      if (count == cap)
+      {
+        cap = cap ? cap * 2 : 1024;
+        Lcov_Entry *grown = realloc(entries, cap * sizeof(*entries));
+        if (grown == NULL) { ok = false; break; }
+        entries = grown;
+      }
+      entries[count++] = line;
+    }
+  }
+  if (ok)
+  {
+    qsort(entries, count, sizeof(*entries), lcov_entry_cmp);
+    lcov_write(out, &t, entries, count);
+  }
+
+  free(entries);
+  free(syms);
+  for (uint32_t i = 0; i < t.file_count; i++)
+  {
+    free(t.files[i]);
+  }
+  free(t.files);
+  free(t.rows);
+  free(elf.data);
+  free(map);
+  return ok;
+}
@@ -1,8 +1,7 @@
 #include "cpu.h"
 #include "memory_file.h"
 #include "exception.h"
-
-uint8_t Stack[Stack_size];
+#include "mcu.h"
 
 /**
  * @brief Initializes the Cortex-M0 CPU structure.
@@ -19,8 +18,11 @@ void init_cpu(CortexM0_CPU *cpu)
   {
     cpu->R[i] = 0; // Clear all registers
   }
-  cpu->SP = Stack_size - 4;
+  cpu->SP = SRAM_BASE + mcu->regions[REGION_SRAM].size; // Full-descending stack from the top of SRAM
   cpu->APSR.all = 0; // Clear flags
+  cpu->exception_pending = 0;
+  cpu->ipsr = 0;
+  cpu->cycles = 0;
 }
 
 /**
@@ -56,28 +58,61 @@ void update_flags(CortexM0_CPU *cpu, uint32_t result, _Bool carry, _Bool overflo
   if ((result & (0x80000000)))
   {
     cpu->APSR.Bits.APSR_N = 1;
-    printf("a negative result \n");
+    TRACE("a negative result \n");
   }
   // Zero
   if (result == 0)
   {
     cpu->APSR.Bits.APSR_Z = 1;
-    printf("a zero result \n");
+    TRACE("a zero result \n");
   };
   // Carry
   if (carry)
   {
     cpu->APSR.Bits.APSR_C = 1;
-    printf("a carry result \n");
+    TRACE("a carry result \n");
   }
   // Overflow
   if (overflow)
   {
     cpu->APSR.Bits.APSR_V = 1;
-    printf("an overflowed result \n");
+    TRACE("an overflowed result \n");
   }
 }
 
+/**
+ * @brief Returns the APSR flags in architectural xPSR layout.
+ *
+ * N, Z, C and V are placed in bits 31..28 and the Thumb bit (24) is always
+ * set, as seen by a debugger.
+ *
+ * @param cpu Pointer to the CortexM0_CPU structure representing the CPU state.
+ * @return The xPSR value.
+ */
+uint32_t get_xpsr(CortexM0_CPU *cpu)
+{
+  return (cpu->APSR.Bits.APSR_N ? N_MASK : 0) |
+         (cpu->APSR.Bits.APSR_Z ? Z_MASK : 0) |
+         (cpu->APSR.Bits.APSR_C ? C_MASK : 0) |
+         (cpu->APSR.Bits.APSR_V ? V_MASK : 0) |
+         (1U << 24);
+}
+
+/**
+ * @brief Sets the APSR flags from an architectural xPSR value.
+ *
+ * @param cpu Pointer to the CortexM0_CPU structure representing the CPU state.
+ * @param xpsr The xPSR value; only bits 31..28 are used.
+ */
+void set_xpsr(CortexM0_CPU *cpu, uint32_t xpsr)
+{
+  cpu->APSR.all = 0;
+  cpu->APSR.Bits.APSR_N = (xpsr & N_MASK) != 0;
+  cpu->APSR.Bits.APSR_Z = (xpsr & Z_MASK) != 0;
+  cpu->APSR.Bits.APSR_C = (xpsr & C_MASK) != 0;
+  cpu->APSR.Bits.APSR_V = (xpsr & V_MASK) != 0;
+}
+
 /**
  * @brief Prints the current state of the Cortex-M0 CPU.
  *
@@ -102,37 +137,157 @@ void print_cpu_state(CortexM0_CPU *cpu)
 
 void cpu_reset(CortexM0_CPU *cpu)
 {
-  cpu->SP = vector_table[0];      // initilize stack pointer
-  cpu->PC = vector_table[1] & ~1; // Reset handler (bit0=0 for Thumb)
+  cpu->SP = mcu->vector_table[0];      // initilize stack pointer
+  cpu->PC = mcu->vector_table[1] & ~1; // Reset handler (bit0=0 for Thumb)
   cpu->APSR.all = 0;
+  cpu->exception_pending = 0;
+  cpu->ipsr = 0;
+  cpu->cycles = 0;
+  stack_mon_reset(&mcu->stack_mon, cpu->SP);
+}
+
+/**
+ * @brief Tells the stack monitor that SP is about to move down to sp.
+ *
+ * @return false if the push must not happen (SP limit crossed).
+ */
+static inline bool stack_push_ok(CortexM0_CPU *cpu, uint32_t sp)
+{
+  return sp >= mcu->stack_mon.low || stack_mon_new_low(cpu, sp);
 }
 
+/**
+ * @brief Stores consecutive words with one bounds/alignment check and one copy.
+ *
+ * @param addr  Guest address of the first word (must be word aligned).
+ * @param words Words to store, lowest address first.
+ * @param count Number of words.
+ * @return false if the range is misaligned or not fully mapped; nothing is
+ *         written in that case.
+ */
+static bool store_block(uint32_t addr, const uint32_t *words, uint32_t count)
+{
+  if (addr & 3)
+  {
+    return false;
+  }
+  uint8_t *p = translate_guest_write(addr, count * WORD_SIZE);
+  if (p == NULL)
+  {
+    return false;
+  }
+  for (uint32_t i = 0; i < count; i++)
+  {
+    host_store32(p + i * WORD_SIZE, words[i]);
+  }
+  for (uint32_t i = 0; mcu->tracing && i < count; i++)
+  {
+    trace_access(true, addr + i * WORD_SIZE, WORD_SIZE, words[i]);
+  }
+  return true;
+}
+
+/**
+ * @brief Loads consecutive words with one bounds/alignment check and one copy.
+ *
+ * @param addr  Guest address of the first word (must be word aligned).
+ * @param words Receives the words, lowest address first.
+ * @param count Number of words.
+ * @return false if the range is misaligned or not fully mapped.
+ */
+static bool load_block(uint32_t addr, uint32_t *words, uint32_t count)
+{
+  if (addr & 3)
+  {
+    return false;
+  }
+  uint8_t *p = translate_guest(addr, count * WORD_SIZE);
+  if (p == NULL)
+  {
+    return false;
+  }
+  for (uint32_t i = 0; i < count; i++)
+  {
+    words[i] = host_load32(p + i * WORD_SIZE);
+  }
+  for (uint32_t i = 0; mcu->tracing && i < count; i++)
+  {
+    trace_access(false, addr + i * WORD_SIZE, WORD_SIZE, words[i]);
+  }
+  return true;
+}
+
+/**
+ * @brief Takes an exception: stacks the caller-saved frame and enters the handler.
+ *
+ * The stacked xPSR carries the flags and the interrupted exception number,
+ * LR is loaded with EXC_RETURN so the handler returns with BX LR or POP {PC}.
+ *
+ * @param cpu Pointer to the CortexM0_CPU structure representing the CPU state.
+ * @param exception_number Exception to enter (IRQ_BASE + n for external interrupt n).
+ */
 void exception_entry(CortexM0_CPU *cpu, uint8_t exception_number)
 {
-  // Push registers (simplified)
-  PUSH(cpu, cpu->APSR.all);
-  PUSH(cpu, cpu->PC);
-  PUSH(cpu, cpu->LR);
-  PUSH(cpu, cpu->R[12]);
-  PUSH(cpu, cpu->R[3]);
-  PUSH(cpu, cpu->R[2]);
-  PUSH(cpu, cpu->R[1]);
-  PUSH(cpu, cpu->R[0]);
-
-  // cpu->LR = 0xFFFFFFF9; // Return to Thread mode using MSP
-  cpu->PC = vector_table[exception_number] & ~1; // Jump to handler
+  // Stack the frame R0-R3, R12, LR, PC, xPSR with one block store
+  uint32_t frame[8] = {
+    cpu->R[0], cpu->R[1], cpu->R[2], cpu->R[3],
+    cpu->R[12], cpu->LR, cpu->PC, get_xpsr(cpu) | cpu->ipsr,
+  };
+  if (!stack_mon_enter(cpu, cpu->SP - sizeof(frame), exception_number))
+  {
+    if (exception_number >= IRQ_BASE)
+    {
+      nvic_set_pending(exception_number - IRQ_BASE); // Taken once the run resumes
+    }
+    return;
+  }
+  if (!store_block(cpu->SP - sizeof(frame), frame, 8))
+  {
+    raise_hardfault(cpu);
+    return;
+  }
+  cpu->SP -= sizeof(frame);
+  STATS_INC(exceptions);
+  latency_entry(cpu, exception_number, cpu->PC);
+
+  cpu->LR = EXC_RETURN_THREAD_MSP; // Return to Thread mode using MSP
+  cpu->PC = mcu->vector_table[exception_number] & ~1; // Jump to handler
+  cpu->ipsr = exception_number;
 }
 
+/**
+ * @brief Returns from an exception by unstacking the frame pushed on entry.
+ *
+ * Interrupts that became pending while the handler ran are re-checked
+ * before the next instruction.
+ *
+ * @param cpu Pointer to the CortexM0_CPU structure representing the CPU state.
+ */
 void exception_return(CortexM0_CPU *cpu)
 {
-  cpu->R[0] = POP(cpu);
-  cpu->R[1] = POP(cpu);
-  cpu->R[2] = POP(cpu);
-  cpu->R[3] = POP(cpu);
-  cpu->R[12] = POP(cpu);
-  cpu->LR = POP(cpu);
-  cpu->PC = POP(cpu);
-  cpu->APSR.all = POP(cpu);
+  uint32_t frame[8];
+  if (!load_block(cpu->SP, frame, 8))
+  {
+    raise_hardfault(cpu);
+    return;
+  }
+  stack_mon_exit();
+  latency_return(cpu);
+  cpu->SP += sizeof(frame);
+  cpu->R[0] = frame[0];
+  cpu->R[1] = frame[1];
+  cpu->R[2] = frame[2];
+  cpu->R[3] = frame[3];
+  cpu->R[12] = frame[4];
+  cpu->LR = frame[5];
+  cpu->PC = frame[6];
+  uint32_t xpsr = frame[7];
+  set_xpsr(cpu, xpsr);
+  cpu->ipsr = xpsr & 0x3F;
+  if (mcu->nvic_pending)
+  {
+    mcu->next_event_cycle = 0;
+  }
 }
 
 /**
@@ -275,7 +430,7 @@ void LDRB(CortexM0_CPU *cpu, uint8_t Rt, uint8_t Rn, uint8_t Rm)
   // Compute memory address
   uint32_t addr = cpu->R[Rm] + cpu->R[Rn];
 
-  int32_t value;
+  uint8_t value;
   if (!mem_read8(addr, &value))
   {
     raise_hardfault(cpu);
@@ -303,7 +458,7 @@ void LDRH(CortexM0_CPU *cpu, uint8_t Rt, uint8_t Rn, uint8_t Rm)
   // Compute memory address
   uint32_t addr = cpu->R[Rm] + cpu->R[Rn];
 
-  int32_t value;
+  uint16_t value;
   if (!mem_read16(addr, &value))
   {
     raise_hardfault(cpu);
@@ -329,7 +484,7 @@ void LDRSH(CortexM0_CPU *cpu, uint8_t Rt, uint8_t Rn, uint8_t Rm)
  check_Rt_validity(Rt, "LDRSH");
 
   uint32_t addr = cpu->R[Rn] + cpu->R[Rm];
-  int16_t halfword;
+  uint16_t halfword;
   
   if (!mem_read16(addr, &halfword))
   {
@@ -337,7 +492,7 @@ void LDRSH(CortexM0_CPU *cpu, uint8_t Rt, uint8_t Rn, uint8_t Rm)
     return;
   }
   
-  cpu->R[Rt] = (int32_t)halfword; // Sign-extend to 32-bit
+  cpu->R[Rt] = (int32_t)(int16_t)halfword; // Sign-extend to 32-bit
 }
 
 /**
@@ -359,16 +514,188 @@ void LDRSB(CortexM0_CPU *cpu, uint8_t Rt, uint8_t Rn, uint8_t Rm)
   // Compute memory address
   uint32_t addr = cpu->R[Rm] + cpu->R[Rn];
 
-  int8_t byte;
-  if (!mem_read16(addr, &byte))
+  uint8_t byte;
+  if (!mem_read8(addr, &byte))
   {
     raise_hardfault(cpu);
     return;
   }
   // Load signed 8-bit and sign-extend to 32-bit
-  cpu->R[Rt] = (int32_t)byte;
+  cpu->R[Rt] = (int32_t)(int8_t)byte;
+}
+
+
+/**
+ * @brief Pushes a word onto the full-descending stack.
+ *
+ * SP is decremented by 4 and the value is stored at the new SP. A failed
+ * store raises a HardFault and leaves SP unchanged.
+ *
+ * @param cpu Pointer to the CortexM0_CPU structure representing the CPU state.
+ * @param value The word to push.
+ */
+void PUSH(CortexM0_CPU *cpu, uint32_t value)
+{
+  if (!stack_push_ok(cpu, cpu->SP - 4))
+  {
+    return;
+  }
+  if (!mem_write32(cpu->SP - 4, value))
+  {
+    raise_hardfault(cpu);
+    return;
+  }
+  cpu->SP -= 4;
+}
+
+/**
+ * @brief Pops a word from the full-descending stack.
+ *
+ * The word at SP is loaded and SP is incremented by 4. A failed load raises
+ * a HardFault, leaves SP unchanged and returns 0.
+ *
+ * @param cpu Pointer to the CortexM0_CPU structure representing the CPU state.
+ * @return The popped word.
+ */
+uint32_t POP(CortexM0_CPU *cpu)
+{
+  uint32_t value;
+  if (!mem_read32(cpu->SP, &value))
+  {
+    raise_hardfault(cpu);
+    return 0;
+  }
+  cpu->SP += 4;
+  return value;
 }
 
+/**
+ * @brief Pushes a register list (PUSH {reglist}).
+ *
+ * Registers are stored lowest-numbered at the lowest address. The whole
+ * range below SP is validated once and written with a single copy; on a
+ * fault nothing is stored and SP is unchanged.
+ *
+ * @param cpu Pointer to the CortexM0_CPU structure representing the CPU state.
+ * @param reglist Bit n set pushes Rn (R0-R7 and LR for the Thumb encoding).
+ */
+void PUSH_LIST(CortexM0_CPU *cpu, uint16_t reglist)
+{
+  uint32_t words[16];
+  uint32_t count = 0;
+  for (int r = 0; r < 16; r++)
+  {
+    if (reglist & (1 << r))
+    {
+      words[count++] = cpu->R[r];
+    }
+  }
+  if (!stack_push_ok(cpu, cpu->SP - count * WORD_SIZE))
+  {
+    return;
+  }
+  if (!store_block(cpu->SP - count * WORD_SIZE, words, count))
+  {
+    raise_hardfault(cpu);
+    return;
+  }
+  cpu->SP -= count * WORD_SIZE;
+}
+
+/**
+ * @brief Pops a register list (POP {reglist}).
+ *
+ * The block at SP is validated and read with a single copy. Popping PC
+ * clears the Thumb bit, so EXC_RETURN values are recognised by the run loop.
+ *
+ * @param cpu Pointer to the CortexM0_CPU structure representing the CPU state.
+ * @param reglist Bit n set pops Rn (R0-R7 and PC for the Thumb encoding).
+ */
+void POP_LIST(CortexM0_CPU *cpu, uint16_t reglist)
+{
+  uint32_t words[16];
+  uint32_t count = __builtin_popcount(reglist);
+  if (!load_block(cpu->SP, words, count))
+  {
+    raise_hardfault(cpu);
+    return;
+  }
+  cpu->SP += count * WORD_SIZE;
+  uint32_t i = 0;
+  for (int r = 0; r < 15; r++)
+  {
+    if (reglist & (1 << r))
+    {
+      cpu->R[r] = words[i++];
+    }
+  }
+  if (reglist & (1 << 15))
+  {
+    cpu->PC = words[i] & ~1U;
+  }
+}
+
+/**
+ * @brief Store Multiple Increment After (STM Rn!, {reglist}).
+ *
+ * One range check and one copy for all registers; Rn is written back with
+ * the address after the last stored word.
+ *
+ * @param cpu Pointer to the CortexM0_CPU structure representing the CPU state.
+ * @param Rn  Base register index.
+ * @param reglist Bit n set stores Rn.
+ */
+void STM(CortexM0_CPU *cpu, uint8_t Rn, uint16_t reglist)
+{
+  uint32_t words[16];
+  uint32_t count = 0;
+  for (int r = 0; r < 16; r++)
+  {
+    if (reglist & (1 << r))
+    {
+      words[count++] = cpu->R[r];
+    }
+  }
+  if (!store_block(cpu->R[Rn], words, count))
+  {
+    raise_hardfault(cpu);
+    return;
+  }
+  cpu->R[Rn] += count * WORD_SIZE;
+}
+
+/**
+ * @brief Load Multiple Increment After (LDM Rn{!}, {reglist}).
+ *
+ * One range check and one copy for all registers. Rn is written back unless
+ * it is in the list, in which case it receives the loaded value.
+ *
+ * @param cpu Pointer to the CortexM0_CPU structure representing the CPU state.
+ * @param Rn  Base register index.
+ * @param reglist Bit n set loads Rn.
+ */
+void LDM(CortexM0_CPU *cpu, uint8_t Rn, uint16_t reglist)
+{
+  uint32_t words[16];
+  uint32_t count = __builtin_popcount(reglist);
+  if (!load_block(cpu->R[Rn], words, count))
+  {
+    raise_hardfault(cpu);
+    return;
+  }
+  if (!(reglist & (1 << Rn)))
+  {
+    cpu->R[Rn] += count * WORD_SIZE;
+  }
+  uint32_t i = 0;
+  for (int r = 0; r < 16; r++)
+  {
+    if (reglist & (1 << r))
+    {
+      cpu->R[r] = words[i++];
+    }
+  }
+}
 
 /**
  * @brief Move (immediate) writes an immediate value to the destination register. The condition flags are updated based on
@@ -431,7 +758,7 @@ void LSL(CortexM0_CPU *cpu, uint8_t Rd, uint8_t Rm, uint32_t immediate)
     cpu->R[Rd] = 0;
   }
 
-  update_flags(cpu, cpu->R[Rd], carry_out, 0);
+  update_flags(cpu, cpu->R[Rd], carry_out, cpu->APSR.Bits.APSR_V); // V is unchanged
   return;
 }
 
@@ -460,13 +787,14 @@ void LSR(CortexM0_CPU *cpu, uint8_t Rd, uint8_t Rm, uint32_t immediate)
     cpu->R[Rd] = (uint32_t)(cpu->R[Rm] >> shift);
   }
 
-  update_flags(cpu, cpu->R[Rd], carry_out, 0);
+  update_flags(cpu, cpu->R[Rd], carry_out, cpu->APSR.Bits.APSR_V); // V is unchanged
   return;
 }
 
 void raise_hardfault(CortexM0_CPU *cpu){
-  // cpu->exception_pending = HARDFAULT;
-  printf("HardFault raised due to invalid memory access or unaligned access.\n");
+  cpu->exception_pending = HARDFAULT;
+  STATS_INC(hardfaults);
+  TRACE("HardFault raised due to invalid memory access or unaligned access.\n");
   return;
 }
 
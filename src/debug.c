@@ -0,0 +1,167 @@
+#include "debug.h"
+#include "mcu.h"
+
+/**
+ * @brief Sets or clears the breakpoint bit of a halfword.
+ *
+ * @param addr Guest address of the instruction (must be halfword aligned).
+ * @param set  true to set the breakpoint, false to clear it.
+ * @return false if the address is unaligned or not mapped.
+ */
+static bool breakpoint_update(uint32_t addr, bool set)
+{
+  uint8_t *p = translate_range(addr, HALFWORD_SIZE);
+  if (p == NULL || (addr & 1))
+  {
+    return false;
+  }
+  uint32_t hw = (uint32_t)(p - mcu->memory) >> 1;
+  if (set)
+  {
+    mcu->bp_bitmap[hw >> 3] |= (1 << (hw & 7));
+  }
+  else
+  {
+    mcu->bp_bitmap[hw >> 3] &= ~(1 << (hw & 7));
+  }
+  return true;
+}
+
+bool breakpoint_set(uint32_t addr)
+{
+  return breakpoint_update(addr, true);
+}
+
+bool breakpoint_clear(uint32_t addr)
+{
+  return breakpoint_update(addr, false);
+}
+
+void breakpoints_clear_all(void)
+{
+  memset(mcu->bp_bitmap, 0, BP_BITMAP_BYTES(mcu->memory_size));
+}
+
+/**
+ * @brief Recomputes the PAGE_WATCHED flag of every page from the watchpoint list.
+ *
+ * Called whenever the list changes, which is rare compared to memory writes.
+ */
+static void watch_rebuild_page_flags(void)
+{
+  for (uint32_t i = 0; i < mcu->memory_size >> PAGE_SHIFT; i++)
+  {
+    if (mcu->page_flags[i] & PAGE_WATCHED) // Reading leaves untouched table pages uncommitted
+    {
+      mcu->page_flags[i] &= ~PAGE_WATCHED;
+    }
+  }
+  for (uint32_t i = 0; i < mcu->watchpoint_count; i++)
+  {
+    // A watched range may cross from one page into the next
+    for (uint32_t off = 0; off < mcu->watchpoints[i].len; off += PAGE_SIZE)
+    {
+      uint8_t *p = translate_address(mcu->watchpoints[i].addr + off);
+      if (p)
+      {
+        mcu->page_flags[(p - mcu->memory) >> PAGE_SHIFT] |= PAGE_WATCHED;
+      }
+    }
+    uint8_t *last = translate_address(mcu->watchpoints[i].addr + mcu->watchpoints[i].len - 1);
+    if (last)
+    {
+      mcu->page_flags[(last - mcu->memory) >> PAGE_SHIFT] |= PAGE_WATCHED;
+    }
+  }
+}
+
+/**
+ * @brief Adds a write watchpoint on the guest range [addr, addr + len).
+ *
+ * @return false if the range is empty, not mapped or the list is full.
+ */
+bool watchpoint_set(uint32_t addr, uint32_t len)
+{
+  if (len == 0 || translate_range(addr, len) == NULL || mcu->watchpoint_count == MAX_WATCHPOINTS)
+  {
+    return false;
+  }
+  mcu->watchpoints[mcu->watchpoint_count].addr = addr;
+  mcu->watchpoints[mcu->watchpoint_count].len = len;
+  mcu->watchpoint_count++;
+  watch_rebuild_page_flags();
+  return true;
+}
+
+/**
+ * @brief Removes the watchpoint starting at addr.
+ *
+ * @return false if no watchpoint starts at addr.
+ */
+bool watchpoint_clear(uint32_t addr)
+{
+  for (uint32_t i = 0; i < mcu->watchpoint_count; i++)
+  {
+    if (mcu->watchpoints[i].addr == addr)
+    {
+      mcu->watchpoints[i] = mcu->watchpoints[--mcu->watchpoint_count];
+      watch_rebuild_page_flags();
+      return true;
+    }
+  }
+  return false;
+}
+
+void watchpoints_clear_all(void)
+{
+  mcu->watchpoint_count = 0;
+  watch_rebuild_page_flags();
+}
+
+/**
+ * @brief Slow path for writes that land on a watched page.
+ *
+ * Compares the written range against every watchpoint and latches the first
+ * hit in watch_hit / watch_hit_addr for the run loop to report.
+ *
+ * @param addr Guest address of the write.
+ * @param size Size of the write in bytes.
+ */
+void watch_check(uint32_t addr, uint32_t size)
+{
+  for (uint32_t i = 0; i < mcu->watchpoint_count; i++)
+  {
+    if (addr < mcu->watchpoints[i].addr + mcu->watchpoints[i].len && mcu->watchpoints[i].addr < addr + size)
+    {
+      mcu->watch_hit = true;
+      mcu->watch_hit_addr = addr;
+      return;
+    }
+  }
+}
+
+void print_debug_points(void)
+{
+  for (uint32_t i = 0; i < BP_BITMAP_BYTES(mcu->memory_size); i++)
+  {
+    for (uint32_t bit = 0; mcu->bp_bitmap[i] >> bit; bit++)
+    {
+      if (!(mcu->bp_bitmap[i] & (1 << bit)))
+      {
+        continue;
+      }
+      uint32_t off = (i * 8 + bit) * 2;
+      for (int r = 0; r < MEM_REGIONS; r++)
+      {
+        if (off - mcu->regions[r].offset < mcu->regions[r].size)
+        {
+          printf("breakpoint 0x%08X\n", mcu->regions[r].base + (off - mcu->regions[r].offset));
+        }
+      }
+    }
+  }
+  for (uint32_t i = 0; i < mcu->watchpoint_count; i++)
+  {
+    printf("watchpoint 0x%08X len %u\n", mcu->watchpoints[i].addr, mcu->watchpoints[i].len);
+  }
+}
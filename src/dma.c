@@ -0,0 +1,212 @@
+#include "dma.h"
+#include "mmio.h"
+#include "events.h"
+#include "exception.h"
+#include "memory_file.h"
+
+#include <string.h>
+
+// One beat of guest memory as a value, in guest (little-endian) byte order
+static uint32_t dma_load(const uint8_t *p, uint32_t size)
+{
+  return size == 4 ? host_load32(p) : size == 2 ? host_load16(p) : p[0];
+}
+
+static void dma_store(uint8_t *p, uint32_t size, uint32_t value)
+{
+  if (size == 4)
+  {
+    host_store32(p, value);
+  }
+  else if (size == 2)
+  {
+    host_store16(p, (uint16_t)value);
+  }
+  else
+  {
+    p[0] = (uint8_t)value;
+  }
+}
+
+/**
+ * @brief Moves a channel's data in one go.
+ *
+ * RAM-to-RAM transfers are a single memmove between the backing arrays.
+ * When one side is a peripheral register, the beats are issued through the
+ * MMIO handlers at a fixed peripheral address.
+ *
+ * @return false if an address is unmapped or misaligned for the beat size.
+ */
+static bool dma_transfer(Dma_Channel *ch)
+{
+  uint32_t size = 1U << ((ch->ccr & DMA_CCR_SIZE_MASK) >> DMA_CCR_SIZE_SHIFT);
+  uint32_t bytes = ch->count * size;
+  if (size > WORD_SIZE || ((ch->src | ch->dst) & (size - 1)))
+  {
+    return false;
+  }
+
+  uint8_t *src = translate_range(ch->src, bytes);
+  uint8_t *dst = translate_write(ch->dst, bytes); // Stores on the guest's behalf: watched
+  if (src && dst)
+  {
+    memmove(dst, src, bytes);
+    return true;
+  }
+
+  for (uint32_t i = 0; i < ch->count; i++)
+  {
+    uint32_t value = 0;
+    if (src)
+    {
+      value = dma_load(src + i * size, size);
+    }
+    else if (!mmio_read(ch->src, size, &value))
+    {
+      return false;
+    }
+    if (dst)
+    {
+      dma_store(dst + i * size, size, value);
+    }
+    else if (!mmio_write(ch->dst, size, value))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Flags the channel's outcome in ISR, disables it and raises its
+ * interrupt if enabled.
+ */
+static void dma_finish(Dma_Channel *ch, bool ok)
+{
+  if (ok)
+  {
+    ch->dma->isr |= 1U << ch->index;
+    ch->count = 0;
+  }
+  else
+  {
+    ch->dma->isr |= 1U << (ch->index + 8);
+  }
+  ch->ccr &= ~DMA_CCR_EN;
+  if (ch->ccr & DMA_CCR_TCIE)
+  {
+    nvic_set_pending(DMA_IRQ_BASE + ch->index);
+  }
+}
+
+/**
+ * @brief Completion event: performs the transfer at the cycle it would end.
+ */
+static void dma_complete(void *ctx, uint64_t now)
+{
+  (void)now;
+  dma_finish(ctx, dma_transfer(ctx));
+}
+
+static bool dma_read_reg(void *ctx, uint32_t offset, uint32_t size, uint32_t *value)
+{
+  Dma *dma = ctx;
+  (void)size;
+
+  if (offset == DMA_ISR)
+  {
+    *value = dma->isr;
+    return true;
+  }
+  uint32_t index = offset / DMA_CHANNEL_STRIDE;
+  if (index >= DMA_CHANNELS)
+  {
+    *value = 0;
+    return true;
+  }
+  Dma_Channel *ch = &dma->ch[index];
+  switch (offset % DMA_CHANNEL_STRIDE)
+  {
+  case DMA_CCR: *value = ch->ccr; break;
+  case DMA_CSRC: *value = ch->src; break;
+  case DMA_CDST: *value = ch->dst; break;
+  case DMA_CCNT: *value = ch->count; break;
+  default: *value = 0; break;
+  }
+  return true;
+}
+
+static bool dma_write_reg(void *ctx, uint32_t offset, uint32_t size, uint32_t value)
+{
+  Dma *dma = ctx;
+  (void)size;
+
+  if (offset == DMA_IFCR)
+  {
+    dma->isr &= ~value;
+    return true;
+  }
+  uint32_t index = offset / DMA_CHANNEL_STRIDE;
+  if (index >= DMA_CHANNELS)
+  {
+    return true;
+  }
+  Dma_Channel *ch = &dma->ch[index];
+  switch (offset % DMA_CHANNEL_STRIDE)
+  {
+  case DMA_CCR:
+  {
+    bool was_enabled = ch->ccr & DMA_CCR_EN;
+    ch->ccr = value;
+    if (!was_enabled && (value & DMA_CCR_EN))
+    {
+      // Finish at the cycle the transfer would take on the bus
+      uint64_t duration = DMA_SETUP_CYCLES + (uint64_t)ch->count * DMA_CYCLES_PER_BEAT;
+      if (!event_schedule(event_now() + duration, dma_complete, ch))
+      {
+        dma_finish(ch, false); // Event table full: the transfer cannot be timed
+      }
+    }
+    else if (was_enabled && !(value & DMA_CCR_EN))
+    {
+      event_cancel(dma_complete, ch); // Aborted: nothing is copied
+    }
+    break;
+  }
+  // Address and count registers are read-only while the channel is enabled
+  case DMA_CSRC: if (!(ch->ccr & DMA_CCR_EN)) ch->src = value; break;
+  case DMA_CDST: if (!(ch->ccr & DMA_CCR_EN)) ch->dst = value; break;
+  case DMA_CCNT: if (!(ch->ccr & DMA_CCR_EN)) ch->count = value & 0xFFFF; break;
+  default: break;
+  }
+  return true;
+}
+
+/**
+ * @brief Maps the DMA controller at the given base address.
+ *
+ * @return false if the register block overlaps another peripheral.
+ */
+bool dma_init(Dma *dma, uint32_t base)
+{
+  memset(dma, 0, sizeof(*dma));
+  dma->base = base;
+  for (uint32_t i = 0; i < DMA_CHANNELS; i++)
+  {
+    dma->ch[i].dma = dma;
+    dma->ch[i].index = i;
+  }
+  return mmio_register(base, DMA_REG_SIZE, dma_read_reg, dma_write_reg, dma);
+}
+
+/**
+ * @brief Cancels in-flight transfers and unmaps the controller.
+ */
+void dma_remove(Dma *dma)
+{
+  for (uint32_t i = 0; i < DMA_CHANNELS; i++)
+  {
+    event_cancel(dma_complete, &dma->ch[i]);
+  }
+  mmio_unregister(dma->base);
+}
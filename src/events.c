@@ -0,0 +1,94 @@
+#include "events.h"
+#include "mcu.h"
+
+static void events_update_next(void)
+{
+  mcu->next_event_cycle = NO_EVENT;
+  for (uint32_t i = 0; i < mcu->event_count; i++)
+  {
+    if (mcu->events[i].when < mcu->next_event_cycle)
+    {
+      mcu->next_event_cycle = mcu->events[i].when;
+    }
+  }
+}
+
+/**
+ * @brief Selects the cycle counter that event_now() reports.
+ *
+ * Called by the run loop so peripherals can timestamp register accesses.
+ */
+void events_bind_clock(const uint64_t *cycles)
+{
+  mcu->event_clock = cycles;
+}
+
+uint64_t event_now(void)
+{
+  return mcu->event_clock ? *mcu->event_clock : 0;
+}
+
+/**
+ * @brief Schedules handler(ctx, now) to run once the cycle counter reaches when.
+ *
+ * @return false if the event table is full.
+ */
+bool event_schedule(uint64_t when, Event_Handler handler, void *ctx)
+{
+  if (mcu->event_count == MAX_EVENTS)
+  {
+    return false;
+  }
+  mcu->events[mcu->event_count++] = (Event){when, handler, ctx};
+  if (when < mcu->next_event_cycle)
+  {
+    mcu->next_event_cycle = when;
+  }
+  return true;
+}
+
+void event_cancel(Event_Handler handler, void *ctx)
+{
+  for (uint32_t i = 0; i < mcu->event_count;)
+  {
+    if (mcu->events[i].handler == handler && mcu->events[i].ctx == ctx)
+    {
+      mcu->events[i] = mcu->events[--mcu->event_count];
+    }
+    else
+    {
+      i++;
+    }
+  }
+  events_update_next();
+}
+
+/**
+ * @brief Fires every event that is due at cycle now.
+ *
+ * Handlers may schedule new events. next_event_cycle is recomputed, so the
+ * run loop pays for a single compare per instruction between events.
+ */
+void events_run(uint64_t now)
+{
+  for (uint32_t i = 0; i < mcu->event_count;)
+  {
+    if (mcu->events[i].when <= now)
+    {
+      Event event = mcu->events[i];
+      mcu->events[i] = mcu->events[--mcu->event_count];
+      event.handler(event.ctx, now);
+    }
+    else
+    {
+      i++;
+    }
+  }
+  events_update_next();
+}
+
+void events_clear(void)
+{
+  mcu->event_count = 0;
+  mcu->next_event_cycle = NO_EVENT;
+}
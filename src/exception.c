@@ -1,9 +1,32 @@
 #include "exception.h"
-
-uint32_t vector_table[48];
+#include "mcu.h"
 
 void load_vector_table(uint32_t *memory) {
-    for (int i = 0; i < 48; i++) {
-        vector_table[i] = memory[i];
+    for (int i = 0; i < VECTOR_TABLE_SIZE; i++) {
+        mcu->vector_table[i] = memory[i];
+    }
+}
+
+/**
+ * @brief Marks an external interrupt pending.
+ *
+ * The run loop only looks at pending interrupts when next_event_cycle is
+ * reached, so it is pulled in to force a check before the next instruction.
+ *
+ * @param irq External interrupt number (exception IRQ_BASE + irq).
+ */
+void nvic_set_pending(uint32_t irq) {
+    if (irq < NUM_IRQS) {
+        if (!(mcu->nvic_pending & (1U << irq))) {
+            latency_pending(irq, event_now());
+        }
+        mcu->nvic_pending |= 1U << irq;
+        mcu->next_event_cycle = 0;
+    }
+}
+
+void nvic_clear_pending(uint32_t irq) {
+    if (irq < NUM_IRQS) {
+        mcu->nvic_pending &= ~(1U << irq);
     }
 }
@@ -0,0 +1,410 @@
+#include "execute.h"
+#include "alu.h"
+#include "branch.h"
+#include "memory_file.h"
+#include "debug.h"
+#include "semihosting.h"
+#include "exception.h"
+#include "events.h"
+#include "mcu.h"
+
+/**
+ * @brief Fetches the halfword at PC and advances PC by 2.
+ *
+ * @param cpu Pointer to the CortexM0_CPU structure representing the CPU state.
+ * @param instr Receives the fetched halfword.
+ * @return false if PC does not point to mapped memory.
+ */
+bool fetch16(CortexM0_CPU *cpu, uint16_t *instr)
+{
+  if (!mem_read16(cpu->PC, instr))
+  {
+    return false;
+  }
+  cpu->PC += 2;
+  return true;
+}
+
+static Stop_Reason undefined_instruction(CortexM0_CPU *cpu, uint16_t instr)
+{
+  printf("Unimplemented instruction 0x%04X at 0x%08X\n", instr, cpu->PC - 2);
+  raise_hardfault(cpu);
+  return STOP_HARDFAULT;
+}
+
+/**
+ * @brief Decodes one 16-bit Thumb instruction and dispatches it to its handler.
+ *
+ * PC has already been advanced past the instruction, so branch offsets are
+ * adjusted by 2 to match the architectural PC (instruction address + 4).
+ * 32-bit BL fetches its second halfword itself.
+ *
+ * @param cpu Pointer to the CortexM0_CPU structure representing the CPU state.
+ * @param instr The instruction halfword.
+ * @return STOP_NONE, or the reason execution must stop.
+ */
+Stop_Reason execute_instruction(CortexM0_CPU *cpu, uint16_t instr)
+{
+  uint8_t Rd = instr & 0x7;
+  uint8_t Rn = (instr >> 3) & 0x7;
+  uint8_t Rm = (instr >> 6) & 0x7;
+
+  switch (instr >> 11)
+  {
+  case 0x00: // LSL Rd, Rm, #imm5
+    STATS_INC(alu);
+    LSL(cpu, Rd, Rn, (instr >> 6) & 0x1F);
+    break;
+
+  case 0x01: // LSR Rd, Rm, #imm5
+    STATS_INC(alu);
+    LSR(cpu, Rd, Rn, (instr >> 6) & 0x1F);
+    break;
+
+  case 0x03:
+    if ((instr & 0x0600) == 0x0000) // ADD Rd, Rn, Rm
+    {
+      STATS_INC(alu);
+      ADD(cpu, Rd, Rn, Rm);
+    }
+    else if ((instr & 0x0600) == 0x0200) // SUB Rd, Rn, Rm
+    {
+      STATS_INC(alu);
+      SUB(cpu, Rd, Rn, Rm);
+    }
+    else
+    {
+      return undefined_instruction(cpu, instr);
+    }
+    break;
+
+  case 0x04: // MOVS Rd, #imm8
+    STATS_INC(alu);
+    MOVS(cpu, (instr >> 8) & 0x7, instr & 0xFF);
+    break;
+
+  case 0x08:
+    if ((instr & 0xFC00) == 0x4000) // Data processing: op Rdn, Rm
+    {
+      switch ((instr >> 6) & 0xF)
+      {
+      case 0x0: AND(cpu, Rd, Rn, Rd); break;
+      case 0x1: EOR(cpu, Rd, Rn, Rd); break;
+      case 0x8: TST(cpu, Rd, Rn); break;
+      case 0xA: CMP(cpu, Rd, Rn); break;
+      case 0xC: ORR(cpu, Rd, Rn, Rd); break;
+      default: return undefined_instruction(cpu, instr);
+      }
+      STATS_INC(alu);
+    }
+    else if ((instr & 0xFF87) == 0x4700) // BX Rm
+    {
+      STATS_INC(branch);
+      BX(cpu, (instr >> 3) & 0xF);
+    }
+    else if ((instr & 0xFF87) == 0x4780) // BLX Rm
+    {
+      STATS_INC(branch);
+      cpu->PC -= 2;
+      BLX(cpu, (instr >> 3) & 0xF, 2);
+    }
+    else
+    {
+      return undefined_instruction(cpu, instr);
+    }
+    break;
+
+  case 0x0A:
+  case 0x0B: // Load/store register offset: op Rt, [Rn, Rm]
+    STATS_INC(load_store);
+    switch ((instr >> 9) & 0x7)
+    {
+    case 0: STR(cpu, Rd, Rn, Rm); break;
+    case 1: STRH(cpu, Rd, Rn, Rm); break;
+    case 2: STRB(cpu, Rd, Rn, Rm); break;
+    case 3: LDRSB(cpu, Rd, Rn, Rm); break;
+    case 4: LDR(cpu, Rd, Rn, Rm); break;
+    case 5: LDRH(cpu, Rd, Rn, Rm); break;
+    case 6: LDRB(cpu, Rd, Rn, Rm); break;
+    case 7: LDRSH(cpu, Rd, Rn, Rm); break;
+    }
+    break;
+
+  case 0x16:
+  case 0x17:
+    if ((instr & 0xFE00) == 0xB400) // PUSH {reglist, LR}
+    {
+      STATS_INC(load_store);
+      PUSH_LIST(cpu, (instr & 0xFF) | ((instr & 0x100) << 6));
+    }
+    else if ((instr & 0xFE00) == 0xBC00) // POP {reglist, PC}
+    {
+      STATS_INC(load_store);
+      POP_LIST(cpu, (instr & 0xFF) | ((instr & 0x100) << 7));
+    }
+    else if (instr == (0xBE00 | SEMIHOSTING_BKPT)) // BKPT 0xAB: semihosting call
+    {
+      STATS_INC(other);
+      return semihosting_call(cpu);
+    }
+    else if ((instr & 0xFF00) == 0xBE00) // BKPT #imm8
+    {
+      cpu->PC -= 2;
+      return STOP_BKPT;
+    }
+    else
+    {
+      return undefined_instruction(cpu, instr);
+    }
+    break;
+
+  case 0x18: // STM Rn!, {reglist}
+    STATS_INC(load_store);
+    STM(cpu, (instr >> 8) & 0x7, instr & 0xFF);
+    break;
+
+  case 0x19: // LDM Rn{!}, {reglist}
+    STATS_INC(load_store);
+    LDM(cpu, (instr >> 8) & 0x7, instr & 0xFF);
+    break;
+
+  case 0x1A:
+  case 0x1B: // B<cond> label
+    if (((instr >> 8) & 0xF) >= 0xE) // UDF / SVC
+    {
+      return undefined_instruction(cpu, instr);
+    }
+  {
+    uint32_t next = cpu->PC;
+    Bcond(cpu, (int8_t)(instr & 0xFF) * 2 + 2, (Condition)((instr >> 8) & 0xF));
+#ifndef VMCU_NO_STATS
+    if (cpu->PC != next) // The offset is never zero, so PC moves only when taken
+    {
+      STATS_INC(bcond_taken);
+    }
+    else
+    {
+      STATS_INC(bcond_not_taken);
+    }
+#endif
+    (void)next;
+    break;
+  }
+
+  case 0x1C: // B label
+    STATS_INC(branch);
+    B(cpu, ((int32_t)((uint32_t)instr << 21) >> 20) + 2);
+    break;
+
+  case 0x1E: // BL label (32-bit)
+  {
+    uint16_t instr2;
+    if (!fetch16(cpu, &instr2))
+    {
+      raise_hardfault(cpu);
+      return STOP_HARDFAULT;
+    }
+    if ((instr2 & 0xD000) != 0xD000)
+    {
+      return undefined_instruction(cpu, instr);
+    }
+    STATS_INC(branch);
+    uint32_t S = (instr >> 10) & 1;
+    uint32_t I1 = !(((instr2 >> 13) & 1) ^ S);
+    uint32_t I2 = !(((instr2 >> 11) & 1) ^ S);
+    uint32_t imm = (S << 24) | (I1 << 23) | (I2 << 22) | ((instr & 0x3FFU) << 12) | ((instr2 & 0x7FFU) << 1);
+    cpu->LR = cpu->PC | 1U;
+    cpu->PC += (int32_t)(imm << 7) >> 7;
+    break;
+  }
+
+  default:
+    return undefined_instruction(cpu, instr);
+  }
+  return STOP_NONE;
+}
+
+/**
+ * @brief Enters the lowest-numbered pending interrupt if the CPU is in Thread mode.
+ *
+ * There is no priority model yet: handlers are not preempted, and interrupts
+ * raised meanwhile are taken after exception_return().
+ */
+static void check_interrupts(CortexM0_CPU *cpu)
+{
+  if (mcu->nvic_pending && cpu->ipsr == 0)
+  {
+    uint32_t irq = __builtin_ctz(mcu->nvic_pending);
+    nvic_clear_pending(irq);
+    exception_entry(cpu, IRQ_BASE + irq);
+  }
+}
+
+/**
+ * @brief Executes a single instruction, ignoring any breakpoint at PC.
+ */
+Stop_Reason cpu_step(CortexM0_CPU *cpu)
+{
+  return cpu_run(cpu, 1);
+}
+
+/*
+ * The loop body of cpu_run(). It is always inlined with constant trace and
+ * coverage arguments, so the plain copy has no instrumentation at all.
+ *
+ * Coverage keeps the current straight-line block [cov_entry, cov_next) in
+ * locals and records it when the next PC is not cov_next (a taken branch or
+ * an exception) or when a Bcond ends it, so the map is written once per
+ * block rather than per instruction.
+ */
+static inline __attribute__((always_inline))
+Stop_Reason run_loop(CortexM0_CPU *cpu, uint64_t max_instructions, Trace *trace, Coverage *cov)
+{
+  Mcu *m = mcu; // Thread-local lookup hoisted out of the loop
+  Stop_Reason stop = STOP_NONE;
+  uint32_t cov_entry = cov ? cov->entry : 0;
+  uint32_t cov_next = cov ? cov->next : 0;
+  for (uint64_t n = 0; n < max_instructions; n++)
+  {
+    uint32_t pc = cpu->PC;
+    uint8_t *p = translate_guest(pc, HALFWORD_SIZE);
+    if (__builtin_expect(p == NULL, 0) && pc >= EXC_RETURN_PREFIX && cpu->ipsr != 0)
+    {
+      exception_return(cpu); // Handler branched to EXC_RETURN
+      pc = cpu->PC;
+      p = translate_guest(pc, HALFWORD_SIZE);
+    }
+    if (p == NULL || (pc & 1))
+    {
+      raise_hardfault(cpu);
+      cpu->exception_pending = 0;
+      stop = STOP_HARDFAULT;
+      break;
+    }
+    if (n > 0 && breakpoint_hit(m, p))
+    {
+      stop = STOP_BREAKPOINT;
+      break;
+    }
+    if (trace && __builtin_expect(pc != trace->next_pc, 0))
+    {
+      trace_jump(trace, pc);
+    }
+    if (cov && pc != cov_next)
+    {
+      coverage_block(cov, cov_entry, cov_next, 0);
+      cov_entry = pc;
+    }
+    cpu->PC = pc + 2;
+    uint16_t instr = host_load16(p);
+    Stop_Reason reason = execute_instruction(cpu, instr);
+    cpu->cycles++;
+    if (trace)
+    {
+      trace->count++;
+      trace->next_pc = pc + 2;
+    }
+    if (cov)
+    {
+      cov_next = pc + 2;
+      if ((instr & 0xF000) == 0xD000 && (instr & 0x0E00) != 0x0E00) // Bcond
+      {
+        coverage_block(cov, cov_entry, cov_next, cpu->PC == cov_next ? COV_NOT_TAKEN : COV_TAKEN);
+        cov_entry = cov_next = cpu->PC;
+      }
+    }
+
+    if (__builtin_expect(reason != STOP_NONE || cpu->exception_pending || m->watch_hit, 0))
+    {
+      if (cpu->exception_pending == HARDFAULT)
+      {
+        cpu->exception_pending = 0;
+        cpu->PC = pc;
+        stop = m->stack_mon.limit_hit ? STOP_STACK_LIMIT : STOP_HARDFAULT;
+        m->stack_mon.limit_hit = false;
+      }
+      else if (reason == STOP_NONE)
+      {
+        m->watch_hit = false;
+        stop = STOP_WATCHPOINT;
+      }
+      else
+      {
+        stop = reason;
+      }
+      break;
+    }
+
+    if (__builtin_expect(cpu->cycles >= m->next_event_cycle, 0))
+    {
+      events_run(cpu->cycles);
+      check_interrupts(cpu);
+      if (cpu->exception_pending == HARDFAULT) // Entry failed; PC is on the next instruction
+      {
+        cpu->exception_pending = 0;
+        stop = m->stack_mon.limit_hit ? STOP_STACK_LIMIT : STOP_HARDFAULT;
+        m->stack_mon.limit_hit = false;
+        break;
+      }
+      if (m->watch_hit) // A peripheral (DMA) stored into a watched range
+      {
+        m->watch_hit = false;
+        stop = STOP_WATCHPOINT;
+        break;
+      }
+    }
+  }
+  if (cov) // Record the part of the block run so far; the next run may continue it
+  {
+    coverage_block(cov, cov_entry, cov_next, 0);
+    cov->entry = cov_entry;
+    cov->next = cov_next;
+  }
+  return stop;
+}
+
+/**
+ * @brief Runs the fetch-decode-execute loop.
+ *
+ * The fast path costs one bit test per fetch for breakpoints; watchpoints are
+ * handled on the write path through per-page flags and only latch watch_hit.
+ * A breakpoint at the starting PC is stepped over so execution can resume
+ * from a previous stop. Peripheral events and pending interrupts are only
+ * examined when the cycle counter reaches next_event_cycle (a watchpoint hit
+ * by an event's store stops the run there), and a branch to
+ * EXC_RETURN is recognised on the (already slow) failed-fetch path. While a
+ * trace runs or coverage is collected, a separate copy of the loop records
+ * them; an instruction that faults is recorded as the last one executed.
+ *
+ * @param cpu Pointer to the CortexM0_CPU structure representing the CPU state.
+ * @param max_instructions Instruction budget (RUN_FOREVER for no limit).
+ * @return The reason execution stopped.
+ */
+Stop_Reason cpu_run(CortexM0_CPU *cpu, uint64_t max_instructions)
+{
+  Mcu *m = mcu;
+  events_bind_clock(&cpu->cycles);
+  if (__builtin_expect(m->trace == NULL && m->coverage == NULL, 1))
+  {
+    return run_loop(cpu, max_instructions, NULL, NULL);
+  }
+  m->tracing = m->trace;
+  Stop_Reason reason = run_loop(cpu, max_instructions, m->trace, m->coverage);
+  m->tracing = NULL;
+  return reason;
+}
+
+const char *stop_reason_name(Stop_Reason reason)
+{
+  switch (reason)
+  {
+  case STOP_NONE: return "budget exhausted";
+  case STOP_BREAKPOINT: return "breakpoint";
+  case STOP_WATCHPOINT: return "watchpoint";
+  case STOP_HARDFAULT: return "hardfault";
+  case STOP_BKPT: return "bkpt";
+  case STOP_EXIT: return "exit";
+  case STOP_STACK_LIMIT: return "stack limit";
+  }
+  return "unknown";
+}
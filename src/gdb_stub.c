@@ -0,0 +1,673 @@
+#include "gdb_stub.h"
+#include "memory_file.h"
+#include "execute.h"
+#include "debug.h"
+#include "mcu.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Largest memory block served by one m/M/X packet (two hex digits per byte)
+#define GDB_MAX_BLOCK ((GDB_PACKET_SIZE - 16) / 2)
+
+static const char target_xml[] =
+  "<?xml version=\"1.0\"?>"
+  "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+  "<target version=\"1.0\">"
+  "<architecture>arm</architecture>"
+  "<feature name=\"org.gnu.gdb.arm.m-profile\">"
+  "<reg name=\"r0\" bitsize=\"32\"/><reg name=\"r1\" bitsize=\"32\"/>"
+  "<reg name=\"r2\" bitsize=\"32\"/><reg name=\"r3\" bitsize=\"32\"/>"
+  "<reg name=\"r4\" bitsize=\"32\"/><reg name=\"r5\" bitsize=\"32\"/>"
+  "<reg name=\"r6\" bitsize=\"32\"/><reg name=\"r7\" bitsize=\"32\"/>"
+  "<reg name=\"r8\" bitsize=\"32\"/><reg name=\"r9\" bitsize=\"32\"/>"
+  "<reg name=\"r10\" bitsize=\"32\"/><reg name=\"r11\" bitsize=\"32\"/>"
+  "<reg name=\"r12\" bitsize=\"32\"/>"
+  "<reg name=\"sp\" bitsize=\"32\" type=\"data_ptr\"/>"
+  "<reg name=\"lr\" bitsize=\"32\"/>"
+  "<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/>"
+  "<reg name=\"xpsr\" bitsize=\"32\" regnum=\"25\"/>"
+  "</feature>"
+  "</target>";
+
+typedef struct {
+  int fd;
+  bool no_ack;
+  uint8_t in[4096];
+  size_t in_len;
+  size_t in_pos;
+  char packet[GDB_PACKET_SIZE + 1];
+  char reply[GDB_PACKET_SIZE + 4];
+  uint8_t block[GDB_MAX_BLOCK];
+} Gdb_Conn;
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static int hex_value(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static char *put_hex_bytes(char *out, const uint8_t *bytes, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    *out++ = hex_digits[bytes[i] >> 4];
+    *out++ = hex_digits[bytes[i] & 0xF];
+  }
+  return out;
+}
+
+// Registers travel as little-endian byte strings
+static char *put_hex_word(char *out, uint32_t value)
+{
+  uint8_t bytes[4] = {value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, value >> 24};
+  return put_hex_bytes(out, bytes, 4);
+}
+
+static bool get_hex_bytes(const char *in, uint8_t *bytes, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    int hi = hex_value(in[2 * i]);
+    int lo = hex_value(in[2 * i + 1]);
+    if (hi < 0 || lo < 0)
+    {
+      return false;
+    }
+    bytes[i] = (hi << 4) | lo;
+  }
+  return true;
+}
+
+static bool get_hex_word(const char *in, uint32_t *value)
+{
+  uint8_t bytes[4];
+  if (!get_hex_bytes(in, bytes, 4))
+  {
+    return false;
+  }
+  *value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+  return true;
+}
+
+/**
+ * @brief Reads one byte from the connection through a 4 KiB input buffer.
+ *
+ * @return The byte, or -1 when the connection is closed.
+ */
+static int conn_getc(Gdb_Conn *conn)
+{
+  if (conn->in_pos == conn->in_len)
+  {
+    ssize_t n = read(conn->fd, conn->in, sizeof(conn->in));
+    if (n <= 0)
+    {
+      return -1;
+    }
+    conn->in_len = n;
+    conn->in_pos = 0;
+  }
+  return conn->in[conn->in_pos++];
+}
+
+static bool conn_write(Gdb_Conn *conn, const char *data, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = write(conn->fd, data, len);
+    if (n <= 0)
+    {
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+/**
+ * @brief Frames and sends a reply packet with a single write().
+ *
+ * The payload must already be in conn->reply starting at offset 1.
+ */
+static bool send_reply(Gdb_Conn *conn, size_t len)
+{
+  uint8_t sum = 0;
+  for (size_t i = 1; i <= len; i++)
+  {
+    sum += (uint8_t)conn->reply[i];
+  }
+  conn->reply[0] = '$';
+  conn->reply[len + 1] = '#';
+  conn->reply[len + 2] = hex_digits[sum >> 4];
+  conn->reply[len + 3] = hex_digits[sum & 0xF];
+  return conn_write(conn, conn->reply, len + 4);
+}
+
+static bool send_str(Gdb_Conn *conn, const char *str)
+{
+  size_t len = strlen(str);
+  memcpy(conn->reply + 1, str, len);
+  return send_reply(conn, len);
+}
+
+/**
+ * @brief Receives the next packet into conn->packet.
+ *
+ * Acknowledgements and stray bytes between packets are skipped. Packets with
+ * a bad checksum are NAKed and dropped.
+ *
+ * @return Packet length, or -1 when the connection is closed.
+ */
+static int receive_packet(Gdb_Conn *conn)
+{
+  for (;;)
+  {
+    int c;
+    do
+    {
+      c = conn_getc(conn);
+      if (c < 0)
+      {
+        return -1;
+      }
+    } while (c != '$');
+
+    size_t len = 0;
+    uint8_t sum = 0;
+    bool overflow = false;
+    while ((c = conn_getc(conn)) != '#')
+    {
+      if (c < 0)
+      {
+        return -1;
+      }
+      if (len < GDB_PACKET_SIZE)
+      {
+        conn->packet[len++] = c;
+      }
+      else
+      {
+        overflow = true;
+      }
+      sum += (uint8_t)c;
+    }
+    int hi = conn_getc(conn);
+    int lo = conn_getc(conn);
+    if (hi < 0 || lo < 0)
+    {
+      return -1;
+    }
+    bool valid = !overflow && hex_value(hi) >= 0 && hex_value(lo) >= 0 &&
+                 ((hex_value(hi) << 4) | hex_value(lo)) == sum;
+    if (!conn->no_ack && !conn_write(conn, valid ? "+" : "-", 1))
+    {
+      return -1;
+    }
+    if (valid)
+    {
+      conn->packet[len] = '\0';
+      return (int)len;
+    }
+  }
+}
+
+static bool read_register(CortexM0_CPU *cpu, uint32_t regnum, uint32_t *value)
+{
+  if (regnum < 16)
+  {
+    *value = cpu->R[regnum];
+  }
+  else if (regnum == GDB_XPSR_REGNUM)
+  {
+    *value = get_xpsr(cpu);
+  }
+  else
+  {
+    return false;
+  }
+  return true;
+}
+
+static bool write_register(CortexM0_CPU *cpu, uint32_t regnum, uint32_t value)
+{
+  if (regnum < 15)
+  {
+    cpu->R[regnum] = value;
+  }
+  else if (regnum == 15)
+  {
+    cpu->PC = value & ~1U;
+  }
+  else if (regnum == GDB_XPSR_REGNUM)
+  {
+    set_xpsr(cpu, value);
+  }
+  else
+  {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Parses "addr,len" and checks len against the block buffer.
+ *
+ * @return Pointer just past the length, or NULL on a malformed request.
+ */
+static const char *parse_addr_len(const char *p, uint32_t *addr, uint32_t *len)
+{
+  char *end;
+  *addr = strtoul(p, &end, 16);
+  if (*end != ',')
+  {
+    return NULL;
+  }
+  *len = strtoul(end + 1, &end, 16);
+  if (*len > GDB_MAX_BLOCK)
+  {
+    return NULL;
+  }
+  return end;
+}
+
+/**
+ * @brief Runs until a stop event, polling the socket for Ctrl-C between chunks.
+ *
+ * @return The stop reply to send, or NULL when the connection was closed.
+ */
+static const char *resume(Gdb_Conn *conn, CortexM0_CPU *cpu, bool single_step, char *buf)
+{
+  Stop_Reason reason;
+  if (single_step)
+  {
+    reason = cpu_step(cpu);
+  }
+  else
+  {
+    for (;;)
+    {
+      reason = cpu_run(cpu, GDB_RUN_CHUNK);
+      if (reason != STOP_NONE)
+      {
+        break;
+      }
+      struct pollfd pfd = {.fd = conn->fd, .events = POLLIN};
+      if (poll(&pfd, 1, 0) > 0)
+      {
+        int c = conn_getc(conn);
+        if (c < 0)
+        {
+          return NULL;
+        }
+        if (c == 0x03)
+        {
+          return "S02";
+        }
+      }
+    }
+  }
+
+  switch (reason)
+  {
+  case STOP_WATCHPOINT:
+    sprintf(buf, "T05watch:%08x;", mcu->watch_hit_addr);
+    return buf;
+  case STOP_HARDFAULT:
+  case STOP_STACK_LIMIT:
+    return "S0b";
+  default:
+    return "S05";
+  }
+}
+
+/**
+ * @brief Handles Z/z packets: software/hardware breakpoints and write watchpoints.
+ */
+static const char *handle_breakpoint(const char *p, bool insert)
+{
+  char *end;
+  unsigned long type = strtoul(p + 1, &end, 16);
+  if (*end != ',')
+  {
+    return "E01";
+  }
+  uint32_t addr = strtoul(end + 1, &end, 16);
+  uint32_t kind = (*end == ',') ? strtoul(end + 1, NULL, 16) : 2;
+  bool ok;
+
+  switch (type)
+  {
+  case 0: // software breakpoint
+  case 1: // hardware breakpoint
+    ok = insert ? breakpoint_set(addr) : breakpoint_clear(addr);
+    break;
+  case 2: // write watchpoint
+    ok = insert ? watchpoint_set(addr, kind) : watchpoint_clear(addr);
+    break;
+  default:
+    return "";
+  }
+  return ok ? "OK" : "E01";
+}
+
+/**
+ * @brief Serves the GDB remote serial protocol on a connected socket.
+ *
+ * Register packets map to CortexM0_CPU using the m-profile layout
+ * (r0-r15, xPSR). Memory packets move whole blocks with
+ * mem_read_block()/mem_write_block() and each reply is framed and sent with
+ * one write(). Returns when GDB detaches, kills the target or disconnects;
+ * the socket is closed.
+ *
+ * @param cpu Pointer to the CortexM0_CPU structure representing the CPU state.
+ * @param fd  Connected socket.
+ */
+void gdb_serve(CortexM0_CPU *cpu, int fd)
+{
+  Gdb_Conn *conn = calloc(1, sizeof(Gdb_Conn));
+  if (conn == NULL)
+  {
+    close(fd);
+    return;
+  }
+  conn->fd = fd;
+  char stop_buf[32];
+  bool running = true;
+
+  while (running)
+  {
+    int len = receive_packet(conn);
+    if (len < 0)
+    {
+      break;
+    }
+    const char *p = conn->packet;
+    char *out = conn->reply + 1;
+    bool ok = true;
+
+    switch (p[0])
+    {
+    case '?':
+      ok = send_str(conn, "S05");
+      break;
+
+    case 'g':
+      for (int i = 0; i < 16; i++)
+      {
+        out = put_hex_word(out, cpu->R[i]);
+      }
+      out = put_hex_word(out, get_xpsr(cpu));
+      ok = send_reply(conn, out - (conn->reply + 1));
+      break;
+
+    case 'G':
+    {
+      uint32_t value;
+      bool valid = len >= 1 + 17 * 8;
+      for (int i = 0; valid && i < 16; i++)
+      {
+        valid = get_hex_word(p + 1 + 8 * i, &value) && write_register(cpu, i, value);
+      }
+      valid = valid && get_hex_word(p + 1 + 8 * 16, &value) && write_register(cpu, GDB_XPSR_REGNUM, value);
+      ok = send_str(conn, valid ? "OK" : "E01");
+      break;
+    }
+
+    case 'p':
+    {
+      uint32_t value;
+      if (read_register(cpu, strtoul(p + 1, NULL, 16), &value))
+      {
+        out = put_hex_word(out, value);
+        ok = send_reply(conn, out - (conn->reply + 1));
+      }
+      else
+      {
+        ok = send_str(conn, "E01");
+      }
+      break;
+    }
+
+    case 'P':
+    {
+      char *end;
+      uint32_t regnum = strtoul(p + 1, &end, 16);
+      uint32_t value;
+      bool valid = *end == '=' && strlen(end + 1) >= 8 && get_hex_word(end + 1, &value) &&
+                   write_register(cpu, regnum, value);
+      ok = send_str(conn, valid ? "OK" : "E01");
+      break;
+    }
+
+    case 'm':
+    {
+      uint32_t addr, size;
+      if (parse_addr_len(p + 1, &addr, &size) && mem_read_block(addr, conn->block, size))
+      {
+        out = put_hex_bytes(out, conn->block, size);
+        ok = send_reply(conn, out - (conn->reply + 1));
+      }
+      else
+      {
+        ok = send_str(conn, "E01");
+      }
+      break;
+    }
+
+    case 'M':
+    {
+      uint32_t addr, size;
+      const char *data = parse_addr_len(p + 1, &addr, &size);
+      bool valid = data && *data == ':' && strlen(data + 1) >= 2 * size &&
+                   get_hex_bytes(data + 1, conn->block, size) &&
+                   mem_write_block(addr, conn->block, size);
+      ok = send_str(conn, valid ? "OK" : "E01");
+      break;
+    }
+
+    case 'X':
+    {
+      uint32_t addr, size;
+      const char *data = parse_addr_len(p + 1, &addr, &size);
+      bool valid = data && *data == ':';
+      if (valid)
+      {
+        // Binary payload: '}' escapes the next byte XOR 0x20
+        const char *in = data + 1;
+        const char *in_end = p + len;
+        uint32_t n = 0;
+        while (n < size && in < in_end)
+        {
+          uint8_t c = *in++;
+          if (c == '}' && in < in_end)
+          {
+            c = *in++ ^ 0x20;
+          }
+          conn->block[n++] = c;
+        }
+        valid = n == size && mem_write_block(addr, conn->block, size);
+      }
+      ok = send_str(conn, valid ? "OK" : "E01");
+      break;
+    }
+
+    case 'Z':
+    case 'z':
+      ok = send_str(conn, handle_breakpoint(p, p[0] == 'Z'));
+      break;
+
+    case 'c':
+    case 's':
+    {
+      if (p[1] != '\0')
+      {
+        cpu->PC = strtoul(p + 1, NULL, 16) & ~1U;
+      }
+      const char *reply = resume(conn, cpu, p[0] == 's', stop_buf);
+      ok = reply && send_str(conn, reply);
+      break;
+    }
+
+    case 'H':
+      ok = send_str(conn, "OK");
+      break;
+
+    case 'D':
+      send_str(conn, "OK");
+      running = false;
+      break;
+
+    case 'k':
+      running = false;
+      break;
+
+    case 'q':
+      if (strncmp(p, "qSupported", 10) == 0)
+      {
+        char features[96];
+        sprintf(features, "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+", GDB_PACKET_SIZE);
+        ok = send_str(conn, features);
+      }
+      else if (strcmp(p, "qAttached") == 0)
+      {
+        ok = send_str(conn, "1");
+      }
+      else if (strncmp(p, "qXfer:features:read:target.xml:", 31) == 0)
+      {
+        char *end;
+        size_t offset = strtoul(p + 31, &end, 16);
+        size_t length = (*end == ',') ? strtoul(end + 1, NULL, 16) : 0;
+        size_t total = sizeof(target_xml) - 1;
+        if (offset > total)
+        {
+          offset = total;
+        }
+        if (length > GDB_PACKET_SIZE - 1)
+        {
+          length = GDB_PACKET_SIZE - 1;
+        }
+        size_t n = (total - offset < length) ? total - offset : length;
+        out[0] = (offset + n < total) ? 'm' : 'l';
+        memcpy(out + 1, target_xml + offset, n);
+        ok = send_reply(conn, n + 1);
+      }
+      else
+      {
+        ok = send_str(conn, "");
+      }
+      break;
+
+    case 'Q':
+      if (strcmp(p, "QStartNoAckMode") == 0)
+      {
+        ok = send_str(conn, "OK");
+        conn->no_ack = true;
+      }
+      else
+      {
+        ok = send_str(conn, "");
+      }
+      break;
+
+    default:
+      ok = send_str(conn, "");
+      break;
+    }
+
+    if (!ok)
+    {
+      break;
+    }
+  }
+
+  close(fd);
+  free(conn);
+}
+
+/**
+ * @brief Opens a listening socket for the stub.
+ *
+ * @param spec "unix:<path>" for a Unix socket, otherwise "[tcp:]<port>" for a
+ *             TCP socket bound to 127.0.0.1.
+ * @return Listening socket, or -1 on failure.
+ */
+int gdb_listen(const char *spec)
+{
+  int fd;
+  if (strncmp(spec, "unix:", 5) == 0)
+  {
+    struct sockaddr_un sa = {.sun_family = AF_UNIX};
+    if (strlen(spec + 5) >= sizeof(sa.sun_path))
+    {
+      return -1;
+    }
+    strcpy(sa.sun_path, spec + 5);
+    unlink(sa.sun_path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+    {
+      perror("gdb_listen");
+      if (fd >= 0) close(fd);
+      return -1;
+    }
+  }
+  else
+  {
+    if (strncmp(spec, "tcp:", 4) == 0)
+    {
+      spec += 4;
+    }
+    struct sockaddr_in sa = {.sin_family = AF_INET};
+    sa.sin_port = htons((uint16_t)atoi(spec));
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int one = 1;
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd >= 0)
+    {
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+    if (fd < 0 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+    {
+      perror("gdb_listen");
+      if (fd >= 0) close(fd);
+      return -1;
+    }
+  }
+  if (listen(fd, 1) < 0)
+  {
+    perror("gdb_listen");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * @brief Waits for GDB to connect.
+ *
+ * Nagle is disabled on TCP connections so small replies are not delayed.
+ *
+ * @return Connected socket, or -1 on failure.
+ */
+int gdb_accept(int listen_fd)
+{
+  int fd = accept(listen_fd, NULL, NULL);
+  if (fd >= 0)
+  {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // fails harmlessly on Unix sockets
+  }
+  return fd;
+}
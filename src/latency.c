@@ -0,0 +1,145 @@
+#include "latency.h"
+#include "mcu.h"
+
+#include <string.h>
+
+/**
+ * @brief Adds one sample to a histogram.
+ *
+ * @param pc Reported with the worst sample.
+ */
+void latency_hist_add(Latency_Hist *h, uint64_t cycles, uint32_t pc)
+{
+  int bucket = cycles ? 64 - __builtin_clzll(cycles) : 0;
+  h->buckets[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1]++;
+  h->count++;
+  h->total += cycles;
+  if (cycles > h->worst || h->count == 1)
+  {
+    h->worst = cycles;
+    h->worst_pc = pc;
+  }
+}
+
+/**
+ * @brief Returns the smallest bucket bound that covers the given fraction
+ *        (per mille) of the samples, clamped to the worst one.
+ */
+uint64_t latency_hist_percentile(const Latency_Hist *h, uint32_t per_mille)
+{
+  uint64_t need = (h->count * per_mille + 999) / 1000;
+  uint64_t seen = 0;
+  for (int k = 0; k < LATENCY_BUCKETS; k++)
+  {
+    seen += h->buckets[k];
+    if (seen >= need && need)
+    {
+      uint64_t bound = k ? (1ull << k) - 1 : 0;
+      return bound < h->worst ? bound : h->worst;
+    }
+  }
+  return h->worst;
+}
+
+/**
+ * @brief Timestamps an interrupt that has just become pending.
+ *
+ * Called by nvic_set_pending() only when the interrupt was not pending yet,
+ * so the latency runs from the first request.
+ */
+void latency_pending(uint32_t irq, uint64_t now)
+{
+  mcu->latency.pending_since[irq] = now;
+}
+
+/**
+ * @brief Charges the stacking cost and records the entry latency.
+ *
+ * Called by exception_entry() once the frame is stacked, so cpu->cycles is
+ * the cycle of the first handler instruction.
+ *
+ * @param pc Return address stacked for the interrupted code.
+ */
+void latency_entry(CortexM0_CPU *cpu, uint8_t exception_number, uint32_t pc)
+{
+  Exc_Latency *lat = &mcu->latency;
+  cpu->cycles += lat->entry_cycles;
+  uint64_t since = cpu->cycles - lat->entry_cycles;
+  if (exception_number >= IRQ_BASE && lat->pending_since[exception_number - IRQ_BASE] <= since)
+  {
+    since = lat->pending_since[exception_number - IRQ_BASE];
+  }
+  latency_hist_add(&lat->entry[exception_number], cpu->cycles - since, pc);
+}
+
+/**
+ * @brief Charges the unstacking cost.
+ */
+void latency_return(CortexM0_CPU *cpu)
+{
+  cpu->cycles += mcu->latency.return_cycles;
+}
+
+/**
+ * @brief Clears the histograms; the stacking costs are kept.
+ */
+void latency_reset(void)
+{
+  memset(mcu->latency.entry, 0, sizeof(mcu->latency.entry));
+}
+
+/**
+ * @brief Summarises the entry histogram of one exception number.
+ *
+ * @return false if the exception was never taken.
+ */
+bool latency_report(uint8_t exception_number, Latency_Report *out)
+{
+  memset(out, 0, sizeof(*out));
+  if (exception_number >= VECTOR_TABLE_SIZE)
+  {
+    return false;
+  }
+  const Latency_Hist *h = &mcu->latency.entry[exception_number];
+  if (h->count == 0)
+  {
+    return false;
+  }
+  out->count = h->count;
+  out->mean = h->total / h->count;
+  out->p50 = latency_hist_percentile(h, 500);
+  out->p90 = latency_hist_percentile(h, 900);
+  out->p99 = latency_hist_percentile(h, 990);
+  out->p999 = latency_hist_percentile(h, 999);
+  out->worst = h->worst;
+  out->worst_pc = h->worst_pc;
+  return true;
+}
+
+void print_latency_report(void)
+{
+  bool any = false;
+  for (int n = 1; n < VECTOR_TABLE_SIZE; n++)
+  {
+    Latency_Report r;
+    if (!latency_report(n, &r))
+    {
+      continue;
+    }
+    if (!any)
+    {
+      printf("Exception entry latency in cycles (percentiles are bucket bounds):\n"
+             "  exc   count      mean    p50    p90    p99  p99.9  worst  at PC\n");
+      any = true;
+    }
+    printf("  %3d  %6llu %9llu %6llu %6llu %6llu %6llu %6llu  0x%08X\n", n,
+           (unsigned long long)r.count, (unsigned long long)r.mean, (unsigned long long)r.p50,
+           (unsigned long long)r.p90, (unsigned long long)r.p99, (unsigned long long)r.p999,
+           (unsigned long long)r.worst, r.worst_pc);
+  }
+  if (!any)
+  {
+    printf("No exceptions taken\n");
+  }
+  printf("Return costs a fixed %u cycles (not measured)\n", mcu->latency.return_cycles);
+}
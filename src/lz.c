@@ -0,0 +1,170 @@
+#include "lz.h"
+
+#include <string.h>
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_LAST_LITERALS 5 // The block always ends with literals
+#define LZ_MATCH_LIMIT 12  // No match starts this close to the end
+
+static inline uint32_t lz_read32(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v)
+{
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Writes the 255-run continuation of a length that did not fit its nibble
+static inline uint8_t *lz_put_length(uint8_t *op, size_t len)
+{
+  for (; len >= 255; len -= 255)
+  {
+    *op++ = 255;
+  }
+  *op++ = (uint8_t)len;
+  return op;
+}
+
+static uint8_t *lz_put_sequence(uint8_t *op, const uint8_t *literals, size_t lit_len,
+                                size_t offset, size_t match_len)
+{
+  uint8_t *token = op++;
+  *token = (uint8_t)((lit_len < 15 ? lit_len : 15) << 4);
+  if (lit_len >= 15)
+  {
+    op = lz_put_length(op, lit_len - 15);
+  }
+  memcpy(op, literals, lit_len);
+  op += lit_len;
+  if (match_len == 0) // Final literals
+  {
+    return op;
+  }
+  *op++ = (uint8_t)offset;
+  *op++ = (uint8_t)(offset >> 8);
+  match_len -= LZ_MIN_MATCH;
+  *token |= match_len < 15 ? match_len : 15;
+  if (match_len >= 15)
+  {
+    op = lz_put_length(op, match_len - 15);
+  }
+  return op;
+}
+
+/**
+ * @brief Compresses one block.
+ *
+ * @param dst Output buffer of at least LZ_BOUND(len) bytes.
+ * @return Compressed size.
+ */
+size_t lz_compress(const uint8_t *src, size_t len, uint8_t *dst)
+{
+  uint32_t table[1 << LZ_HASH_BITS];
+  memset(table, 0, sizeof(table));
+  const uint8_t *ip = src + 1; // Position 0 is the table's "empty" value
+  const uint8_t *anchor = src;
+  const uint8_t *match_limit = len > LZ_MATCH_LIMIT ? src + len - LZ_MATCH_LIMIT : src;
+  const uint8_t *match_end = src + len - (len > LZ_LAST_LITERALS ? LZ_LAST_LITERALS : len);
+  uint8_t *op = dst;
+  uint32_t misses = 1 << 6;
+
+  while (ip < match_limit)
+  {
+    uint32_t v = lz_read32(ip);
+    uint32_t h = lz_hash(v);
+    const uint8_t *ref = src + table[h];
+    table[h] = (uint32_t)(ip - src);
+    if (ref == src || ip - ref > LZ_MAX_OFFSET || lz_read32(ref) != v)
+    {
+      ip += misses++ >> 6; // Skip faster through data that does not compress
+      continue;
+    }
+    misses = 1 << 6;
+    const uint8_t *mp = ip + LZ_MIN_MATCH;
+    const uint8_t *rp = ref + LZ_MIN_MATCH;
+    while (mp < match_end && *mp == *rp)
+    {
+      mp++;
+      rp++;
+    }
+    op = lz_put_sequence(op, anchor, ip - anchor, ip - ref, mp - ip);
+    ip = anchor = mp;
+  }
+  return lz_put_sequence(op, anchor, src + len - anchor, 0, 0) - dst;
+}
+
+/**
+ * @brief Decompresses one block produced by lz_compress().
+ *
+ * @return false unless the block decodes to exactly dst_len bytes.
+ */
+bool lz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len)
+{
+  const uint8_t *ip = src;
+  const uint8_t *end = src + len;
+  uint8_t *op = dst;
+  uint8_t *op_end = dst + dst_len;
+
+  while (ip < end)
+  {
+    uint8_t token = *ip++;
+    size_t lit_len = token >> 4;
+    if (lit_len == 15)
+    {
+      uint8_t b;
+      do
+      {
+        if (ip >= end) return false;
+        b = *ip++;
+        lit_len += b;
+      } while (b == 255);
+    }
+    if ((size_t)(end - ip) < lit_len || (size_t)(op_end - op) < lit_len)
+    {
+      return false;
+    }
+    memcpy(op, ip, lit_len);
+    ip += lit_len;
+    op += lit_len;
+    if (ip == end) // Final literals
+    {
+      break;
+    }
+
+    if (end - ip < 2)
+    {
+      return false;
+    }
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    size_t match_len = token & 15;
+    if (match_len == 15)
+    {
+      uint8_t b;
+      do
+      {
+        if (ip >= end) return false;
+        b = *ip++;
+        match_len += b;
+      } while (b == 255);
+    }
+    match_len += LZ_MIN_MATCH;
+    if (offset == 0 || offset > (size_t)(op - dst) || (size_t)(op_end - op) < match_len)
+    {
+      return false;
+    }
+    const uint8_t *ref = op - offset;
+    for (size_t i = 0; i < match_len; i++) // Overlapping copies repeat the pattern
+    {
+      op[i] = ref[i];
+    }
+    op += match_len;
+  }
+  return op == op_end;
+}
@@ -1,57 +1,674 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <unistd.h>
+#include <time.h>
 #include "cpu.h"
 #include "alu.h"
 #include "memory_file.h"
+#include "execute.h"
+#include "debug.h"
+#include "gdb_stub.h"
+#include "uart.h"
+#include "semihosting.h"
+#include "dma.h"
+#include "mcu.h"
+#include "cosim.h"
+#include "batch.h"
+#include "mem_ops.h"
+#include "pacing.h"
+#include "conformance.h"
 #include "test_mod.h"
 
 
+static void print_help(void)
+{
+    printf("Commands:\n"
+           "  run [n]             run until a stop event (or n instructions)\n"
+           "  step [n]            execute n instructions (default 1)\n"
+           "  break <addr>        set a breakpoint\n"
+           "  delete <addr>       clear a breakpoint\n"
+           "  watch <addr> [len]  set a write watchpoint (default len 4)\n"
+           "  unwatch <addr>      clear a watchpoint\n"
+           "  info                list breakpoints and watchpoints\n"
+           "  regs                print registers\n"
+           "  dump <addr> [len]   dump memory (default len 64)\n"
+           "  fill <addr> <len> [word]  fill memory with a repeated word (default 0)\n"
+           "  copy <dst> <src> <len>    copy memory\n"
+           "  stats [reset]       print execution counters as JSON (or clear them)\n"
+           "  stack               print stack use per exception context\n"
+           "  latency [reset]     print exception latency histograms (or clear them)\n"
+           "  pace                print real-time pacing statistics (with --pace)\n"
+           "  reset               reset the CPU from the vector table\n"
+           "  reload <file>       load a new build, rewriting only changed Flash pages, and reset\n"
+           "  quit                exit\n");
+}
 
-int main() {
-    CortexM0_CPU cpu;
-    init_cpu(&cpu);
+static void report_stop(CortexM0_CPU *cpu, Stop_Reason reason)
+{
+    semihosting_flush();
+    if (reason == STOP_EXIT) {
+        printf("Program exited with code %d\n", mcu->semihost_exit_code);
+    } else if (reason == STOP_WATCHPOINT) {
+        printf("Stopped: watchpoint (write to 0x%08X) at PC 0x%08X\n", mcu->watch_hit_addr, cpu->PC);
+    } else {
+        printf("Stopped: %s at PC 0x%08X\n", stop_reason_name(reason), cpu->PC);
+    }
+}
+
+/**
+ * @brief Runs the loaded image without the monitor, or replays the cached
+ *        result of an identical earlier run.
+ *
+ * UART output goes to stdout, followed by a summary line.
+ *
+ * @return The guest's exit code, or 1 if it did not exit.
+ */
+static int run_batch(CortexM0_CPU *cpu, Uart *uart, const char *input_path, uint64_t cycles,
+                     const char *cache_dir)
+{
+    uint8_t *input = NULL;
+    long input_len = 0;
+    if (input_path) {
+        FILE *f = fopen(input_path, "rb");
+        if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (input_len = ftell(f)) < 0 ||
+            (rewind(f), input = malloc(input_len ? input_len : 1)) == NULL ||
+            fread(input, 1, input_len, f) != (size_t)input_len) {
+            printf("Cannot read input %s\n", input_path);
+            if (f) fclose(f);
+            free(input);
+            return 1;
+        }
+        fclose(f);
+    }
 
-    cpu.R[0] = 0x10; 
-    STR(&cpu, 0, 0, 0);
+    Batch_Job job = {input, input_len, cycles, cache_dir};
+    Batch_Result result;
+    bool ok = batch_run(cpu, uart, &job, &result);
+    free(input);
+    if (!ok) {
+        return 1;
+    }
+    fwrite(result.output, 1, result.output_len, stdout);
+    printf("%sStopped: %s at PC 0x%08X after %llu cycles%s\n",
+           result.output_len && result.output[result.output_len - 1] != '\n' ? "\n" : "",
+           stop_reason_name(result.reason), result.R[15], (unsigned long long)result.cycles,
+           result.cached ? " (cached)" : "");
+    batch_result_free(&result);
+    return result.reason == STOP_EXIT ? result.exit_code : 1;
+}
+
+/**
+ * @brief Sets up a ring of nodes that each run image (or the built-in token
+ *        ring when image is NULL) and transmit to the next node.
+ */
+static bool cosim_setup_ring(Cosim *sim, uint32_t nodes, uint64_t latency, const char *image,
+                             const Mcu_Config *map)
+{
+    if (!cosim_init_config(sim, nodes, UART_DEFAULT_BASE, map)) {
+        return false;
+    }
+    bool ok = true;
+    for (uint32_t i = 0; i < nodes && ok; i++) {
+        ok = cosim_connect(sim, i, (i + 1) % nodes, latency);
+    }
+    if (ok && image) {
+        Flash_Image flash;
+        ok = flash_image_load(&flash, image) && cosim_load_shared(sim, &flash);
+        flash_image_release(&flash);
+    } else if (ok) {
+        ok = cosim_load_token_ring(sim);
+    }
+    if (!ok) {
+        cosim_destroy(sim);
+    }
+    return ok;
+}
 
-    LDR(&cpu, 13, 0, 0);
+/**
+ * @brief Runs a ring of co-simulated nodes once per mode and reports the speedup.
+ *
+ * Every node runs image (or the built-in token ring when image is NULL) and
+ * transmits to the next node over a link with the given latency.
+ *
+ * @return Process exit status.
+ */
+static int run_cosim_benchmark(uint32_t nodes, uint64_t latency, uint64_t cycles, const char *image,
+                               const Mcu_Config *map)
+{
+    double seconds[2];
+    CortexM0_CPU result[2];
+    printf("Co-simulating %u nodes for %llu cycles each (link latency %llu cycles)\n",
+           nodes, (unsigned long long)cycles, (unsigned long long)latency);
 
-    printf("Value in R1 after LDR: 0x%X\n", cpu.R[1]);
+    for (int parallel = 0; parallel < 2; parallel++) {
+        static Cosim sim;
+        if (!cosim_setup_ring(&sim, nodes, latency, image, map)) {
+            return 1;
+        }
 
-    // // printf("CPU init: \n");
-    // // print_cpu_state(&cpu);
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        bool ok = cosim_run(&sim, cycles, parallel);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        seconds[parallel] = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        result[parallel] = sim.nodes[nodes - 1].mcu->cpu;
+        cosim_destroy(&sim);
+        if (!ok) {
+            return 1;
+        }
+        printf("  %-12s %8.3f s  %8.1f MIPS\n", parallel ? "parallel:" : "round-robin:",
+               seconds[parallel], nodes * (double)cycles / seconds[parallel] / 1e6);
+    }
 
-    // // test_Bcond_EQ(&cpu);
-    // MOVS(&cpu, 8, 0x12);
-    
+    printf("Speedup %.2fx on %ld host CPUs, results %s\n", seconds[0] / seconds[1],
+           sysconf(_SC_NPROCESSORS_ONLN),
+           memcmp(&result[0].R, &result[1].R, sizeof(result[0].R)) == 0 ? "match" : "differ");
+    return 0;
+}
+
+static double seconds_since(const struct timespec *t0)
+{
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Runs the co-simulated ring in parallel once per placement policy.
+ *
+ * Each policy gets a fresh set of instances, so memory first touched under
+ * one policy does not favour the next.
+ *
+ * @return Process exit status.
+ */
+static int run_placement_benchmark(uint32_t nodes, uint64_t latency, uint64_t cycles,
+                                   const char *image, const Mcu_Config *map)
+{
+    static const struct {
+        const char *name;
+        unsigned flags;
+    } policies[] = {
+        {"floating:", 0},
+        {"pinned:", COSIM_PIN},
+        {"local:", COSIM_LOCAL_MEMORY},
+        {"local+huge:", COSIM_LOCAL_MEMORY | COSIM_HUGE_PAGES},
+    };
+    const size_t count = sizeof(policies) / sizeof(policies[0]);
+    uint32_t reference[16];
+    bool match = true;
+    printf("Placing %u nodes on %ld host CPUs, %llu cycles each\n", nodes,
+           sysconf(_SC_NPROCESSORS_ONLN), (unsigned long long)cycles);
+
+    for (size_t p = 0; p < count; p++) {
+        static Cosim sim;
+        if (!cosim_setup_ring(&sim, nodes, latency, image, map)) {
+            return 1;
+        }
+        cosim_set_placement(&sim, policies[p].flags);
+        struct timespec t0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        bool ok = cosim_run(&sim, cycles, true);
+        double seconds = seconds_since(&t0);
+        const uint32_t *R = sim.nodes[nodes - 1].mcu->cpu.R;
+        if (p == 0) {
+            memcpy(reference, R, sizeof(reference));
+        }
+        match = match && memcmp(reference, R, sizeof(reference)) == 0;
+        bool unbound = sim.unbound;
+        cosim_destroy(&sim);
+        if (!ok) {
+            return 1;
+        }
+        printf("  %-12s %8.3f s  %8.1f MIPS%s\n", policies[p].name, seconds,
+               nodes * (double)cycles / seconds / 1e6,
+               unbound ? "  (memory not moved: mbind refused)" : "");
+    }
+    printf("Results %s\n", match ? "match" : "differ");
+    return 0;
+}
+
+static volatile uint32_t bench_sink; // Keeps benchmark loops from being optimised away
+
+// Word access kernels: one byte at a time, as mem_read32()/mem_write32()
+// did before host_load32() and host_store32(), or with those helpers
+static bool kernel_read32(uint32_t addr, uint32_t *value, bool bytewise)
+{
+    uint8_t *p = (addr & 3) ? NULL : translate_range(addr, WORD_SIZE);
+    if (p == NULL) return false;
+    if (bytewise) {
+        *value = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    } else {
+        *value = host_load32(p);
+    }
+    return true;
+}
 
-    // // uint32_t *tmp_sp = cpu.SP;
-    // // printf("Stack ends at :%p\n", (uint32_t *)&(Stack[Stack_size-1]));
-    // print_cpu_state(&cpu);
-    
+static bool kernel_write32(uint32_t addr, uint32_t value, bool bytewise)
+{
+    uint8_t *p = (addr & 3) ? NULL : translate_range(addr, WORD_SIZE);
+    if (p == NULL) return false;
+    if (bytewise) {
+        p[0] = (uint8_t)value;
+        p[1] = (uint8_t)(value >> 8);
+        p[2] = (uint8_t)(value >> 16);
+        p[3] = (uint8_t)(value >> 24);
+    } else {
+        host_store32(p, value);
+    }
+    return true;
+}
 
-    // PUSH(&cpu, 1);
-    // print_cpu_state(&cpu);
-    // // print_memory();
-    // print_stack();
+/**
+ * @brief Times the word accessors and the bulk memory operations.
+ *
+ * Word accesses go through SRAM of a fresh instance, both as the bare
+ * translate-and-access kernel (byte-wise and native) and through the full
+ * accessors with their MMIO, watchpoint and trace checks. The bulk operations work on
+ * 1 MiB of external RAM and are compared with the portable kernels and a
+ * plain byte loop.
+ *
+ * @return Process exit status.
+ */
+static int run_memory_benchmark(void)
+{
+    enum { BULK = 1 << 20, PASSES = 256 };
+    Mcu_Config config = {FLASH_SIZE, SRAM_SIZE, BULK};
+    Mcu *m = mcu_create_config(&config);
+    uint8_t *ref = malloc(BULK);
+    if (m == NULL || ref == NULL) {
+        return 1;
+    }
+    mcu_select(m);
+    uint32_t sum = 0;
+    uint64_t accesses = (uint64_t)PASSES * 64 * (SRAM_SIZE / WORD_SIZE);
+    struct timespec t0;
 
-    // printf("Poping back the value to R2 \n");
-    // cpu.R[2] = POP(&cpu);
-    // STR(&cpu, 2, 15, 0);
-    print_cpu_state(&cpu);
-    // print_stack();
-    print_memory();
+    printf("Word accesses (ns per read + write):\n");
+    for (int kind = 0; kind < 3; kind++) {
+        static const char *const names[] = {"byte-wise:", "native:", "mem_read32:"};
+        bool bytewise = kind == 0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int pass = 0; pass < PASSES * 64; pass++) {
+            for (uint32_t addr = SRAM_BASE; addr < SRAM_BASE + SRAM_SIZE; addr += WORD_SIZE) {
+                uint32_t v;
+                if (kind < 2) {
+                    kernel_read32(addr, &v, bytewise);
+                    kernel_write32(addr, v + pass, bytewise);
+                } else {
+                    mem_read32(addr, &v);
+                    mem_write32(addr, v + pass);
+                }
+                sum += v;
+            }
+        }
+        printf("  %-12s %6.2f\n", names[kind],
+               seconds_since(&t0) * 1e9 / accesses);
+    }
 
-    // int var_1, *var_2; 
-    // int var_3 = 22;
-    // var_1 = (unsigned int)(&var_3);
-    // var_2 = &var_3;
+    uint8_t *p = translate_range(EXT_RAM_BASE, BULK);
+    printf("Bulk operations on %u KiB (GB/s):\n", BULK >> 10);
+    for (int kind = 0; kind < 3; kind++) {
+        static const char *const names[] = {"byte loop:", "portable:", "vectorized:"};
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int pass = 0; pass < PASSES; pass++) {
+            if (kind == 0) {
+                for (uint32_t i = 0; i < BULK; i++) p[i] = (uint8_t)(0xDEADBEEF >> (8 * (i & 3)));
+            } else if (kind == 1) {
+                mem_ops_fill32_scalar(p, 0xDEADBEEF, BULK);
+            } else {
+                mem_fill(EXT_RAM_BASE, 0xDEADBEEF, BULK);
+            }
+        }
+        double fill = seconds_since(&t0);
+        memcpy(ref, p, BULK);
 
-    // printf("var_1: %d, var_2: %d\n", var_1, var_2);
+        uint32_t diff = 0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int pass = 0; pass < PASSES; pass++) {
+            if (kind == 0) {
+                uint32_t i = 0;
+                while (i < BULK && p[i] == ref[i]) i++;
+                diff += i;
+            } else if (kind == 1) {
+                diff += mem_ops_mismatch_scalar(p, ref, BULK);
+            } else {
+                uint32_t at;
+                mem_compare(EXT_RAM_BASE, ref, BULK, &at);
+                diff += at - EXT_RAM_BASE;
+            }
+        }
+        double compare = seconds_since(&t0);
+        sum += diff;
+        printf("  %-12s fill %6.2f  compare %6.2f\n", names[kind],
+               (double)BULK * PASSES / fill / 1e9, (double)BULK * PASSES / compare / 1e9);
+    }
 
+    mcu_select(NULL);
+    mcu_destroy(m);
+    free(ref);
+    bench_sink = sum;
     return 0;
 }
 
+/**
+ * @brief Checks the ALU and shift handlers against the reference sweep.
+ *
+ * argv[2], argv[3] and argv[4] optionally give the random cases per
+ * operation, the thread count (0 = one per host CPU) and the operand bits
+ * swept exhaustively (16 = every pair of 16-bit values, 2^32 cases per
+ * two-operand instruction).
+ *
+ * @return Process exit status: 1 if any case differs.
+ */
+static int run_conformance(int argc, char **argv)
+{
+    Conformance_Config config = {CONFORMANCE_DEFAULT_RANDOM, 0x5EED, 0, 16};
+    if (argc > 2 && (strcmp(argv[2], "-h") == 0 || strcmp(argv[2], "--help") == 0)) {
+        printf("Usage: %s --conformance [random-per-op] [threads] [bits]\n"
+               "  Sweeps every pair of <bits>-bit operand values (default 16: 2^32 cases per\n"
+               "  two-operand instruction, 2^21 per shift), then %llu random cases per\n"
+               "  operation, on <threads> threads (default: one per host CPU).\n",
+               argv[0], (unsigned long long)CONFORMANCE_DEFAULT_RANDOM);
+        return 0;
+    }
+    if (argc > 2) {
+        config.random_cases = strtoull(argv[2], NULL, 0);
+    }
+    if (argc > 3) {
+        config.threads = (unsigned)strtoul(argv[3], NULL, 0);
+    }
+    if (argc > 4) {
+        config.exhaustive_bits = (unsigned)strtoul(argv[4], NULL, 0);
+        if (config.exhaustive_bits < 1 || config.exhaustive_bits > 16) {
+            printf("Exhaustive operand bits must be 1-16\n");
+            return 1;
+        }
+    }
+    Conformance_Report report[CONF_OPS];
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    bool ok = conformance_run(&config, report);
+    double seconds = seconds_since(&t0);
+    uint64_t cases = 0;
+    for (int op = 0; op < CONF_OPS; op++) {
+        cases += report[op].cases;
+    }
+    printf("ALU and shift conformance (every pair of %u-bit operands, then %llu random):\n",
+           config.exhaustive_bits, (unsigned long long)config.random_cases);
+    print_conformance_report(report);
+    printf("%llu cases in %.1f s (%.1f M cases/s): %s\n", (unsigned long long)cases, seconds,
+           cases / seconds / 1e6, ok ? "all match" : "MISMATCH");
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "--test") == 0) {
+        run_all_tests();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-memory") == 0) {
+        return run_memory_benchmark();
+    }
+    if (argc > 1 && strcmp(argv[1], "--conformance") == 0) {
+        return run_conformance(argc, argv);
+    }
+    if (argc > 2 && strcmp(argv[1], "--decode-trace") == 0) {
+        return trace_decode(argv[2], stdout) ? 0 : 1;
+    }
+    if (argc > 3 && strcmp(argv[1], "--lcov") == 0) {
+        return coverage_lcov(argv[2], argv[3], stdout) ? 0 : 1;
+    }
+
+    const char *image = NULL;
+    const char *gdb_spec = NULL;
+    const char *uart_spec = NULL;
+    uint32_t uart_base = UART_DEFAULT_BASE;
+    uint32_t cosim_nodes = 0;
+    uint64_t cosim_latency = COSIM_DEFAULT_LATENCY;
+    uint64_t cycles = 10000000;
+    Mcu_Config map = {FLASH_SIZE, SRAM_SIZE, 0};
+    bool custom_map = false;
+    const char *trace_path = NULL;
+    const char *coverage_path = NULL;
+    bool exc_latency = false;
+    uint32_t exc_entry_cycles = 0, exc_return_cycles = 0;
+    bool batch = false;
+    const char *input_path = NULL;
+    const char *cache_dir = NULL;
+    uint32_t stack_limit = 0;
+    bool stack_canary = false;
+    uint64_t pace_hz = 0;
+    bool compare_placement = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--gdb") == 0 && i + 1 < argc) {
+            gdb_spec = argv[++i];
+        } else if (strcmp(argv[i], "--uart") == 0 && i + 1 < argc) {
+            uart_spec = argv[++i];
+        } else if (strcmp(argv[i], "--uart-base") == 0 && i + 1 < argc) {
+            uart_base = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--flash-size") == 0 && i + 1 < argc) {
+            map.flash_size = strtoul(argv[++i], NULL, 0);
+            custom_map = true;
+        } else if (strcmp(argv[i], "--sram-size") == 0 && i + 1 < argc) {
+            map.sram_size = strtoul(argv[++i], NULL, 0);
+            custom_map = true;
+        } else if (strcmp(argv[i], "--ext-ram-size") == 0 && i + 1 < argc) {
+            map.ext_ram_size = strtoul(argv[++i], NULL, 0);
+            custom_map = true;
+        } else if (strcmp(argv[i], "--stack-limit") == 0 && i + 1 < argc) {
+            stack_limit = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            batch = true;
+        } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            input_path = argv[++i];
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--coverage") == 0 && i + 1 < argc) {
+            coverage_path = argv[++i];
+        } else if (strcmp(argv[i], "--exc-cycles") == 0 && i + 1 < argc) {
+            char *end;
+            exc_entry_cycles = strtoul(argv[++i], &end, 0);
+            exc_return_cycles = *end == ',' ? strtoul(end + 1, NULL, 0) : 0;
+        } else if (strcmp(argv[i], "--exc-latency") == 0) {
+            exc_latency = true;
+        } else if (strcmp(argv[i], "--pace") == 0 && i + 1 < argc) {
+            pace_hz = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--stack-canary") == 0) {
+            stack_canary = true;
+        } else if (strcmp(argv[i], "--placement") == 0) {
+            compare_placement = true;
+        } else if (strcmp(argv[i], "--cosim") == 0 && i + 1 < argc) {
+            cosim_nodes = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+            cosim_latency = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc) {
+            cycles = strtoull(argv[++i], NULL, 0);
+        } else {
+            image = argv[i];
+        }
+    }
+
+    if (cosim_nodes) {
+        const Mcu_Config *node_map = custom_map ? &map : NULL;
+        if (compare_placement) {
+            return run_placement_benchmark(cosim_nodes, cosim_latency, cycles, image, node_map);
+        }
+        return run_cosim_benchmark(cosim_nodes, cosim_latency, cycles, image, node_map);
+    }
+
+    if (custom_map) {
+        Mcu *m = mcu_create_config(&map);
+        if (m == NULL) {
+            return 1;
+        }
+        mcu_select(m);
+    }
+
+    CortexM0_CPU cpu;
+    init_cpu(&cpu);
+    if (image) {
+        if (!load_binary(image)) {
+            return 1;
+        }
+        cpu_reset(&cpu);
+    }
+    stack_set_limit(stack_limit);
+    mcu->latency.entry_cycles = exc_entry_cycles;
+    mcu->latency.return_cycles = exc_return_cycles;
+    if (stack_canary && !stack_canary_fill(SRAM_BASE, cpu.SP)) {
+        printf("Cannot fill the stack below 0x%08X\n", cpu.SP);
+        return 1;
+    }
+
+    if (coverage_path && !coverage_start()) {
+        return 1;
+    }
 
+    static Dma dma0;
+    dma_init(&dma0, DMA_DEFAULT_BASE);
+
+    static Uart uart0;
+    if (batch) {
+        if (!uart_init(&uart0, uart_base)) {
+            printf("Cannot set up UART at 0x%08X\n", uart_base);
+            return 1;
+        }
+        // A cached result would record no coverage
+        int status = run_batch(&cpu, &uart0, input_path, cycles, coverage_path ? NULL : cache_dir);
+        uart_detach(&uart0);
+        if (exc_latency) {
+            print_latency_report();
+        }
+        if (coverage_path && !coverage_save(coverage_path)) {
+            return 1;
+        }
+        return status;
+    }
+    if (uart_spec) {
+        int tx_fd, rx_fd;
+        if (!uart_init(&uart0, uart_base) || uart_open_host(uart_spec, &tx_fd, &rx_fd) < 0 ||
+            !uart_attach(&uart0, tx_fd, rx_fd)) {
+            printf("Cannot set up UART at 0x%08X\n", uart_base);
+            return 1;
+        }
+    }
+
+    if (trace_path && !trace_start(trace_path)) {
+        return 1;
+    }
+
+    if (gdb_spec) {
+        int listen_fd = gdb_listen(gdb_spec);
+        if (listen_fd < 0) {
+            return 1;
+        }
+        printf("Waiting for GDB on %s\n", gdb_spec);
+        int fd = gdb_accept(listen_fd);
+        close(listen_fd);
+        if (fd < 0) {
+            return 1;
+        }
+        gdb_serve(&cpu, fd);
+        if (trace_path) trace_stop();
+        if (coverage_path) coverage_save(coverage_path);
+        semihosting_close_all();
+        uart_detach(&uart0);
+        return 0;
+    }
+
+    Pacer pacer;
+    pacer_init(&pacer, pace_hz);
+
+    char line[128];
+    char cmd[16];
+    printf("> ");
+    fflush(stdout);
+    while (fgets(line, sizeof(line), stdin)) {
+        unsigned long a = 0, b = 0, c = 0;
+        int args = sscanf(line, "%15s %li %li %li", cmd, (long *)&a, (long *)&b, (long *)&c);
+
+        if (args < 1) {
+            // empty line
+        } else if (strcmp(cmd, "run") == 0) {
+            uint64_t n = args >= 2 ? a : RUN_FOREVER;
+            report_stop(&cpu, pace_hz ? pacer_run(&pacer, &cpu, n) : cpu_run(&cpu, n));
+        } else if (strcmp(cmd, "step") == 0) {
+            Stop_Reason reason = cpu_run(&cpu, args >= 2 ? a : 1);
+            if (reason != STOP_NONE) {
+                report_stop(&cpu, reason);
+            }
+            printf("PC: 0x%08X\n", cpu.PC);
+        } else if (strcmp(cmd, "break") == 0 && args >= 2) {
+            if (!breakpoint_set(a)) printf("Invalid breakpoint address\n");
+        } else if (strcmp(cmd, "delete") == 0 && args >= 2) {
+            if (!breakpoint_clear(a)) printf("Invalid breakpoint address\n");
+        } else if (strcmp(cmd, "watch") == 0 && args >= 2) {
+            if (!watchpoint_set(a, args >= 3 ? b : 4)) printf("Cannot set watchpoint\n");
+        } else if (strcmp(cmd, "unwatch") == 0 && args >= 2) {
+            if (!watchpoint_clear(a)) printf("No watchpoint at that address\n");
+        } else if (strcmp(cmd, "info") == 0) {
+            print_debug_points();
+        } else if (strcmp(cmd, "regs") == 0) {
+            print_cpu_state(&cpu);
+        } else if (strcmp(cmd, "dump") == 0 && args >= 2) {
+            print_memory(a, args >= 3 ? b : 64);
+        } else if (strcmp(cmd, "fill") == 0 && args >= 3) {
+            if (!mem_fill(a, args >= 4 ? c : 0, b)) printf("Invalid memory range\n");
+        } else if (strcmp(cmd, "copy") == 0 && args >= 4) {
+            if (!mem_copy(a, b, c)) printf("Invalid memory range\n");
+        } else if (strcmp(cmd, "stats") == 0) {
+            char reset[8];
+            if (sscanf(line, "%*s %7s", reset) == 1 && strcmp(reset, "reset") == 0) {
+                stats_reset();
+            } else {
+                Mcu_Stats stats;
+                char json[512];
+                stats_snapshot(&stats);
+                stats_json(&stats, json, sizeof(json));
+                printf("%s\n", json);
+            }
+        } else if (strcmp(cmd, "stack") == 0) {
+            print_stack_report();
+        } else if (strcmp(cmd, "pace") == 0) {
+            if (pace_hz) {
+                print_pacer_report(&pacer);
+            } else {
+                printf("Not paced; start with --pace <hz>\n");
+            }
+        } else if (strcmp(cmd, "latency") == 0) {
+            char reset[8];
+            if (sscanf(line, "%*s %7s", reset) == 1 && strcmp(reset, "reset") == 0) {
+                latency_reset();
+            } else {
+                print_latency_report();
+            }
+        } else if (strcmp(cmd, "reset") == 0) {
+            cpu_reset(&cpu);
+        } else if (strcmp(cmd, "reload") == 0) {
+            char path[256];
+            uint32_t changed;
+            if (sscanf(line, "%*s %255s", path) != 1) {
+                print_help();
+            } else if (reload_binary(&cpu, path, &changed)) {
+                printf("Reloaded %s: %u Flash pages changed\n", path, changed);
+            }
+        } else if (strcmp(cmd, "quit") == 0) {
+            break;
+        } else {
+            print_help();
+        }
+        printf("> ");
+        fflush(stdout);
+    }
+
+    if (trace_path) trace_stop();
+    if (coverage_path) coverage_save(coverage_path);
+    semihosting_close_all();
+    uart_detach(&uart0);
+    return 0;
+}
@@ -0,0 +1,444 @@
+#define _GNU_SOURCE
+#include "mcu.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// From <numaif.h>, which would need libnuma only for the mbind() wrapper
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+#define NUMA_MAX_NODES 1024
+
+// Backing memory and tables of the default instance; it never shares Flash
+static uint8_t default_memory[MEMORY_SIZE] __attribute__((aligned(HOST_PAGE_SIZE)));
+static uint8_t default_page_flags[MEM_PAGES];
+static uint8_t default_bp_bitmap[BP_BITMAP_SIZE];
+
+// Instance used by threads that never call mcu_select()
+static Mcu default_mcu = {
+  .memory = default_memory,
+  .memory_size = MEMORY_SIZE,
+  .regions = {
+    [REGION_FLASH] = {FLASH_BASE, FLASH_SIZE, 0},
+    [REGION_SRAM] = {SRAM_BASE, SRAM_SIZE, FLASH_SPAN},
+    [REGION_EXT_RAM] = {EXT_RAM_BASE, 0, MEMORY_SIZE},
+  },
+  .page_flags = default_page_flags,
+  .bp_bitmap = default_bp_bitmap,
+  .numa_node = -1,
+  .next_event_cycle = NO_EVENT,
+  .stack_mon = {
+    .initial_sp = SRAM_BASE + SRAM_SIZE, .low = SRAM_BASE + SRAM_SIZE,
+    .thread_low = SRAM_BASE + SRAM_SIZE, .min_sp = SRAM_BASE + SRAM_SIZE,
+    .entry_sp = SRAM_BASE + SRAM_SIZE,
+  },
+};
+
+_Thread_local Mcu *mcu = &default_mcu;
+
+// Flags and breakpoint tables share one mapping, placed after the page flags
+static size_t mcu_table_size(uint32_t memory_size)
+{
+  return HOST_PAGE_ALIGN((memory_size >> PAGE_SHIFT) + BP_BITMAP_BYTES(memory_size));
+}
+
+// Reserves len bytes; from HUGE_PAGE_SIZE up the start is huge-page aligned
+static void *mcu_reserve(size_t len)
+{
+  size_t pad = len >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : 0;
+  uint8_t *p = mmap(NULL, len + pad, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED || pad == 0)
+  {
+    return p;
+  }
+  uint8_t *base = (uint8_t *)(((uintptr_t)p + pad - 1) & ~(uintptr_t)(pad - 1));
+  if (base > p)
+  {
+    munmap(p, base - p);
+  }
+  munmap(base + len, p + pad - base);
+  return base;
+}
+
+// Regions of HUGE_PAGE_SIZE or more start on a huge page, for mcu_place()
+static uint64_t mcu_region_align(uint64_t offset, uint32_t size)
+{
+  return size >= HUGE_PAGE_SIZE ? (offset + HUGE_PAGE_SIZE - 1) & ~(uint64_t)(HUGE_PAGE_SIZE - 1)
+                                : offset;
+}
+
+// Applies the instance's placement to a range, which a fresh mapping loses
+static void mcu_place_range(Mcu *m, void *p, size_t len)
+{
+  if (m->huge_pages && len >= HUGE_PAGE_SIZE)
+  {
+    madvise(p, len, MADV_HUGEPAGE);
+  }
+  if (m->numa_node >= 0)
+  {
+    mcu_bind_memory(p, len, m->numa_node);
+  }
+}
+
+// Region by region, so huge pages never back a small region
+static void mcu_place_all(Mcu *m)
+{
+  for (int id = 0; id < MEM_REGIONS; id++)
+  {
+    if (m->regions[id].size)
+    {
+      mcu_place_range(m, m->memory + m->regions[id].offset, HOST_PAGE_ALIGN(m->regions[id].size));
+    }
+  }
+  if (m->numa_node >= 0)
+  {
+    mcu_bind_memory(m->page_flags, mcu_table_size(m->memory_size), m->numa_node);
+  }
+}
+
+// Replaces [p, p + len) of a mapped instance with fresh zero pages
+static bool mcu_zero_pages(void *p, size_t len)
+{
+  return mmap(p, len, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) != MAP_FAILED;
+}
+
+// Stops what an instance runs or holds outside its own struct
+static void mcu_release(Mcu *m)
+{
+  Mcu *prev = mcu;
+  mcu = m;
+  if (m->trace)
+  {
+    trace_stop(); // Joins the writer thread and closes the file
+  }
+  coverage_stop();
+  semihosting_close_all(); // Flushes and closes files the guest left open
+  mcu = prev;
+}
+
+// Clears everything but the memory layout and initialises the CPU
+static void mcu_clear_state(Mcu *m)
+{
+  mcu_release(m);
+  Mcu layout = *m;
+  memset(m, 0, sizeof(*m));
+  m->memory = layout.memory;
+  m->memory_size = layout.memory_size;
+  memcpy(m->regions, layout.regions, sizeof(m->regions));
+  m->mapped = layout.mapped;
+  m->page_flags = layout.page_flags;
+  m->bp_bitmap = layout.bp_bitmap;
+  m->numa_node = layout.numa_node;
+  m->huge_pages = layout.huge_pages;
+  m->next_event_cycle = NO_EVENT;
+  init_cpu(&m->cpu);
+  m->cpu.SP = m->regions[REGION_SRAM].base + m->regions[REGION_SRAM].size;
+  stack_mon_reset(&m->stack_mon, m->cpu.SP);
+}
+
+/**
+ * @brief Clears an instance to its power-on state.
+ *
+ * Memory, peripherals, breakpoints and pending events are cleared and the
+ * CPU is initialised with init_cpu(). A shared Flash image is unmapped.
+ * The memory layout is kept.
+ *
+ * @param m Instance to initialise.
+ */
+void mcu_init(Mcu *m)
+{
+  // Fresh zero pages; the kernel drops any private or shared Flash pages
+  if (!m->mapped || !mcu_zero_pages(m->memory, m->memory_size) ||
+      !mcu_zero_pages(m->page_flags, mcu_table_size(m->memory_size)))
+  {
+    memset(m->memory, 0, m->memory_size);
+    memset(m->page_flags, 0, m->memory_size >> PAGE_SHIFT);
+    memset(m->bp_bitmap, 0, BP_BITMAP_BYTES(m->memory_size));
+  }
+  else
+  {
+    mcu_place_all(m);
+  }
+  mcu_clear_state(m);
+}
+
+/**
+ * @brief Allocates and initialises an instance with the default memory map.
+ *
+ * @return The instance, or NULL if allocation fails.
+ */
+Mcu *mcu_create(void)
+{
+  return mcu_create_config(NULL);
+}
+
+/**
+ * @brief Allocates and initialises a new instance.
+ *
+ * The instance has its own page-aligned mapping, so instances running on
+ * different threads share no cache lines and mcu_place() can move it to
+ * another NUMA node. Its memory and per-page tables are only reserved (mmap() with MAP_NORESERVE): the host commits a page when
+ * the guest first writes to it, so a large map costs nothing up front and
+ * an instance running a shared Flash image (see mcu_map_flash()) mostly
+ * pays for the SRAM it uses.
+ *
+ * @param config Region sizes, or NULL for FLASH_SIZE / SRAM_SIZE and no
+ *               external RAM.
+ * @return The instance, or NULL for an invalid map or if allocation fails.
+ */
+Mcu *mcu_create_config(const Mcu_Config *config)
+{
+  Mcu_Config sizes = config ? *config : (Mcu_Config){FLASH_SIZE, SRAM_SIZE, 0};
+  if (sizes.flash_size > REGION_MAX_SIZE || sizes.sram_size > REGION_MAX_SIZE ||
+      sizes.ext_ram_size > REGION_MAX_SIZE)
+  {
+    printf("Memory regions are limited to %u bytes\n", REGION_MAX_SIZE);
+    return NULL;
+  }
+  uint64_t sram_offset = mcu_region_align(HOST_PAGE_ALIGN((uint64_t)sizes.flash_size), sizes.sram_size);
+  uint64_t ext_offset = mcu_region_align(sram_offset + HOST_PAGE_ALIGN((uint64_t)sizes.sram_size),
+                                         sizes.ext_ram_size);
+  uint64_t memory_size = ext_offset + HOST_PAGE_ALIGN((uint64_t)sizes.ext_ram_size);
+  if (memory_size > MEMORY_MAX_SIZE)
+  {
+    printf("Memory map exceeds %u bytes\n", MEMORY_MAX_SIZE);
+    return NULL;
+  }
+
+  Mcu *m = mmap(NULL, HOST_PAGE_ALIGN(sizeof(Mcu)), PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (m == MAP_FAILED)
+  {
+    return NULL;
+  }
+  m->memory_size = memory_size;
+  m->memory = mcu_reserve(memory_size);
+  m->page_flags = mmap(NULL, mcu_table_size(memory_size), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (m->memory == MAP_FAILED || m->page_flags == MAP_FAILED)
+  {
+    if (m->memory != MAP_FAILED) munmap(m->memory, memory_size);
+    if (m->page_flags != MAP_FAILED) munmap(m->page_flags, mcu_table_size(memory_size));
+    munmap(m, HOST_PAGE_ALIGN(sizeof(Mcu)));
+    return NULL;
+  }
+  m->bp_bitmap = m->page_flags + (memory_size >> PAGE_SHIFT);
+  m->regions[REGION_FLASH] = (Mem_Region){FLASH_BASE, sizes.flash_size, 0};
+  m->regions[REGION_SRAM] = (Mem_Region){SRAM_BASE, sizes.sram_size, sram_offset};
+  m->regions[REGION_EXT_RAM] = (Mem_Region){EXT_RAM_BASE, sizes.ext_ram_size, ext_offset};
+  m->mapped = true;
+  m->numa_node = -1;
+  mcu_clear_state(m);
+  return m;
+}
+
+/**
+ * @brief Stops the instance's trace, frees its coverage, closes the files
+ *        its guest left open and unmaps it.
+ */
+void mcu_destroy(Mcu *m)
+{
+  mcu_release(m);
+  if (mcu == m)
+  {
+    mcu = &default_mcu;
+  }
+  munmap(m->memory, m->memory_size);
+  munmap(m->page_flags, mcu_table_size(m->memory_size));
+  munmap(m, HOST_PAGE_ALIGN(sizeof(Mcu)));
+}
+
+/**
+ * @brief Makes m the instance used by the calling thread.
+ *
+ * @param m Instance to select (NULL selects the default instance).
+ */
+void mcu_select(Mcu *m)
+{
+  mcu = m ? m : &default_mcu;
+}
+
+/**
+ * @brief Zeroes one region of an instance without touching the others.
+ *
+ * Mapped instances get fresh zero pages, so clearing a large region does not
+ * commit it (and drops a shared Flash image).
+ */
+void mcu_clear_region(Mcu *m, Mem_Region_Id id)
+{
+  Mem_Region *r = &m->regions[id];
+  if (!m->mapped || !mcu_zero_pages(m->memory + r->offset, HOST_PAGE_ALIGN(r->size)))
+  {
+    memset(m->memory + r->offset, 0, r->size);
+  }
+  else
+  {
+    mcu_place_range(m, m->memory + r->offset, HOST_PAGE_ALIGN(r->size));
+  }
+}
+
+/**
+ * @brief Sets a preferred NUMA node for [p, p + len) and migrates the pages
+ *        already there.
+ *
+ * p must be page aligned. Pages shared with other mappings (a shared Flash
+ * image) stay where they are.
+ *
+ * @return false if the kernel refused, e.g. without NUMA support or when a
+ *         container forbids mbind().
+ */
+bool mcu_bind_memory(void *p, size_t len, int numa_node)
+{
+  unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+  if (numa_node < 0 || numa_node >= NUMA_MAX_NODES)
+  {
+    return false;
+  }
+  mask[numa_node / (8 * sizeof(unsigned long))] |= 1UL << (numa_node % (8 * sizeof(unsigned long)));
+  return syscall(SYS_mbind, p, len, MPOL_PREFERRED, mask, NUMA_MAX_NODES + 1, MPOL_MF_MOVE) == 0;
+}
+
+/**
+ * @brief Places a mapped instance on a host NUMA node and/or on huge pages.
+ *
+ * The instance itself, its regions and its tables prefer numa_node from now
+ * on, and pages already committed are migrated there. With huge_pages,
+ * regions of at least HUGE_PAGE_SIZE are advised to use transparent huge
+ * pages; that saves TLB misses on large RAM but commits 2 MiB at a time.
+ * The placement survives mcu_init(), mcu_clear_region() and mcu_map_flash().
+ *
+ * @param numa_node Node to prefer, or -1 to leave memory where it is.
+ * @return false for the default instance or if the kernel refused the
+ *         memory policy; the instance works either way.
+ */
+bool mcu_place(Mcu *m, int numa_node, bool huge_pages)
+{
+  if (!m->mapped)
+  {
+    return false;
+  }
+  m->numa_node = numa_node;
+  m->huge_pages = huge_pages;
+  mcu_place_all(m);
+  return numa_node < 0 || mcu_bind_memory(m, HOST_PAGE_ALIGN(sizeof(Mcu)), numa_node);
+}
+
+/**
+ * @brief Creates a shareable Flash image from a buffer.
+ *
+ * The contents are padded with zeros to a host page and sealed, so they can
+ * no longer change once instances have mapped them.
+ *
+ * @return false if len exceeds REGION_MAX_SIZE or the image cannot be created.
+ */
+bool flash_image_create(Flash_Image *image, const void *data, uint32_t len)
+{
+  image->fd = -1;
+  image->len = len;
+  if (len > REGION_MAX_SIZE)
+  {
+    printf("Image does not fit in %u bytes of Flash\n", REGION_MAX_SIZE);
+    return false;
+  }
+  int fd = memfd_create("vmcu-flash", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0)
+  {
+    perror("flash image");
+    return false;
+  }
+  if (ftruncate(fd, HOST_PAGE_ALIGN(len)) < 0 || pwrite(fd, data, len, 0) != (ssize_t)len ||
+      fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+  {
+    perror("flash image");
+    close(fd);
+    return false;
+  }
+  image->fd = fd;
+  return true;
+}
+
+/**
+ * @brief Creates a shareable Flash image from a raw binary file.
+ */
+bool flash_image_load(Flash_Image *image, const char *path)
+{
+  image->fd = -1;
+  FILE *f = fopen(path, "rb");
+  if (f == NULL)
+  {
+    printf("Cannot open image %s\n", path);
+    return false;
+  }
+  uint8_t *buf = NULL;
+  long len = -1;
+  if (fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) >= 0 && len <= REGION_MAX_SIZE)
+  {
+    rewind(f);
+    buf = malloc(len ? len : 1);
+  }
+  bool ok = buf && fread(buf, 1, len, f) == (size_t)len && flash_image_create(image, buf, len);
+  if (!ok && image->fd < 0)
+  {
+    printf("Cannot read image %s\n", path);
+  }
+  free(buf);
+  fclose(f);
+  return ok;
+}
+
+/**
+ * @brief Drops the creator's reference; instances keep their mappings.
+ */
+void flash_image_release(Flash_Image *image)
+{
+  if (image->fd >= 0)
+  {
+    close(image->fd);
+    image->fd = -1;
+  }
+}
+
+/**
+ * @brief Maps a shared Flash image into an instance, copy-on-write.
+ *
+ * Pages the instance never writes stay shared with every other instance
+ * using the image; the rest of Flash is cleared. The vector table is not
+ * reloaded; select the instance and call load_vector_table() before
+ * resetting the CPU. If the host page size is not HOST_PAGE_SIZE, or m is
+ * the default instance, the image is copied instead.
+ *
+ * @return false if the image does not fit or cannot be mapped or read.
+ */
+bool mcu_map_flash(Mcu *m, const Flash_Image *image)
+{
+  if (image->len > m->regions[REGION_FLASH].size)
+  {
+    printf("Image does not fit in %u bytes of Flash\n", m->regions[REGION_FLASH].size);
+    return false;
+  }
+  mcu_clear_region(m, REGION_FLASH);
+  if (image->len == 0)
+  {
+    return true;
+  }
+  uint8_t *flash = m->memory + m->regions[REGION_FLASH].offset;
+  if (m->mapped && sysconf(_SC_PAGESIZE) == HOST_PAGE_SIZE)
+  {
+    if (mmap(flash, HOST_PAGE_ALIGN(image->len), PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_FIXED, image->fd, 0) == MAP_FAILED)
+    {
+      return false;
+    }
+    mcu_place_range(m, flash, HOST_PAGE_ALIGN(image->len));
+    return true;
+  }
+  return pread(image->fd, flash, image->len, 0) == (ssize_t)image->len;
+}
@@ -0,0 +1,231 @@
+#include "mem_ops.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#include <immintrin.h>
+#define MEM_OPS_X86 1
+#endif
+
+// Fills from an offset that is a multiple of 4, so the pattern stays in phase
+static void fill32_from(uint8_t *p, const uint8_t pat[8], size_t i, size_t len)
+{
+  uint64_t w;
+  memcpy(&w, pat, sizeof(w));
+  for (; i + 8 <= len; i += 8)
+  {
+    memcpy(p + i, &w, sizeof(w));
+  }
+  for (; i < len; i++)
+  {
+    p[i] = pat[i & 3];
+  }
+}
+
+static size_t mismatch_from(const uint8_t *a, const uint8_t *b, size_t i, size_t len)
+{
+  for (; i + 8 <= len; i += 8)
+  {
+    uint64_t x, y;
+    memcpy(&x, a + i, sizeof(x));
+    memcpy(&y, b + i, sizeof(y));
+    if (x != y)
+    {
+      break;
+    }
+  }
+  while (i < len && a[i] == b[i])
+  {
+    i++;
+  }
+  return i;
+}
+
+static void or_from(uint8_t *dst, const uint8_t *src, size_t i, size_t len)
+{
+  for (; i + 8 <= len; i += 8)
+  {
+    uint64_t x, y;
+    memcpy(&x, dst + i, sizeof(x));
+    memcpy(&y, src + i, sizeof(y));
+    x |= y;
+    memcpy(dst + i, &x, sizeof(x));
+  }
+  for (; i < len; i++)
+  {
+    dst[i] |= src[i];
+  }
+}
+
+static void pattern_bytes(uint32_t pattern, uint8_t pat[8])
+{
+  for (int i = 0; i < 8; i++)
+  {
+    pat[i] = (uint8_t)(pattern >> (8 * (i & 3)));
+  }
+}
+
+void mem_ops_fill32_scalar(uint8_t *p, uint32_t pattern, size_t len)
+{
+  uint8_t pat[8];
+  pattern_bytes(pattern, pat);
+  fill32_from(p, pat, 0, len);
+}
+
+size_t mem_ops_mismatch_scalar(const uint8_t *a, const uint8_t *b, size_t len)
+{
+  return mismatch_from(a, b, 0, len);
+}
+
+void mem_ops_or_scalar(uint8_t *dst, const uint8_t *src, size_t len)
+{
+  or_from(dst, src, 0, len);
+}
+
+#ifdef MEM_OPS_X86
+
+static void or_sse2(uint8_t *dst, const uint8_t *src, size_t len)
+{
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i *)(dst + i));
+    __m128i y = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(x, y));
+  }
+  or_from(dst, src, i, len);
+}
+
+__attribute__((target("avx2")))
+static void or_avx2(uint8_t *dst, const uint8_t *src, size_t len)
+{
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32)
+  {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(dst + i));
+    __m256i y = _mm256_loadu_si256((const __m256i *)(src + i));
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(x, y));
+  }
+  or_from(dst, src, i, len);
+}
+
+static void fill32_sse2(uint8_t *p, const uint8_t pat[8], size_t len)
+{
+  uint32_t v;
+  memcpy(&v, pat, sizeof(v));
+  __m128i x = _mm_set1_epi32((int)v);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16)
+  {
+    _mm_storeu_si128((__m128i *)(p + i), x);
+  }
+  fill32_from(p, pat, i, len);
+}
+
+static size_t mismatch_sse2(const uint8_t *a, const uint8_t *b, size_t len)
+{
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+    if (mask != 0xFFFF)
+    {
+      return i + __builtin_ctz(~mask);
+    }
+  }
+  return mismatch_from(a, b, i, len);
+}
+
+__attribute__((target("avx2")))
+static void fill32_avx2(uint8_t *p, const uint8_t pat[8], size_t len)
+{
+  uint32_t v;
+  memcpy(&v, pat, sizeof(v));
+  __m256i x = _mm256_set1_epi32((int)v);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64)
+  {
+    _mm256_storeu_si256((__m256i *)(p + i), x);
+    _mm256_storeu_si256((__m256i *)(p + i + 32), x);
+  }
+  for (; i + 32 <= len; i += 32)
+  {
+    _mm256_storeu_si256((__m256i *)(p + i), x);
+  }
+  fill32_from(p, pat, i, len);
+}
+
+__attribute__((target("avx2")))
+static size_t mismatch_avx2(const uint8_t *a, const uint8_t *b, size_t len)
+{
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32)
+  {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+    if (mask != 0xFFFFFFFF)
+    {
+      return i + __builtin_ctz(~mask);
+    }
+  }
+  return mismatch_from(a, b, i, len);
+}
+
+#endif // MEM_OPS_X86
+
+/**
+ * @brief Fills len bytes with a repeated little-endian word.
+ *
+ * Byte i gets byte (i % 4) of pattern.
+ */
+void mem_ops_fill32(uint8_t *p, uint32_t pattern, size_t len)
+{
+  uint8_t pat[8];
+  pattern_bytes(pattern, pat);
+#ifdef MEM_OPS_X86
+  if (len >= 64 && __builtin_cpu_supports("avx2"))
+  {
+    fill32_avx2(p, pat, len);
+    return;
+  }
+  fill32_sse2(p, pat, len);
+#else
+  fill32_from(p, pat, 0, len);
+#endif
+}
+
+/**
+ * @brief Returns the offset of the first byte that differs, or len if none.
+ */
+size_t mem_ops_mismatch(const uint8_t *a, const uint8_t *b, size_t len)
+{
+#ifdef MEM_OPS_X86
+  if (len >= 64 && __builtin_cpu_supports("avx2"))
+  {
+    return mismatch_avx2(a, b, len);
+  }
+  return mismatch_sse2(a, b, len);
+#else
+  return mismatch_from(a, b, 0, len);
+#endif
+}
+
+/**
+ * @brief ORs len bytes of src into dst (used to merge coverage bitmaps).
+ */
+void mem_ops_or(uint8_t *dst, const uint8_t *src, size_t len)
+{
+#ifdef MEM_OPS_X86
+  if (len >= 64 && __builtin_cpu_supports("avx2"))
+  {
+    or_avx2(dst, src, len);
+    return;
+  }
+  or_sse2(dst, src, len);
+#else
+  or_from(dst, src, 0, len);
+#endif
+}
@@ -1,119 +1,436 @@
 
 
 #include "memory_file.h"
+#include "mcu.h"
+#include "mem_ops.h"
 
-uint8_t Memory[MEMORY_SIZE];
-uint8_t Flash[FLASH_SIZE];
-uint8_t SRAM[SRAM_SIZE];
-
-_Bool check_memory_bounds(uint32_t address, uint32_t size) {
-  return (address + size - 1 < MEMORY_SIZE);
-}
+#include <stdlib.h>
 
 /**
- * @brief Prints the contents of the memory array.
+ * @brief Prints a range of guest memory.
+ *
+ * Bytes are printed in hexadecimal, eight per line, each line prefixed with
+ * its guest address. Unmapped addresses are shown as "--".
  *
- * This function iterates through the global Memory array and prints its contents
- * in a formatted manner, displaying each byte in hexadecimal format.
+ * @param addr Guest address of the first byte to print.
+ * @param len  Number of bytes to print.
  */
-void print_memory(){
-  for(int i = 0; i < MEMORY_SIZE; i++){
-    printf("[%d] 0x%02X ",i, Memory[i]);
+void print_memory(uint32_t addr, uint32_t len){
+  for(uint32_t i = 0; i < len; i++){
     if(i % 8 == 0) {
-      printf("\n");
+      printf("%s0x%08X:", i ? "\n" : "", addr + i);
+    }
+    uint8_t *p = translate_address(addr + i);
+    if (p) {
+      printf(" %02X", *p);
+    } else {
+      printf(" --");
     }
   }
   printf("\n");
 }
 
-void print_stack(){
-  for(int i = 0; i < Stack_size; i++){
-    printf("[%d] 0x%02X ",i, Stack[i]);
-    if(i % 8 == 0) {
-      printf("\n");
-    }
+/**
+ * @brief Notifies the debugger if a write touches a watched page.
+ *
+ * Only the page flag is tested here, so writes to unwatched pages cost a
+ * single load. The watchpoint list itself is walked by watch_check().
+ */
+static inline void check_watch(const uint8_t *p, uint32_t addr, uint32_t size)
+{
+  if (mcu->page_flags[(p - mcu->memory) >> PAGE_SHIFT] & PAGE_WATCHED) {
+    watch_check(addr, size);
   }
-  printf("\n");
 }
 
-
 bool mem_read8(uint32_t addr, uint8_t  *value)
 {
-    if (addr >= MEMORY_SIZE) return false;
-
-    *value = Memory[addr];
+    uint8_t *p = translate_guest(addr, BYTE_SIZE);
+    if (p == NULL) {
+        uint32_t reg;
+        if (!mmio_read(addr, BYTE_SIZE, &reg)) return false;
+        *value = (uint8_t)reg;
+    } else {
+        *value = p[0];
+    }
+    trace_access(false, addr, BYTE_SIZE, *value);
     return true;
 }
 
 bool mem_read16(uint32_t addr, uint16_t *value)
 {
-    if (addr + 1 >= MEMORY_SIZE) return false;
     if (addr & 1) {
-        // Unaligned halfword → HardFault (later)
+        // Unaligned halfword → HardFault
         return false;
     }
-
-    *value = Memory[addr] |
-            (Memory[addr + 1] << 8);
+    uint8_t *p = translate_guest(addr, HALFWORD_SIZE);
+    if (p == NULL) {
+        uint32_t reg;
+        if (!mmio_read(addr, HALFWORD_SIZE, &reg)) return false;
+        *value = (uint16_t)reg;
+    } else {
+        *value = host_load16(p);
+    }
+    trace_access(false, addr, HALFWORD_SIZE, *value);
     return true;
 }
 
 bool mem_read32(uint32_t addr, uint32_t *value)
 {
-    if (addr + 3 >= MEMORY_SIZE) return false;
     if (addr & 3) {
-        // Unaligned word → HardFault (later)
+        // Unaligned word → HardFault
         return false;
     }
-
-    *value = Memory[addr] |
-            (Memory[addr + 1] << 8) |
-            (Memory[addr + 2] << 16) |
-            (Memory[addr + 3] << 24);
+    uint8_t *p = translate_guest(addr, WORD_SIZE);
+    if (p == NULL) {
+        if (!mmio_read(addr, WORD_SIZE, value)) return false;
+    } else {
+        *value = host_load32(p);
+    }
+    trace_access(false, addr, WORD_SIZE, *value);
     return true;
 }
 
 bool mem_write8(uint32_t addr, uint8_t  value){
-  
-  if (addr >= MEMORY_SIZE) return false;
-  
-  Memory[addr] = value;
+  uint8_t *p = translate_guest(addr, BYTE_SIZE);
+  if (p == NULL) {
+    if (!mmio_write(addr, BYTE_SIZE, value)) return false;
+    trace_access(true, addr, BYTE_SIZE, value);
+    return true;
+  }
+  check_watch(p, addr, BYTE_SIZE);
+  trace_access(true, addr, BYTE_SIZE, value);
+
+  p[0] = value;
   return true;
 }
 
 bool mem_write16(uint32_t addr, uint16_t value){
-  if (addr + 1 >= MEMORY_SIZE) return false;
   if (addr & 1) { // addr % 2 == 0
-        // Unaligned halfword → HardFault (later)
+        // Unaligned halfword → HardFault
         return false;
     }
-  Memory[addr]     = (uint8_t)(value & 0xFF);
-  Memory[addr + 1] = (uint8_t)(value >> 8);
+  uint8_t *p = translate_guest(addr, HALFWORD_SIZE);
+  if (p == NULL) {
+    if (!mmio_write(addr, HALFWORD_SIZE, value)) return false;
+    trace_access(true, addr, HALFWORD_SIZE, value);
+    return true;
+  }
+  check_watch(p, addr, HALFWORD_SIZE);
+  trace_access(true, addr, HALFWORD_SIZE, value);
+
+  host_store16(p, value);
   return true;
-  
+
 }
 
 bool mem_write32(uint32_t addr, uint32_t value){
-  if (addr + 3 >= MEMORY_SIZE) return false;
   if (addr & 3) { // addr % 4 == 0
-        // Unaligned halfword → HardFault (later)
+        // Unaligned word → HardFault
         return false;
     }
-  Memory[addr]     = (uint8_t)(value & 0xFF);
-  Memory[addr + 1] = (uint8_t)((value >> 8) & 0xFF);
-  Memory[addr + 2] = (uint8_t)((value >> 16) & 0xFF);
-  Memory[addr + 3] = (uint8_t)((value >> 24) & 0xFF);
+  uint8_t *p = translate_guest(addr, WORD_SIZE);
+  if (p == NULL) {
+    if (!mmio_write(addr, WORD_SIZE, value)) return false;
+    trace_access(true, addr, WORD_SIZE, value);
+    return true;
+  }
+  check_watch(p, addr, WORD_SIZE);
+  trace_access(true, addr, WORD_SIZE, value);
+
+  host_store32(p, value);
   return true;
-  
+
 }
 
 uint8_t* translate_address(uint32_t addr){
-    if (addr < FLASH_SIZE) {
-        return &Flash[addr];
-    } else if (addr >= 0x20000000 && addr < 0x20000000 + SRAM_SIZE) {
-        return &SRAM[addr - 0x20000000];
-    } else {
-        return NULL; // Invalid address
+    return translate_range(addr, BYTE_SIZE);
+}
+
+/**
+ * @brief Translates a guest address range to a host pointer.
+ *
+ * The whole range [addr, addr + size) must lie inside a single region,
+ * otherwise NULL is returned. Regions are checked in order (Flash, SRAM,
+ * external RAM), so instruction fetches hit on the first compare.
+ *
+ * @param addr Guest address of the first byte.
+ * @param size Number of bytes in the range.
+ * @return Host pointer to the first byte, or NULL for an invalid range.
+ */
+uint8_t* translate_range(uint32_t addr, uint32_t size){
+    for (int i = 0; i < MEM_REGIONS; i++) {
+        const Mem_Region *r = &mcu->regions[i];
+        if (addr - r->base < r->size && size <= r->size - (addr - r->base)) {
+            return mcu->memory + r->offset + (addr - r->base);
+        }
+    }
+    return NULL; // Invalid address
+}
+
+/**
+ * @brief translate_range() for an access made by the guest CPU: an
+ *        instruction fetch, a load or store, or a block transfer.
+ *
+ * The access is counted against its region in the execution counters.
+ * Debugger, loader and peripheral accesses use translate_range() and are
+ * not counted.
+ */
+uint8_t* translate_guest(uint32_t addr, uint32_t size){
+    for (int i = 0; i < MEM_REGIONS; i++) {
+        const Mem_Region *r = &mcu->regions[i];
+        if (addr - r->base < r->size && size <= r->size - (addr - r->base)) {
+            STATS_INC(region_accesses[i]);
+            return mcu->memory + r->offset + (addr - r->base);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Translates a guest address and reports how many bytes follow it.
+ *
+ * @param addr  Guest address.
+ * @param avail Receives the number of contiguous bytes from addr to the end
+ *              of its region.
+ * @return Host pointer, or NULL if addr is not mapped.
+ */
+uint8_t* translate_span(uint32_t addr, uint32_t *avail){
+    for (int i = 0; i < MEM_REGIONS; i++) {
+        const Mem_Region *r = &mcu->regions[i];
+        if (addr - r->base < r->size) {
+            *avail = r->size - (addr - r->base);
+            return mcu->memory + r->offset + (addr - r->base);
+        }
+    }
+    *avail = 0;
+    return NULL;
+}
+
+// Checks the pages of a translated store target for watchpoints
+static uint8_t* watch_range(uint8_t *p, uint32_t addr, uint32_t size){
+  if (p == NULL || size == 0) return p;
+
+  uint32_t first = (p - mcu->memory) >> PAGE_SHIFT;
+  uint32_t last = (p + size - 1 - mcu->memory) >> PAGE_SHIFT;
+  for (uint32_t page = first; page <= last; page++) {
+    if (mcu->page_flags[page] & PAGE_WATCHED) {
+      watch_check(addr, size);
+      break;
+    }
+  }
+  return p;
+}
+
+/**
+ * @brief Translates the target of a block store into guest memory.
+ *
+ * Like translate_range(), but the pages covered by the range are checked
+ * for watchpoints, as mem_write* would do for each access.
+ *
+ * @param addr Guest address of the first byte.
+ * @param size Number of bytes that will be stored.
+ * @return Host pointer to the first byte, or NULL for an invalid range.
+ */
+uint8_t* translate_write(uint32_t addr, uint32_t size){
+  return watch_range(translate_range(addr, size), addr, size);
+}
+
+/**
+ * @brief translate_write() for a block store by the guest CPU, counted like
+ *        translate_guest().
+ */
+uint8_t* translate_guest_write(uint32_t addr, uint32_t size){
+  return watch_range(translate_guest(addr, size), addr, size);
+}
+
+/**
+ * @brief Copies a block of guest memory to a host buffer.
+ *
+ * The block is moved with a single memcpy from the backing array, so large
+ * debugger and loader transfers do not go through the per-byte accessors.
+ * Watchpoints are not triggered.
+ *
+ * @param addr Guest address of the first byte.
+ * @param buf  Destination host buffer.
+ * @param len  Number of bytes to copy.
+ * @return false if the block is not fully inside one mapped region.
+ */
+bool mem_read_block(uint32_t addr, void *buf, uint32_t len){
+  uint8_t *p = translate_range(addr, len);
+  if (p == NULL) return false;
+
+  memcpy(buf, p, len);
+  return true;
+}
+
+/**
+ * @brief Copies a host buffer into guest memory.
+ *
+ * Counterpart of mem_read_block(): one memcpy into the backing array,
+ * watchpoints are not triggered.
+ *
+ * @param addr Guest address of the first byte.
+ * @param buf  Source host buffer.
+ * @param len  Number of bytes to copy.
+ * @return false if the block is not fully inside one mapped region.
+ */
+bool mem_write_block(uint32_t addr, const void *buf, uint32_t len){
+  uint8_t *p = translate_range(addr, len);
+  if (p == NULL) return false;
+
+  memcpy(p, buf, len);
+  return true;
+}
+
+/**
+ * @brief Copies a block of guest memory to another guest address.
+ *
+ * Overlapping blocks are handled like memmove(). Each block must lie inside
+ * one mapped region; watchpoints are not triggered.
+ *
+ * @return false if either block is not fully inside one mapped region.
+ */
+bool mem_copy(uint32_t dst, uint32_t src, uint32_t len){
+  uint8_t *d = translate_range(dst, len);
+  const uint8_t *s = translate_range(src, len);
+  if (d == NULL || s == NULL) return false;
+
+  memmove(d, s, len);
+  return true;
+}
+
+/**
+ * @brief Fills guest memory with a repeated little-endian word.
+ *
+ * Byte i of the block gets byte (i % 4) of pattern, so a fill that is not
+ * word aligned still starts with the pattern's low byte.
+ *
+ * @return false if the block is not fully inside one mapped region.
+ */
+bool mem_fill(uint32_t addr, uint32_t pattern, uint32_t len){
+  uint8_t *p = translate_range(addr, len);
+  if (p == NULL) return false;
+
+  mem_ops_fill32(p, pattern, len);
+  return true;
+}
+
+/**
+ * @brief Compares guest memory with a host buffer.
+ *
+ * @param diff Receives the guest address of the first differing byte, or
+ *             addr + len if the block matches. May be NULL.
+ * @return false if the block is not fully inside one mapped region.
+ */
+bool mem_compare(uint32_t addr, const void *buf, uint32_t len, uint32_t *diff){
+  const uint8_t *p = translate_range(addr, len);
+  if (p == NULL) return false;
+
+  size_t n = mem_ops_mismatch(p, buf, len);
+  if (diff) *diff = addr + (uint32_t)n;
+  return true;
+}
+
+/**
+ * @brief Loads a raw binary image into Flash and reloads the vector table.
+ *
+ * The image is copied to FLASH_BASE; the remainder of Flash is cleared
+ * without being committed.
+ *
+ * @param path Path to the raw binary image.
+ * @return true on success, false if the file cannot be read or does not fit.
+ */
+bool load_binary(const char *path){
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    printf("Cannot open image %s\n", path);
+    return false;
+  }
+  uint32_t flash_size = mcu->regions[REGION_FLASH].size;
+  mcu_clear_region(mcu, REGION_FLASH);
+  size_t n = fread(Flash, 1, flash_size, f);
+  int extra = fgetc(f);
+  fclose(f);
+  if (extra != EOF) {
+    printf("Image %s does not fit in %u bytes of Flash\n", path, flash_size);
+    return false;
+  }
+  printf("Loaded %zu bytes into Flash\n", n);
+  load_vector_table((uint32_t *)Flash);
+  return true;
+}
+
+/**
+ * @brief Replaces the Flash contents with a new image, rewriting only the
+ *        host pages that differ, then reloads the vector table and resets.
+ *
+ * Meant for edit-build-test loops: the instance keeps its memory, tables
+ * and breakpoints, and a rebuilt image usually differs in a few pages.
+ * Unchanged pages are only read, so they stay shared with a mapped Flash
+ * image (mcu_map_flash()) or uncommitted. As after load_binary(), Flash
+ * past the image is zero. Coverage of rewritten pages is dropped, and
+ * pending interrupts of the old firmware are cleared.
+ *
+ * @param changed_pages Receives the number of pages rewritten. May be NULL.
+ * @return false if the image does not fit in Flash; Flash is then unchanged.
+ */
+bool reload_image(CortexM0_CPU *cpu, const void *image, uint32_t len, uint32_t *changed_pages){
+  static const uint8_t zero[HOST_PAGE_SIZE];
+  uint32_t flash_size = mcu->regions[REGION_FLASH].size;
+  if (len > flash_size) {
+    printf("Image does not fit in %u bytes of Flash\n", flash_size);
+    return false;
+  }
+
+  uint32_t changed = 0;
+  for (uint32_t off = 0; off < flash_size; off += HOST_PAGE_SIZE) {
+    uint32_t n = flash_size - off < HOST_PAGE_SIZE ? flash_size - off : HOST_PAGE_SIZE;
+    uint32_t used = off >= len ? 0 : (len - off < n ? len - off : n); // Image bytes in the page
+    const uint8_t *src = (const uint8_t *)image + (used ? off : 0);
+    uint8_t *p = Flash + off;
+    if (mem_ops_mismatch(p, src, used) == used &&
+        mem_ops_mismatch(p + used, zero, n - used) == n - used) {
+      continue;
     }
+    memcpy(p, src, used);
+    memset(p + used, 0, n - used);
+    if (mcu->coverage) {
+      coverage_invalidate(mcu->coverage, FLASH_BASE + off, FLASH_BASE + off + n);
+    }
+    changed++;
+  }
+  if (changed_pages) *changed_pages = changed;
+
+  load_vector_table((uint32_t *)Flash);
+  cpu_reset(cpu);
+  mcu->nvic_pending = 0;
+  return true;
 }
 
+/**
+ * @brief reload_image() from a raw binary file.
+ */
+bool reload_binary(CortexM0_CPU *cpu, const char *path, uint32_t *changed_pages){
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    printf("Cannot open image %s\n", path);
+    return false;
+  }
+  uint8_t *buf = NULL;
+  long len = -1;
+  if (fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) >= 0 && len <= REGION_MAX_SIZE) {
+    rewind(f);
+    buf = malloc(len ? len : 1);
+  }
+  bool read = buf && fread(buf, 1, len, f) == (size_t)len;
+  fclose(f);
+  if (!read) {
+    printf("Cannot read image %s\n", path);
+    free(buf);
+    return false;
+  }
+  bool ok = reload_image(cpu, buf, len, changed_pages);
+  free(buf);
+  return ok;
+}
@@ -0,0 +1,86 @@
+#include "mmio.h"
+#include "mcu.h"
+
+/**
+ * @brief Maps a peripheral's register block into the address space.
+ *
+ * @param base  Guest address of the register block.
+ * @param size  Size of the register block in bytes.
+ * @param read  Handler for loads (NULL makes the block write-only).
+ * @param write Handler for stores (NULL makes the block read-only).
+ * @param ctx   Peripheral state passed back to the handlers.
+ * @return false if the table is full or the block overlaps another one.
+ */
+bool mmio_register(uint32_t base, uint32_t size, Mmio_Read read, Mmio_Write write, void *ctx)
+{
+  if (mcu->mmio_count == MAX_MMIO_REGIONS || size == 0)
+  {
+    return false;
+  }
+  for (uint32_t i = 0; i < mcu->mmio_count; i++)
+  {
+    if (base < mcu->mmio_regions[i].base + mcu->mmio_regions[i].size && mcu->mmio_regions[i].base < base + size)
+    {
+      return false;
+    }
+  }
+  mcu->mmio_regions[mcu->mmio_count++] = (Mmio_Region){base, size, read, write, ctx};
+  return true;
+}
+
+void mmio_unregister(uint32_t base)
+{
+  for (uint32_t i = 0; i < mcu->mmio_count; i++)
+  {
+    if (mcu->mmio_regions[i].base == base)
+    {
+      mcu->mmio_regions[i] = mcu->mmio_regions[--mcu->mmio_count];
+      return;
+    }
+  }
+}
+
+static Mmio_Region *mmio_find(uint32_t addr, uint32_t size)
+{
+  for (uint32_t i = 0; i < mcu->mmio_count; i++)
+  {
+    if (addr - mcu->mmio_regions[i].base < mcu->mmio_regions[i].size &&
+        size <= mcu->mmio_regions[i].size - (addr - mcu->mmio_regions[i].base))
+    {
+      return &mcu->mmio_regions[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Dispatches a load that missed Flash and SRAM to a peripheral.
+ *
+ * @return false if no peripheral claims the address (→ HardFault).
+ */
+bool mmio_read(uint32_t addr, uint32_t size, uint32_t *value)
+{
+  STATS_INC(mmio_accesses);
+  Mmio_Region *region = mmio_find(addr, size);
+  if (region == NULL || region->read == NULL)
+  {
+    return false;
+  }
+  return region->read(region->ctx, addr - region->base, size, value);
+}
+
+/**
+ * @brief Dispatches a store that missed Flash and SRAM to a peripheral.
+ *
+ * @return false if no peripheral claims the address (→ HardFault).
+ */
+bool mmio_write(uint32_t addr, uint32_t size, uint32_t value)
+{
+  STATS_INC(mmio_accesses);
+  Mmio_Region *region = mmio_find(addr, size);
+  if (region == NULL || region->write == NULL)
+  {
+    return false;
+  }
+  return region->write(region->ctx, addr - region->base, size, value);
+}
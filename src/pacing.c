@@ -0,0 +1,116 @@
+#include "pacing.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#define NS_PER_SEC 1000000000ull
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+// Guest cycles to wall nanoseconds without overflowing on long runs
+static uint64_t cycles_to_ns(const Pacer *p, uint64_t cycles)
+{
+  return cycles / p->hz * NS_PER_SEC + cycles % p->hz * NS_PER_SEC / p->hz;
+}
+
+static void sleep_until(uint64_t deadline)
+{
+  struct timespec ts = {(time_t)(deadline / NS_PER_SEC), (long)(deadline % NS_PER_SEC)};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+  {
+  }
+}
+
+/**
+ * @brief Sets up a pacer for the given core clock with default batch size
+ *        and catch-up bound, and clears its statistics.
+ */
+void pacer_init(Pacer *p, uint64_t hz)
+{
+  memset(p, 0, sizeof(*p));
+  p->hz = hz ? hz : PACE_DEFAULT_HZ;
+  p->quantum = p->hz * PACE_PERIOD_NS / NS_PER_SEC;
+  p->quantum = p->quantum ? p->quantum : 1;
+  p->max_lag_ns = PACE_MAX_LAG_NS;
+}
+
+/**
+ * @brief Runs like cpu_run(), but no faster than the pacer's core clock.
+ *
+ * The origin is set when the call starts, so time spent stopped between
+ * calls is not caught up. On Linux the calling thread's timer slack is
+ * lowered to 1 ns, since the default 50 us would dominate the wake-up jitter.
+ *
+ * @param max Instruction budget (RUN_FOREVER for no limit).
+ */
+Stop_Reason pacer_run(Pacer *p, CortexM0_CPU *cpu, uint64_t max)
+{
+#ifdef __linux__
+  prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+#endif
+  uint64_t start_ns = now_ns();
+  uint64_t start_cycles = cpu->cycles;
+  p->origin_ns = start_ns;
+  p->origin_cycles = start_cycles;
+
+  Stop_Reason reason = STOP_NONE;
+  for (uint64_t left = max; left > 0 && reason == STOP_NONE;)
+  {
+    uint64_t n = left < p->quantum ? left : p->quantum;
+    reason = cpu_run(cpu, n);
+    left -= n;
+    p->batches++;
+
+    // Exception stacking costs advance the clock too, so pace on cycles
+    uint64_t deadline = p->origin_ns + cycles_to_ns(p, cpu->cycles - p->origin_cycles);
+    uint64_t now = now_ns();
+    if (now > deadline)
+    {
+      uint64_t lag = now - deadline;
+      p->overruns++;
+      p->overrun_max_ns = lag > p->overrun_max_ns ? lag : p->overrun_max_ns;
+      if (lag > p->max_lag_ns)
+      {
+        p->resyncs++;
+        p->dropped_ns += lag;
+        p->origin_ns = now;
+        p->origin_cycles = cpu->cycles;
+      }
+      continue;
+    }
+    sleep_until(deadline);
+    latency_hist_add(&p->jitter, now_ns() - deadline, cpu->PC);
+  }
+
+  p->wall_ns += now_ns() - start_ns;
+  p->guest_ns += cycles_to_ns(p, cpu->cycles - start_cycles);
+  return reason;
+}
+
+void print_pacer_report(const Pacer *p)
+{
+  printf("Paced at %llu Hz in batches of %llu instructions\n", (unsigned long long)p->hz,
+         (unsigned long long)p->quantum);
+  printf("  guest %.3f ms, wall %.3f ms, %llu batches\n", p->guest_ns / 1e6, p->wall_ns / 1e6,
+         (unsigned long long)p->batches);
+  if (p->jitter.count)
+  {
+    printf("  wake-up jitter: mean %llu ns, p50 %llu, p99 %llu, worst %llu ns\n",
+           (unsigned long long)(p->jitter.total / p->jitter.count),
+           (unsigned long long)latency_hist_percentile(&p->jitter, 500),
+           (unsigned long long)latency_hist_percentile(&p->jitter, 990),
+           (unsigned long long)p->jitter.worst);
+  }
+  printf("  overruns: %llu (worst %llu ns), resyncs: %llu (%.3f ms dropped)\n",
+         (unsigned long long)p->overruns, (unsigned long long)p->overrun_max_ns,
+         (unsigned long long)p->resyncs, p->dropped_ns / 1e6);
+}
@@ -0,0 +1,289 @@
+#include "semihosting.h"
+#include "memory_file.h"
+#include "mcu.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const open_modes[12] = {
+  "r", "rb", "r+", "r+b", "w", "wb", "w+", "w+b", "a", "ab", "a+", "a+b"
+};
+
+/**
+ * @brief Allocates a handle for a host stream.
+ *
+ * Regular files are made unbuffered in stdio: all buffering happens in the
+ * handle's own SEMIHOST_BUFFER_SIZE buffer. Console handles are shared per
+ * stream.
+ *
+ * @return Handle (index + 1), or -1 if the table is full.
+ */
+static int add_file(FILE *file, bool is_console)
+{
+  int free_slot = -1;
+  for (int i = 0; i < SEMIHOST_MAX_FILES; i++)
+  {
+    if (is_console && mcu->semihost_files[i].file == file)
+    {
+      return i + 1;
+    }
+    if (mcu->semihost_files[i].file == NULL && free_slot < 0)
+    {
+      free_slot = i;
+    }
+  }
+  if (free_slot < 0)
+  {
+    return -1;
+  }
+  uint8_t *buffer = malloc(SEMIHOST_BUFFER_SIZE);
+  if (buffer == NULL)
+  {
+    return -1;
+  }
+  if (!is_console)
+  {
+    setvbuf(file, NULL, _IONBF, 0);
+  }
+  mcu->semihost_files[free_slot] = (Semihost_File){file, buffer, 0, is_console};
+  return free_slot + 1;
+}
+
+static Semihost_File *get_file(uint32_t handle)
+{
+  if (handle == 0 || handle > SEMIHOST_MAX_FILES || mcu->semihost_files[handle - 1].file == NULL)
+  {
+    return NULL;
+  }
+  return &mcu->semihost_files[handle - 1];
+}
+
+static void file_flush(Semihost_File *f)
+{
+  if (f->used)
+  {
+    fwrite(f->buffer, 1, f->used, f->file);
+    f->used = 0;
+  }
+  fflush(f->file);
+}
+
+/**
+ * @brief Appends guest data to the handle's buffer.
+ *
+ * Small writes cost one memcpy; the host write() happens once per full
+ * buffer. Writes larger than the buffer go straight to the stream.
+ */
+static void file_write(Semihost_File *f, const uint8_t *data, size_t len)
+{
+  if (f->used + len > SEMIHOST_BUFFER_SIZE)
+  {
+    file_flush(f);
+  }
+  if (len >= SEMIHOST_BUFFER_SIZE)
+  {
+    fwrite(data, 1, len, f->file);
+    return;
+  }
+  memcpy(f->buffer + f->used, data, len);
+  f->used += len;
+}
+
+static void close_file(Semihost_File *f)
+{
+  file_flush(f);
+  if (!f->is_console)
+  {
+    fclose(f->file);
+  }
+  free(f->buffer);
+  *f = (Semihost_File){0};
+}
+
+/**
+ * @brief Returns a host pointer to a NUL-terminated guest string.
+ *
+ * The terminator is searched with memchr over the backing memory of the
+ * region that holds the string.
+ *
+ * @return The string, or NULL if it is unmapped or runs off its region.
+ */
+static const char *guest_string(uint32_t addr, size_t *len)
+{
+  uint32_t avail;
+  const char *p = (const char *)translate_span(addr, &avail);
+  const char *end = p ? memchr(p, '\0', avail) : NULL;
+  if (end == NULL)
+  {
+    return NULL;
+  }
+  *len = end - p;
+  return p;
+}
+
+/**
+ * @brief Executes a semihosting request (BKPT 0xAB).
+ *
+ * R0 holds the operation and R1 the parameter (usually a pointer to a
+ * parameter block); the result is returned in R0. Data buffers are taken
+ * straight from the backing memory through the memory map and moved in one
+ * block, without going through the per-byte accessors. Host writes are
+ * buffered per handle.
+ *
+ * @param cpu Pointer to the CortexM0_CPU structure representing the CPU state.
+ * @return STOP_EXIT for SYS_EXIT, STOP_HARDFAULT for a bad parameter block,
+ *         STOP_NONE otherwise.
+ */
+Stop_Reason semihosting_call(CortexM0_CPU *cpu)
+{
+  uint32_t op = cpu->R[0];
+  uint32_t arg[3];
+
+  mcu->semihost_host_io |= op != SYS_EXIT;
+  if (!mcu->semihost_clock_started)
+  {
+    mcu->semihost_start_clock = clock();
+    mcu->semihost_clock_started = true;
+  }
+
+  switch (op)
+  {
+  case SYS_OPEN:
+  {
+    if (!mem_read_block(cpu->R[1], arg, sizeof(arg)))
+    {
+      break;
+    }
+    size_t name_len;
+    const char *name = guest_string(arg[0], &name_len);
+    if (name == NULL || arg[1] >= 12)
+    {
+      cpu->R[0] = (uint32_t)-1;
+      return STOP_NONE;
+    }
+    if (strcmp(name, ":tt") == 0)
+    {
+      FILE *console = arg[1] < 4 ? stdin : (arg[1] < 8 ? stdout : stderr);
+      cpu->R[0] = add_file(console, true);
+      return STOP_NONE;
+    }
+    FILE *file = fopen(name, open_modes[arg[1]]);
+    cpu->R[0] = file ? (uint32_t)add_file(file, false) : (uint32_t)-1;
+    return STOP_NONE;
+  }
+
+  case SYS_CLOSE:
+  {
+    if (!mem_read_block(cpu->R[1], arg, WORD_SIZE))
+    {
+      break;
+    }
+    Semihost_File *f = get_file(arg[0]);
+    if (f)
+    {
+      close_file(f);
+    }
+    cpu->R[0] = f ? 0 : (uint32_t)-1;
+    return STOP_NONE;
+  }
+
+  case SYS_WRITE0:
+  {
+    size_t len;
+    const char *str = guest_string(cpu->R[1], &len);
+    Semihost_File *f = get_file(add_file(stdout, true));
+    if (str == NULL || f == NULL)
+    {
+      break;
+    }
+    file_write(f, (const uint8_t *)str, len);
+    return STOP_NONE;
+  }
+
+  case SYS_WRITE:
+  {
+    if (!mem_read_block(cpu->R[1], arg, sizeof(arg)))
+    {
+      break;
+    }
+    Semihost_File *f = get_file(arg[0]);
+    const uint8_t *buf = translate_range(arg[1], arg[2]);
+    if (f == NULL || (buf == NULL && arg[2] != 0))
+    {
+      cpu->R[0] = arg[2];
+      return STOP_NONE;
+    }
+    file_write(f, buf, arg[2]);
+    cpu->R[0] = 0; // Bytes not written
+    return STOP_NONE;
+  }
+
+  case SYS_READ:
+  {
+    if (!mem_read_block(cpu->R[1], arg, sizeof(arg)))
+    {
+      break;
+    }
+    Semihost_File *f = get_file(arg[0]);
+    uint8_t *buf = translate_write(arg[1], arg[2]);
+    if (f == NULL || (buf == NULL && arg[2] != 0))
+    {
+      cpu->R[0] = arg[2];
+      return STOP_NONE;
+    }
+    if (f->is_console)
+    {
+      semihosting_flush(); // Make pending output visible before blocking on input
+    }
+    file_flush(f);
+    cpu->R[0] = arg[2] - fread(buf, 1, arg[2], f->file); // Bytes not read
+    return STOP_NONE;
+  }
+
+  case SYS_CLOCK:
+    cpu->R[0] = (uint32_t)((clock() - mcu->semihost_start_clock) / (CLOCKS_PER_SEC / 100));
+    return STOP_NONE;
+
+  case SYS_EXIT:
+    semihosting_flush();
+    mcu->semihost_exit_code = (cpu->R[1] == ADP_STOPPED_APPLICATION_EXIT) ? 0 : 1;
+    return STOP_EXIT;
+
+  default:
+    printf("Unsupported semihosting operation 0x%02X\n", op);
+    cpu->R[0] = (uint32_t)-1;
+    return STOP_NONE;
+  }
+
+  // Parameter block or string outside mapped memory
+  raise_hardfault(cpu);
+  return STOP_HARDFAULT;
+}
+
+/**
+ * @brief Flushes the host-side buffers of all open semihosting files.
+ */
+void semihosting_flush(void)
+{
+  for (int i = 0; i < SEMIHOST_MAX_FILES; i++)
+  {
+    if (mcu->semihost_files[i].file)
+    {
+      file_flush(&mcu->semihost_files[i]);
+    }
+  }
+}
+
+/**
+ * @brief Closes every file the guest left open and releases the buffers.
+ */
+void semihosting_close_all(void)
+{
+  for (int i = 0; i < SEMIHOST_MAX_FILES; i++)
+  {
+    if (mcu->semihost_files[i].file)
+    {
+      close_file(&mcu->semihost_files[i]);
+    }
+  }
+}
@@ -0,0 +1,192 @@
+#include "stack_mon.h"
+#include "mcu.h"
+
+#include <string.h>
+
+/**
+ * @brief Starts a new measurement from the given SP.
+ *
+ * Peaks are cleared; the SP limit and the canary range are kept.
+ */
+void stack_mon_reset(Stack_Monitor *mon, uint32_t sp)
+{
+  memset(mon->peak, 0, sizeof(mon->peak));
+  mon->initial_sp = sp;
+  mon->low = sp;
+  mon->thread_low = sp;
+  mon->min_sp = sp;
+  mon->entry_sp = sp;
+  mon->handler = 0;
+  mon->limit_hit = false;
+}
+
+/**
+ * @brief Records a new lowest SP for the current context.
+ *
+ * Called by the push paths only when sp is below the current low, so the
+ * limit is tested once per new low rather than on every push.
+ *
+ * @return false if sp crosses the limit: the push must not be performed and
+ *         the run loop stops with STOP_STACK_LIMIT.
+ */
+bool stack_mon_new_low(CortexM0_CPU *cpu, uint32_t sp)
+{
+  Stack_Monitor *mon = &mcu->stack_mon;
+  if (sp < mon->limit)
+  {
+    mon->limit_hit = true;
+    cpu->exception_pending = HARDFAULT;
+    return false;
+  }
+  mon->low = sp;
+  if (sp < mon->min_sp)
+  {
+    mon->min_sp = sp;
+  }
+  return true;
+}
+
+/**
+ * @brief Switches to handler context before an exception frame is stacked.
+ *
+ * @param sp SP once the frame is stacked.
+ * @param exception_number Exception being entered.
+ * @return false if the frame would cross the limit.
+ */
+bool stack_mon_enter(CortexM0_CPU *cpu, uint32_t sp, uint8_t exception_number)
+{
+  Stack_Monitor *mon = &mcu->stack_mon;
+  uint32_t thread_low = mon->low;
+  mon->low = cpu->SP;
+  if (!stack_mon_new_low(cpu, sp))
+  {
+    mon->low = thread_low;
+    return false;
+  }
+  mon->thread_low = thread_low;
+  mon->entry_sp = cpu->SP;
+  mon->handler = exception_number;
+  return true;
+}
+
+/**
+ * @brief Folds the running handler's depth into its peak and resumes Thread mode.
+ */
+void stack_mon_exit(void)
+{
+  Stack_Monitor *mon = &mcu->stack_mon;
+  uint32_t depth = mon->entry_sp - mon->low;
+  if (depth > mon->peak[mon->handler])
+  {
+    mon->peak[mon->handler] = depth;
+  }
+  mon->low = mon->thread_low;
+  mon->handler = 0;
+}
+
+/**
+ * @brief Stops execution before any push or exception entry that would
+ *        move SP below addr (0 disables the limit).
+ *
+ * The instruction is not executed and PC is left on it. The limit is
+ * tested when SP reaches a new low, so set it before SP has gone below it.
+ */
+void stack_set_limit(uint32_t addr)
+{
+  mcu->stack_mon.limit = addr;
+  mcu->stack_mon.limit_hit = false;
+}
+
+/**
+ * @brief Fills [start, end) with STACK_CANARY for later high-water scans.
+ *
+ * This commits the pages of the range, so fill only the part of SRAM that
+ * holds the stack (and the data it may grow into).
+ *
+ * @return false if the range is not word aligned or not inside one region.
+ */
+bool stack_canary_fill(uint32_t start, uint32_t end)
+{
+  uint8_t *p = end > start ? translate_range(start, end - start) : NULL;
+  if (p == NULL || ((start | end) & 3))
+  {
+    return false;
+  }
+  memset(p, STACK_CANARY & 0xFF, end - start);
+  mcu->stack_mon.canary_start = start;
+  mcu->stack_mon.canary_end = end;
+  return true;
+}
+
+/**
+ * @brief Reports stack use so far.
+ *
+ * Peaks come from SP tracking. The canary range is scanned here, not on
+ * writes: sram_high_water is the highest byte written inside it, and with a
+ * limit, headroom is the run of untouched canary bytes from the limit up.
+ * A store that writes the canary value itself cannot be told apart.
+ */
+void stack_report(Stack_Report *out)
+{
+  const Stack_Monitor *mon = &mcu->stack_mon;
+  uint32_t ipsr = mon->handler;
+  memcpy(out->peak, mon->peak, sizeof(out->peak));
+  uint32_t thread_low = ipsr ? mon->thread_low : mon->low;
+  if (mon->initial_sp - thread_low > out->peak[0])
+  {
+    out->peak[0] = mon->initial_sp - thread_low;
+  }
+  if (ipsr && mon->entry_sp - mon->low > out->peak[ipsr])
+  {
+    out->peak[ipsr] = mon->entry_sp - mon->low;
+  }
+  out->max_depth = mon->initial_sp - mon->min_sp;
+
+  out->sram_high_water = 0;
+  out->headroom = 0;
+  const uint8_t *p = translate_range(mon->canary_start, mon->canary_end - mon->canary_start);
+  if (p == NULL || mon->canary_end <= mon->canary_start)
+  {
+    return;
+  }
+  uint32_t len = mon->canary_end - mon->canary_start;
+  for (uint32_t i = len; i > 0; i--)
+  {
+    if (p[i - 1] != (STACK_CANARY & 0xFF))
+    {
+      out->sram_high_water = mon->canary_start + i - 1;
+      break;
+    }
+  }
+  if (mon->limit >= mon->canary_start && mon->limit < mon->canary_end)
+  {
+    uint32_t i = mon->limit - mon->canary_start;
+    while (i < len && p[i] == (STACK_CANARY & 0xFF))
+    {
+      i++;
+    }
+    out->headroom = i - (mon->limit - mon->canary_start);
+  }
+}
+
+void print_stack_report(void)
+{
+  Stack_Report report;
+  stack_report(&report);
+  printf("Stack: %u bytes max (Thread %u)\n", report.max_depth, report.peak[0]);
+  for (int n = 1; n < VECTOR_TABLE_SIZE; n++)
+  {
+    if (report.peak[n])
+    {
+      printf("  exception %d: %u bytes\n", n, report.peak[n]);
+    }
+  }
+  if (mcu->stack_mon.limit)
+  {
+    printf("Limit 0x%08X, %u bytes never used above it\n", mcu->stack_mon.limit, report.headroom);
+  }
+  if (report.sram_high_water)
+  {
+    printf("Highest SRAM byte written: 0x%08X\n", report.sram_high_water);
+  }
+}
@@ -0,0 +1,53 @@
+#include "stats.h"
+#include "mcu.h"
+
+#include <string.h>
+
+/**
+ * @brief Copies the selected instance's counters and fills in derived fields.
+ *
+ * With VMCU_NO_STATS every counter reads as 0.
+ */
+void stats_snapshot(Mcu_Stats *out)
+{
+#ifdef VMCU_NO_STATS
+  memset(out, 0, sizeof(*out));
+#else
+  *out = mcu->stats;
+  out->instructions = out->alu + out->load_store + out->branch +
+                      out->bcond_taken + out->bcond_not_taken + out->other;
+  out->stack_depth = mcu->stack_mon.initial_sp - mcu->stack_mon.min_sp;
+#endif
+}
+
+void stats_reset(void)
+{
+#ifndef VMCU_NO_STATS
+  memset(&mcu->stats, 0, sizeof(mcu->stats));
+#endif
+}
+
+/**
+ * @brief Formats a snapshot as a single-line JSON object.
+ *
+ * @return Length of the full JSON text, as snprintf() (the output is
+ *         truncated if that is not less than len).
+ */
+size_t stats_json(const Mcu_Stats *s, char *buf, size_t len)
+{
+  int n = snprintf(buf, len,
+    "{\"instructions\":%llu,\"alu\":%llu,\"load_store\":%llu,\"branch\":%llu,"
+    "\"bcond_taken\":%llu,\"bcond_not_taken\":%llu,\"other\":%llu,"
+    "\"flash_accesses\":%llu,\"sram_accesses\":%llu,\"ext_ram_accesses\":%llu,"
+    "\"mmio_accesses\":%llu,\"hardfaults\":%llu,\"exceptions\":%llu,\"stack_depth\":%u}",
+    (unsigned long long)s->instructions, (unsigned long long)s->alu,
+    (unsigned long long)s->load_store, (unsigned long long)s->branch,
+    (unsigned long long)s->bcond_taken, (unsigned long long)s->bcond_not_taken,
+    (unsigned long long)s->other,
+    (unsigned long long)s->region_accesses[REGION_FLASH],
+    (unsigned long long)s->region_accesses[REGION_SRAM],
+    (unsigned long long)s->region_accesses[REGION_EXT_RAM],
+    (unsigned long long)s->mmio_accesses, (unsigned long long)s->hardfaults,
+    (unsigned long long)s->exceptions, s->stack_depth);
+  return n < 0 ? 0 : (size_t)n;
+}
@@ -1,4 +1,68 @@
 #include "test_mod.h"
+#include "memory_file.h"
+#include "execute.h"
+#include "debug.h"
+#include "gdb_stub.h"
+#include "uart.h"
+#include "semihosting.h"
+#include "dma.h"
+#include "events.h"
+#include "exception.h"
+#include "mcu.h"
+#include "cosim.h"
+#include "vmcu.h"
+#include "lz.h"
+#include "batch.h"
+#include "mem_ops.h"
+#include "pacing.h"
+#include "conformance.h"
+#include "alu.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <elf.h>
+
+// Copies a Thumb program into Flash at address 0
+static void load_program(const uint16_t *code, uint32_t count)
+{
+    memset(Flash, 0, FLASH_SIZE);
+    for (uint32_t i = 0; i < count; i++) {
+        Flash[2 * i] = code[i] & 0xFF;
+        Flash[2 * i + 1] = code[i] >> 8;
+    }
+}
+
+#define TEST_CODE 0xC0 // Test programs start right after the vector table
+
+// Lays out a test image: initial SP at the top of SRAM, reset vector at
+// TEST_CODE and the code from there; the rest of image is zero
+static void build_test_image(uint32_t *image, size_t size, const uint16_t *code, size_t code_size)
+{
+    assert(TEST_CODE + code_size <= size);
+    memset(image, 0, size);
+    image[0] = SRAM_BASE + SRAM_SIZE;
+    image[1] = TEST_CODE | 1;
+    memcpy((uint8_t *)image + TEST_CODE, code, code_size);
+}
+
+// A fresh instance with the default memory map and image loaded
+static Vmcu *load_test_image(const uint32_t *image, size_t size)
+{
+    Vmcu *vm = vmcu_create(NULL);
+    assert(vm && vmcu_load_image(vm, image, size));
+    return vm;
+}
+
+static Vmcu *load_test_program(uint32_t *image, size_t size, const uint16_t *code, size_t code_size)
+{
+    build_test_image(image, size, code, code_size);
+    return load_test_image(image, size);
+}
 
 void test_Bcond_EQ(CortexM0_CPU *cpu) {
     uint32_t L_offset = 4;
@@ -15,3 +79,1333 @@ void test_Bcond_EQ(CortexM0_CPU *cpu) {
     Bcond(cpu, L_offset, EQ);
     assert(*pc_reg == L_offset);
 }
+
+void test_breakpoint_stops_run(CortexM0_CPU *cpu) {
+    const uint16_t program[] = {
+        0x2001, // MOVS r0, #1
+        0x2102, // MOVS r1, #2
+        0x1842, // ADDS r2, r0, r1
+        0xE7FE, // B .
+    };
+    load_program(program, 4);
+    init_cpu(cpu);
+    breakpoints_clear_all();
+    assert(breakpoint_set(0x4));
+
+    assert(cpu_run(cpu, RUN_FOREVER) == STOP_BREAKPOINT);
+    assert(cpu->PC == 0x4);
+    assert(cpu->R[2] == 0);
+
+    // Resuming steps over the breakpoint
+    assert(cpu_run(cpu, 1) == STOP_NONE);
+    assert(cpu->R[2] == 3);
+    breakpoints_clear_all();
+}
+
+void test_watchpoint_stops_run(CortexM0_CPU *cpu) {
+    const uint16_t program[] = {
+        0x2020, // MOVS r0, #0x20
+        0x0600, // LSLS r0, r0, #24
+        0x2155, // MOVS r1, #0x55
+        0x2200, // MOVS r2, #0
+        0x5081, // STR r1, [r0, r2]
+        0xE7FE, // B .
+    };
+    load_program(program, 6);
+    init_cpu(cpu);
+    assert(watchpoint_set(SRAM_BASE, 4));
+
+    assert(cpu_run(cpu, 100) == STOP_WATCHPOINT);
+    assert(mcu->watch_hit_addr == SRAM_BASE);
+    assert(cpu->PC == 0xA);
+    assert(SRAM[0] == 0x55);
+
+    // Writes to an unwatched page never reach the slow path
+    watchpoints_clear_all();
+    assert(!(mcu->page_flags[(SRAM - mcu->memory) >> PAGE_SHIFT] & PAGE_WATCHED));
+    init_cpu(cpu);
+    assert(cpu_run(cpu, 100) == STOP_NONE);
+}
+
+typedef struct {
+    CortexM0_CPU *cpu;
+    int fd;
+} Gdb_Test_Server;
+
+static void *gdb_test_server(void *arg) {
+    Gdb_Test_Server *server = arg;
+    gdb_serve(server->cpu, server->fd);
+    return NULL;
+}
+
+// Sends one packet and returns the payload of the reply (acks are skipped)
+static const char *gdb_transact(int fd, const char *payload) {
+    static char reply[GDB_PACKET_SIZE + 8];
+    char packet[GDB_PACKET_SIZE + 8];
+    uint8_t sum = 0;
+    for (const char *c = payload; *c; c++) {
+        sum += (uint8_t)*c;
+    }
+    int len = snprintf(packet, sizeof(packet), "$%s#%02x", payload, sum);
+    assert(write(fd, packet, len) == len);
+
+    size_t n = 0;
+    char c;
+    do {
+        assert(read(fd, &c, 1) == 1);
+    } while (c != '$');
+    while (read(fd, &c, 1) == 1 && c != '#') {
+        reply[n++] = c;
+    }
+    reply[n] = '\0';
+    char checksum[2];
+    assert(read(fd, checksum, 2) == 2);
+    return reply;
+}
+
+void test_gdb_stub(CortexM0_CPU *cpu) {
+    const uint16_t program[] = {
+        0x2001, // MOVS r0, #1
+        0x2102, // MOVS r1, #2
+        0x1842, // ADDS r2, r0, r1
+        0xE7FE, // B .
+    };
+    load_program(program, 4);
+    init_cpu(cpu);
+    breakpoints_clear_all();
+
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    Gdb_Test_Server server = {cpu, fds[0]};
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, gdb_test_server, &server) == 0);
+    int fd = fds[1];
+
+    assert(strcmp(gdb_transact(fd, "QStartNoAckMode"), "OK") == 0);
+    assert(strcmp(gdb_transact(fd, "?"), "S05") == 0);
+
+    // Bulk memory write and read back
+    assert(strcmp(gdb_transact(fd, "M20000010,4:deadbeef"), "OK") == 0);
+    assert(strcmp(gdb_transact(fd, "m20000010,4"), "deadbeef") == 0);
+    assert(strcmp(gdb_transact(fd, "X20000014,2:}]x"), "OK") == 0);
+    assert(SRAM[0x14] == '}' && SRAM[0x15] == 'x');
+    assert(strcmp(gdb_transact(fd, "m1fffffff,4"), "E01") == 0);
+
+    // Registers: xPSR has the Thumb bit set
+    assert(strlen(gdb_transact(fd, "g")) == 17 * 8);
+    assert(strcmp(gdb_transact(fd, "p19"), "00000001") == 0);
+    assert(strcmp(gdb_transact(fd, "P3=78563412"), "OK") == 0);
+    assert(cpu->R[3] == 0x12345678);
+
+    // Breakpoint, continue and single-step
+    assert(strcmp(gdb_transact(fd, "Z0,4,2"), "OK") == 0);
+    assert(strcmp(gdb_transact(fd, "c"), "S05") == 0);
+    assert(strcmp(gdb_transact(fd, "pf"), "04000000") == 0);
+    assert(strcmp(gdb_transact(fd, "s"), "S05") == 0);
+    assert(strcmp(gdb_transact(fd, "p2"), "03000000") == 0);
+    assert(strcmp(gdb_transact(fd, "z0,4,2"), "OK") == 0);
+
+    assert(strcmp(gdb_transact(fd, "D"), "OK") == 0);
+    pthread_join(thread, NULL);
+    close(fd);
+}
+
+void test_uart(CortexM0_CPU *cpu) {
+    static Uart uart;
+    int tx[2], rx[2];
+    assert(pipe(tx) == 0 && pipe(rx) == 0);
+    assert(uart_init(&uart, UART_DEFAULT_BASE));
+    assert(uart_attach(&uart, tx[1], rx[0]));
+
+    // TX: the emulator only touches the ring; the host thread does the write()
+    const char *msg = "hello";
+    for (const char *c = msg; *c; c++) {
+        assert(mem_write8(UART_DEFAULT_BASE + UART_DR, *c));
+    }
+
+    // RX: bytes written on the host side show up behind RXNE
+    assert(write(rx[1], "k", 1) == 1);
+    uint32_t sr = 0;
+    while (!(sr & UART_SR_RXNE)) {
+        assert(mem_read32(UART_DEFAULT_BASE + UART_SR, &sr));
+    }
+    uint8_t byte;
+    assert(mem_read8(UART_DEFAULT_BASE + UART_DR, &byte) && byte == 'k');
+
+    uart_detach(&uart);
+    char out[8] = {0};
+    assert(read(tx[0], out, sizeof(out)) == 5 && strcmp(out, msg) == 0);
+    assert(!mem_write8(UART_DEFAULT_BASE + UART_DR, 'x')); // Unmapped after detach
+    close(tx[0]); close(tx[1]); close(rx[0]); close(rx[1]);
+
+    // Neither input at EOF nor a full RX ring with input pending makes the I/O thread spin
+    static char pending[RING_SIZE + 100];
+    int null_fd = open("/dev/null", O_RDONLY);
+    assert(null_fd >= 0 && pipe(rx) == 0);
+    assert(write(rx[1], pending, sizeof(pending)) == (ssize_t)sizeof(pending));
+    for (int phase = 0; phase < 2; phase++) {
+        assert(uart_init(&uart, UART_DEFAULT_BASE));
+        struct timespec t0, t1, nap = {0, 50000000};
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        assert(uart_attach(&uart, -1, phase == 0 ? null_fd : rx[0]));
+        nanosleep(&nap, NULL);
+        uart_detach(&uart);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        // Each idle wake-up follows a 1 ms wait, however loaded the host; a
+        // spinning thread wakes thousands of times per ms
+        uint64_t ms = (t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_nsec - t0.tv_nsec) / 1000000;
+        assert(uart.polls <= ms + 10);
+    }
+    close(null_fd); close(rx[0]); close(rx[1]);
+    (void)cpu;
+}
+
+void test_semihosting(CortexM0_CPU *cpu) {
+    const char path[] = "/tmp/vmcu_semihost_test.txt";
+    const char text[] = "semihosted";
+    init_cpu(cpu);
+    mem_write_block(SRAM_BASE + 0x100, path, sizeof(path));
+    mem_write_block(SRAM_BASE + 0x200, text, sizeof(text) - 1);
+
+    // SYS_OPEN "wb"
+    uint32_t open_args[3] = {SRAM_BASE + 0x100, 5, sizeof(path) - 1};
+    mem_write_block(SRAM_BASE, open_args, sizeof(open_args));
+    cpu->R[0] = SYS_OPEN;
+    cpu->R[1] = SRAM_BASE;
+    assert(semihosting_call(cpu) == STOP_NONE);
+    uint32_t handle = cpu->R[0];
+    assert(handle != (uint32_t)-1);
+
+    // SYS_WRITE takes the buffer straight out of SRAM
+    uint32_t write_args[3] = {handle, SRAM_BASE + 0x200, sizeof(text) - 1};
+    mem_write_block(SRAM_BASE, write_args, sizeof(write_args));
+    cpu->R[0] = SYS_WRITE;
+    assert(semihosting_call(cpu) == STOP_NONE && cpu->R[0] == 0);
+
+    mem_write_block(SRAM_BASE, &handle, sizeof(handle));
+    cpu->R[0] = SYS_CLOSE;
+    assert(semihosting_call(cpu) == STOP_NONE && cpu->R[0] == 0);
+
+    // SYS_READ stores into SRAM like the guest would, so watchpoints fire
+    open_args[1] = 1; // "rb"
+    mem_write_block(SRAM_BASE, open_args, sizeof(open_args));
+    cpu->R[0] = SYS_OPEN;
+    assert(semihosting_call(cpu) == STOP_NONE && cpu->R[0] != (uint32_t)-1);
+    uint32_t read_args[3] = {cpu->R[0], SRAM_BASE + 0x300, sizeof(text) - 1};
+    mem_write_block(SRAM_BASE, read_args, sizeof(read_args));
+    assert(watchpoint_set(SRAM_BASE + 0x304, 4));
+    cpu->R[0] = SYS_READ;
+    assert(semihosting_call(cpu) == STOP_NONE && cpu->R[0] == 0);
+    assert(mcu->watch_hit && mcu->watch_hit_addr == SRAM_BASE + 0x300);
+    assert(memcmp(&SRAM[0x300], text, sizeof(text) - 1) == 0);
+    mcu->watch_hit = false;
+    watchpoints_clear_all();
+    mem_write_block(SRAM_BASE, read_args, sizeof(read_args[0]));
+    cpu->R[0] = SYS_CLOSE;
+    assert(semihosting_call(cpu) == STOP_NONE && cpu->R[0] == 0);
+    open_args[1] = 5;
+
+    FILE *f = fopen(path, "rb");
+    char buf[32] = {0};
+    assert(f && fread(buf, 1, sizeof(buf), f) == sizeof(text) - 1);
+    fclose(f);
+    remove(path);
+    assert(strcmp(buf, text) == 0);
+
+    // A file left open is flushed and closed when the instance is re-initialised
+    mem_write_block(SRAM_BASE, open_args, sizeof(open_args));
+    cpu->R[0] = SYS_OPEN;
+    assert(semihosting_call(cpu) == STOP_NONE && cpu->R[0] != (uint32_t)-1);
+    write_args[0] = cpu->R[0];
+    mem_write_block(SRAM_BASE, write_args, sizeof(write_args));
+    cpu->R[0] = SYS_WRITE;
+    assert(semihosting_call(cpu) == STOP_NONE && cpu->R[0] == 0);
+    mcu_init(mcu);
+    memset(buf, 0, sizeof(buf));
+    f = fopen(path, "rb");
+    assert(f && fread(buf, 1, sizeof(buf), f) == sizeof(text) - 1);
+    fclose(f);
+    remove(path);
+    assert(strcmp(buf, text) == 0);
+
+    // SYS_EXIT through the decoder
+    const uint16_t program[] = {
+        0x2018, // MOVS r0, #0x18
+        0xBEAB, // BKPT 0xAB
+    };
+    load_program(program, 2);
+    init_cpu(cpu);
+    cpu->R[1] = ADP_STOPPED_APPLICATION_EXIT;
+    assert(cpu_run(cpu, 10) == STOP_EXIT);
+    assert(mcu->semihost_exit_code == 0);
+}
+
+static void idle_event(void *ctx, uint64_t now) {
+    (void)ctx;
+    (void)now;
+}
+
+void test_dma_interrupt(CortexM0_CPU *cpu) {
+    static Dma dma;
+    const uint32_t code = 0xC0; // Right after the vector table
+    memset(Flash, 0, FLASH_SIZE);
+    uint32_t vectors[VECTOR_TABLE_SIZE] = {0};
+    vectors[0] = SRAM_BASE + SRAM_SIZE;
+    vectors[1] = code | 1;
+    vectors[IRQ_BASE + DMA_IRQ_BASE + 1] = (code + 4) | 1; // Channel 1
+    memcpy(Flash, vectors, sizeof(vectors));
+    const uint16_t program[] = {
+        0xE7FE, // main:    B .
+        0xE7FE,
+        0x2701, // handler: MOVS r7, #1
+        0x4770, //          BX LR
+    };
+    memcpy(Flash + code, program, sizeof(program));
+    load_vector_table((uint32_t *)Flash);
+    init_cpu(cpu);
+    cpu_reset(cpu);
+    events_clear();
+    assert(dma_init(&dma, DMA_DEFAULT_BASE));
+
+    for (uint32_t i = 0; i < 64; i++) {
+        SRAM[0x100 + i] = i;
+    }
+    uint32_t ch1 = DMA_DEFAULT_BASE + DMA_CHANNEL_STRIDE;
+    assert(mem_write32(ch1 + DMA_CSRC, SRAM_BASE + 0x100));
+    assert(mem_write32(ch1 + DMA_CDST, SRAM_BASE + 0x200));
+    assert(mem_write32(ch1 + DMA_CCNT, 16));
+    assert(mem_write32(ch1 + DMA_CCR, DMA_CCR_EN | DMA_CCR_TCIE | (2 << DMA_CCR_SIZE_SHIFT)));
+
+    // Nothing moves before the transfer's completion cycle
+    uint64_t done = DMA_SETUP_CYCLES + 16 * DMA_CYCLES_PER_BEAT;
+    assert(cpu_run(cpu, done - 1) == STOP_NONE);
+    assert(SRAM[0x200 + 63] == 0 && cpu->ipsr == 0);
+
+    // Completion copies the block and enters the handler, which returns to main
+    assert(cpu_run(cpu, 1) == STOP_NONE);
+    assert(memcmp(SRAM + 0x100, SRAM + 0x200, 64) == 0);
+    assert(cpu->ipsr == IRQ_BASE + DMA_IRQ_BASE + 1);
+    assert(cpu_run(cpu, 3) == STOP_NONE);
+    assert(cpu->R[7] == 1 && cpu->ipsr == 0);
+    assert(cpu->PC == code && cpu->SP == SRAM_BASE + SRAM_SIZE);
+
+    uint32_t isr;
+    assert(mem_read32(DMA_DEFAULT_BASE + DMA_ISR, &isr) && isr == (1U << 1));
+
+    // A RAM-to-RAM store into a watched range stops the run
+    assert(mem_write32(DMA_DEFAULT_BASE + DMA_IFCR, isr));
+    assert(mem_write32(ch1 + DMA_CDST, SRAM_BASE + 0x300));
+    assert(mem_write32(ch1 + DMA_CCNT, 16));
+    assert(watchpoint_set(SRAM_BASE + 0x33C, 4));
+    assert(mem_write32(ch1 + DMA_CCR, DMA_CCR_EN | (2 << DMA_CCR_SIZE_SHIFT)));
+    assert(cpu_run(cpu, done) == STOP_WATCHPOINT);
+    assert(mcu->watch_hit_addr == SRAM_BASE + 0x300);
+    assert(memcmp(SRAM + 0x100, SRAM + 0x300, 64) == 0);
+    watchpoints_clear_all();
+
+    // With the event table full the transfer fails instead of completing early
+    assert(mem_write32(DMA_DEFAULT_BASE + DMA_IFCR, ~0u));
+    for (uint32_t i = 0; i < MAX_EVENTS; i++) {
+        assert(event_schedule(event_now() + 1000, idle_event, NULL));
+    }
+    assert(mem_write32(ch1 + DMA_CDST, SRAM_BASE + 0x400));
+    assert(mem_write32(ch1 + DMA_CCNT, 16));
+    assert(mem_write32(ch1 + DMA_CCR, DMA_CCR_EN | (2 << DMA_CCR_SIZE_SHIFT)));
+    uint32_t ccr;
+    assert(mem_read32(DMA_DEFAULT_BASE + DMA_ISR, &isr) && isr == (1U << (1 + 8)));
+    assert(mem_read32(ch1 + DMA_CCR, &ccr) && !(ccr & DMA_CCR_EN));
+    assert(SRAM[0x400 + 63] == 0);
+    events_clear();
+    dma_remove(&dma);
+}
+
+void test_block_transfer(CortexM0_CPU *cpu) {
+    const uint16_t program[] = {
+        0xB507, // PUSH {r0, r1, r2, lr}
+        0xBCF0, // POP {r4, r5, r6, r7}
+        0xC307, // STM r3!, {r0, r1, r2}
+        0xCB70, // LDM r3!, {r4, r5, r6}   (r3 rewound by the test)
+        0xE7FE, // B .
+    };
+    load_program(program, 5);
+    init_cpu(cpu);
+    uint32_t top = cpu->SP;
+    cpu->R[0] = 0x10; cpu->R[1] = 0x11; cpu->R[2] = 0x12;
+    cpu->LR = 0x1234;
+    cpu->R[3] = SRAM_BASE + 0x40;
+
+    // Lowest register at the lowest address
+    assert(cpu_run(cpu, 1) == STOP_NONE);
+    assert(cpu->SP == top - 16);
+    uint32_t frame[4];
+    assert(mem_read_block(cpu->SP, frame, sizeof(frame)));
+    assert(frame[0] == 0x10 && frame[2] == 0x12 && frame[3] == 0x1234);
+
+    assert(cpu_run(cpu, 1) == STOP_NONE);
+    assert(cpu->SP == top && cpu->R[4] == 0x10 && cpu->R[7] == 0x1234);
+
+    assert(cpu_run(cpu, 1) == STOP_NONE);
+    assert(cpu->R[3] == SRAM_BASE + 0x4C);
+    cpu->R[3] = SRAM_BASE + 0x40;
+    cpu->R[4] = cpu->R[5] = cpu->R[6] = 0;
+    assert(cpu_run(cpu, 1) == STOP_NONE);
+    assert(cpu->R[4] == 0x10 && cpu->R[5] == 0x11 && cpu->R[6] == 0x12);
+
+    // A push that would run off SRAM stores nothing and leaves SP alone
+    load_program(program, 5);
+    init_cpu(cpu);
+    cpu->SP = SRAM_BASE + 8;
+    SRAM[0] = SRAM[4] = 0xAA;
+    assert(cpu_run(cpu, 1) == STOP_HARDFAULT);
+    assert(cpu->SP == SRAM_BASE + 8 && SRAM[0] == 0xAA && SRAM[4] == 0xAA);
+}
+
+// Runs the token ring on a fresh board and copies out every node's CPU state
+static void cosim_token_ring(uint32_t nodes, uint64_t cycles, bool parallel, unsigned placement,
+                             CortexM0_CPU *out) {
+    static Cosim sim;
+    assert(cosim_init(&sim, nodes, UART_DEFAULT_BASE));
+    for (uint32_t i = 0; i < nodes; i++) {
+        assert(cosim_connect(&sim, i, (i + 1) % nodes, 1000));
+    }
+    assert(cosim_load_token_ring(&sim));
+    cosim_set_placement(&sim, placement);
+    // Two runs check that windows continue across calls
+    assert(cosim_run(&sim, cycles / 2, parallel));
+    assert(cosim_run(&sim, cycles - cycles / 2, parallel));
+    for (uint32_t i = 0; i < nodes; i++) {
+        assert(!sim.nodes[i].halted);
+        assert((sim.nodes[i].cpu >= 0) == (parallel && placement != 0));
+        out[i] = sim.nodes[i].mcu->cpu;
+    }
+    cosim_destroy(&sim);
+}
+
+void test_cosim(CortexM0_CPU *cpu) {
+    (void)cpu;
+    CortexM0_CPU serial[4], parallel[4], placed[4];
+    cosim_token_ring(4, 50500, false, 0, serial);
+    cosim_token_ring(4, 50500, true, 0, parallel);
+    cosim_token_ring(4, 50500, true, COSIM_LOCAL_MEMORY | COSIM_HUGE_PAGES, placed);
+
+    uint32_t received = 0;
+    for (int i = 0; i < 4; i++) {
+        assert(serial[i].cycles == 50500);
+        // Threads only meet at window boundaries, yet the result is identical
+        assert(memcmp(serial[i].R, parallel[i].R, sizeof(serial[i].R)) == 0);
+        assert(serial[i].PC == parallel[i].PC);
+        // Pinning and moving memory do not change it either
+        assert(memcmp(serial[i].R, placed[i].R, sizeof(serial[i].R)) == 0);
+        // Node i sends tokens equal to i modulo the ring size
+        assert(serial[i].R[6] > 0 && serial[i].R[0] % 4 == (uint32_t)i);
+        received += serial[i].R[6];
+    }
+    // One hop costs the 1000-cycle link latency plus a few instructions
+    assert(received >= 45 && received <= 50);
+
+    // A full event table delays delivery to the next window but loses nothing
+    static Cosim sim;
+    assert(cosim_init(&sim, 2, UART_DEFAULT_BASE));
+    assert(cosim_connect(&sim, 0, 1, 1000) && cosim_connect(&sim, 1, 0, 1000));
+    assert(cosim_load_token_ring(&sim));
+    mcu_select(sim.nodes[1].mcu);
+    for (uint32_t i = 0; i < MAX_EVENTS; i++) {
+        assert(event_schedule(1ull << 40, idle_event, NULL));
+    }
+    mcu_select(NULL);
+    assert(cosim_run(&sim, 20000, false));
+    assert(sim.nodes[0].late == 0 && sim.nodes[1].late > 0);
+    assert(sim.links[0]->dropped == 0 && !sim.nodes[1].halted);
+    assert(sim.nodes[0].mcu->cpu.R[6] > 0 && sim.nodes[1].mcu->cpu.R[6] > 0);
+    cosim_destroy(&sim);
+}
+
+void test_shared_flash(CortexM0_CPU *cpu) {
+    (void)cpu;
+    const uint16_t program[] = {
+        0x2105, // MOVS r1, #5
+        0x7001, // (data; never executed)
+    };
+    Flash_Image image;
+    assert(flash_image_create(&image, program, sizeof(program)));
+    Mcu *a = mcu_create();
+    Mcu *b = mcu_create();
+    assert(a && b && mcu_map_flash(a, &image) && mcu_map_flash(b, &image));
+    flash_image_release(&image); // Mappings outlive the creator's reference
+
+    // A Flash write in one instance gets a private copy of that page only
+    mcu_select(a);
+    assert(mem_write16(FLASH_BASE + 2, 0xBEEF));
+    uint16_t value;
+    assert(mem_read16(FLASH_BASE + 2, &value) && value == 0xBEEF);
+    mcu_select(b);
+    assert(mem_read16(FLASH_BASE + 2, &value) && value == 0x7001);
+    assert(mem_read16(FLASH_BASE, &value) && value == 0x2105);
+
+    // Both instances run the shared code with their own registers and SRAM
+    b->cpu.PC = FLASH_BASE;
+    assert(cpu_run(&b->cpu, 1) == STOP_NONE && b->cpu.R[1] == 5);
+    assert(mem_write32(SRAM_BASE, 1));
+    mcu_select(a);
+    uint32_t word;
+    assert(mem_read32(SRAM_BASE, &word) && word == 0);
+
+    // Re-initialising drops the image
+    mcu_init(a);
+    assert(mem_read16(FLASH_BASE, &value) && value == 0);
+    mcu_select(NULL);
+    mcu_destroy(a);
+    mcu_destroy(b);
+}
+
+// Number of host pages of [p, p + len) that are backed by memory
+static uint32_t resident_pages(const uint8_t *p, size_t len) {
+    static unsigned char vec[(64 << 20) / HOST_PAGE_SIZE];
+    assert(len / HOST_PAGE_SIZE <= sizeof(vec));
+    assert(mincore((void *)p, len, vec) == 0);
+    uint32_t n = 0;
+    for (size_t i = 0; i < len / HOST_PAGE_SIZE; i++) {
+        n += vec[i] & 1;
+    }
+    return n;
+}
+
+void test_sparse_memory(CortexM0_CPU *cpu) {
+    (void)cpu;
+    const Mcu_Config config = {1 << 20, 256 << 10, 64 << 20};
+    Mcu *m = mcu_create_config(&config);
+    assert(m);
+    mcu_select(m);
+    uint8_t *ext = m->memory + m->regions[REGION_EXT_RAM].offset;
+    assert(resident_pages(ext, 64 << 20) == 0);
+
+    // Only the pages the guest writes are committed
+    assert(mem_write32(EXT_RAM_BASE + 0x10, 0x11223344));
+    assert(mem_write32(EXT_RAM_BASE + (48 << 20), 0x55667788));
+    assert(resident_pages(ext, 64 << 20) == 2);
+    uint32_t value;
+    assert(mem_read32(EXT_RAM_BASE + (48 << 20), &value) && value == 0x55667788);
+    assert(mem_read32(EXT_RAM_BASE + (64 << 20) - 4, &value) && value == 0);
+    assert(!mem_read32(EXT_RAM_BASE + (64 << 20), &value));
+    assert(!mem_write_block(EXT_RAM_BASE + (64 << 20) - 2, &value, 4));
+
+    // The stack starts at the top of the configured SRAM
+    assert(m->cpu.SP == SRAM_BASE + (256 << 10));
+    assert(mem_write32(SRAM_BASE + (256 << 10) - 4, 1));
+    assert(breakpoint_set(EXT_RAM_BASE + 0x100) && breakpoint_set(SRAM_BASE + 0x20));
+
+    // Clearing a region hands back its pages
+    mcu_clear_region(m, REGION_EXT_RAM);
+    assert(resident_pages(ext, 64 << 20) == 0);
+    assert(mem_read32(EXT_RAM_BASE + 0x10, &value) && value == 0);
+
+    // Oversized maps are rejected up front
+    const Mcu_Config huge = {REGION_MAX_SIZE, REGION_MAX_SIZE, REGION_MAX_SIZE};
+    assert(mcu_create_config(&huge) == NULL);
+
+    // Large regions start on a huge page; placement keeps contents and sparseness
+    assert((m->regions[REGION_EXT_RAM].offset & (HUGE_PAGE_SIZE - 1)) == 0);
+    assert(((uintptr_t)m->memory & (HUGE_PAGE_SIZE - 1)) == 0);
+    assert(mem_write32(EXT_RAM_BASE + 0x10, 0x99));
+    mcu_place(m, -1, false);
+    assert(resident_pages(ext, 64 << 20) == 1);
+    assert(mem_read32(EXT_RAM_BASE + 0x10, &value) && value == 0x99);
+    // Kept across a re-initialisation, along with the layout
+    mcu_place(m, 0, true);
+    mcu_init(m);
+    assert(m->numa_node == 0 && m->huge_pages && m->cpu.SP == SRAM_BASE + (256 << 10));
+    mcu_select(NULL);
+    assert(!mcu_place(mcu, 0, false));
+    mcu_destroy(m);
+}
+
+void test_vmcu_api(CortexM0_CPU *cpu) {
+    (void)cpu;
+    uint32_t image[0xC8 / 4] = {0};
+    image[0] = SRAM_BASE + 0x1000;
+    image[1] = 0xC0 | 1;
+    image[IRQ_BASE + 3] = 0xC4 | 1;
+    const uint16_t code[] = {
+        0x19C0, // loop:    ADDS r0, r0, r7
+        0xE7FD, //          B loop
+        0x2642, // handler: MOVS r6, #0x42
+        0x4770, //          BX lr
+    };
+    memcpy((uint8_t *)image + 0xC0, code, sizeof(code));
+
+    const Vmcu_Config config = {0, 0x2000, 0};
+    Vmcu *vm = vmcu_create(&config);
+    assert(vm && vmcu_api_version() == VMCU_API_VERSION);
+    assert(vmcu_load_image(vm, image, sizeof(image)));
+    assert(vmcu_get_reg(vm, VMCU_REG_PC) == 0xC0 && vmcu_get_reg(vm, VMCU_REG_SP) == SRAM_BASE + 0x1000);
+    vmcu_set_reg(vm, 7, 1);
+
+    // Small quanta add up to one long run
+    for (int i = 0; i < 100; i++) {
+        assert(vmcu_run_for(vm, 10) == VMCU_STOP_BUDGET);
+    }
+    assert(vmcu_cycles(vm) == 1000 && vmcu_get_reg(vm, 0) == 500);
+
+    // An injected interrupt runs its handler and returns to the loop
+    assert(vmcu_set_irq(vm, 3) && !vmcu_set_irq(vm, NUM_IRQS));
+    assert(vmcu_run_for(vm, 10) == VMCU_STOP_BUDGET);
+    assert(vmcu_get_reg(vm, 6) == 0x42 && (vmcu_get_reg(vm, VMCU_REG_XPSR) & 0x3F) == 0);
+
+    uint8_t data[64], back[64];
+    for (int i = 0; i < 64; i++) data[i] = i;
+    assert(vmcu_write_mem(vm, SRAM_BASE + 0x1FC0, data, sizeof(data)));
+    assert(vmcu_read_mem(vm, SRAM_BASE + 0x1FC0, back, sizeof(back)) && memcmp(data, back, 64) == 0);
+    assert(!vmcu_read_mem(vm, SRAM_BASE + 0x1FF0, back, 32));
+
+    // Peripheral registers are not plain memory: a read must not pop UART RX
+    static Uart uart;
+    int rx[2];
+    Mcu *own = mcu;
+    mcu_select(vm);
+    assert(pipe(rx) == 0 && uart_init(&uart, UART_DEFAULT_BASE) && uart_attach(&uart, -1, rx[0]));
+    assert(write(rx[1], "u", 1) == 1);
+    uint32_t sr = 0;
+    while (!(sr & UART_SR_RXNE)) {
+        assert(mem_read32(UART_DEFAULT_BASE + UART_SR, &sr));
+    }
+    assert(!vmcu_read_mem(vm, UART_DEFAULT_BASE + UART_DR, back, 1));
+    assert(!vmcu_write_mem(vm, UART_DEFAULT_BASE + UART_DR, data, 1));
+    assert(mem_read32(UART_DEFAULT_BASE + UART_SR, &sr) && (sr & UART_SR_RXNE));
+    assert(mem_read8(UART_DEFAULT_BASE + UART_DR, back) && back[0] == 'u');
+    uart_detach(&uart);
+    close(rx[0]); close(rx[1]);
+    mcu_select(own);
+
+    assert(vmcu_set_breakpoint(vm, 0xC2, true));
+    assert(vmcu_run_for(vm, 10) == VMCU_STOP_BREAKPOINT && vmcu_get_reg(vm, VMCU_REG_PC) == 0xC2);
+    assert(vmcu_run_for(vm, 1) == VMCU_STOP_BUDGET); // Steps over the breakpoint
+
+    // The calling thread's own instance is untouched
+    assert(mcu != vm);
+    vmcu_destroy(vm);
+}
+
+void test_stats(CortexM0_CPU *cpu) {
+    (void)cpu;
+    const uint16_t code[] = {
+        0x2003, //          MOVS r0, #3
+        0x2701, //          MOVS r7, #1
+        0xB510, //          PUSH {r4, lr}
+        0x1BC0, // loop:    SUBS r0, r0, r7
+        0xD1FD, //          BNE loop
+        0xE7FE, //          B .
+    };
+    uint32_t image[0xCC / 4];
+    Vmcu *vm = load_test_program(image, sizeof(image), code, sizeof(code));
+    assert(vmcu_run_for(vm, 20) == VMCU_STOP_BUDGET);
+
+    char json[512];
+    size_t len = vmcu_stats_json(vm, json, sizeof(json));
+    assert(len > 0 && len < sizeof(json) && json[0] == '{' && json[len - 1] == '}');
+#ifndef VMCU_NO_STATS
+    Mcu_Stats stats;
+    mcu_select(vm);
+    stats_snapshot(&stats);
+    mcu_select(NULL);
+    assert(stats.instructions == 20 && stats.alu == 3 + 2 && stats.load_store == 1);
+    assert(stats.bcond_taken == 2 && stats.bcond_not_taken == 1 && stats.branch == 11);
+    // One fetch per instruction, one block store for the PUSH
+    assert(stats.region_accesses[REGION_FLASH] == 20 && stats.region_accesses[REGION_SRAM] == 1);
+    assert(stats.region_accesses[REGION_EXT_RAM] == 0);
+
+    // Debugger and loader accesses are not guest accesses
+    uint8_t peek[16];
+    assert(vmcu_read_mem(vm, SRAM_BASE, peek, sizeof(peek)) && vmcu_write_mem(vm, SRAM_BASE, peek, 4));
+    assert(vmcu_read_mem(vm, 0xC0, peek, sizeof(peek)));
+    mcu_select(vm);
+    stats_snapshot(&stats);
+    mcu_select(NULL);
+    assert(stats.region_accesses[REGION_FLASH] == 20 && stats.region_accesses[REGION_SRAM] == 1);
+    assert(stats.stack_depth == 8 && stats.hardfaults == 0 && stats.exceptions == 0);
+    assert(strstr(json, "\"instructions\":20,") && strstr(json, "\"stack_depth\":8}"));
+
+    // A fetch from an odd PC faults; reset clears the counters, the stack
+    // depth belongs to the stack monitor and lasts until the CPU is reset
+    vmcu_set_reg(vm, VMCU_REG_PC, 0xC1);
+    assert(vmcu_run_for(vm, 1) == VMCU_STOP_HARDFAULT);
+    vmcu_stats_json(vm, json, sizeof(json));
+    assert(strstr(json, "\"hardfaults\":1,"));
+    vmcu_stats_reset(vm);
+    vmcu_stats_json(vm, json, sizeof(json));
+    assert(strstr(json, "\"instructions\":0,") && strstr(json, "\"stack_depth\":8}"));
+#endif
+    vmcu_destroy(vm);
+}
+
+void test_stack_monitor(CortexM0_CPU *cpu) {
+    (void)cpu;
+    const uint32_t top = SRAM_BASE + SRAM_SIZE;
+    const uint16_t code[] = {
+        0xB5F0, //          PUSH {r4-r7, lr}
+        0xE7FE, //          B .
+        0x0000,
+        0xB510, // handler: PUSH {r4, lr}
+        0xBD10, //          POP {r4, pc}
+    };
+    uint32_t image[0xCC / 4];
+    build_test_image(image, sizeof(image), code, sizeof(code));
+    image[IRQ_BASE + 3] = (TEST_CODE + 6) | 1;
+    Vmcu *vm = load_test_image(image, sizeof(image));
+    mcu_select(vm);
+    assert(stack_canary_fill(SRAM_BASE, top) && !stack_canary_fill(SRAM_BASE, top + 4));
+    mcu_select(NULL);
+    vmcu_set_stack_limit(vm, top - 128);
+    assert(vmcu_run_for(vm, 10) == VMCU_STOP_BUDGET);
+    assert(vmcu_set_irq(vm, 3) && vmcu_run_for(vm, 10) == VMCU_STOP_BUDGET);
+
+    // Thread: 5 words; IRQ 3: 8-word frame + 2 words, on top of Thread's
+    assert(vmcu_stack_peak(vm, 0) == 20 && vmcu_stack_peak(vm, IRQ_BASE + 3) == 40);
+    assert(vmcu_stack_peak(vm, -1) == 60 && vmcu_stack_peak(vm, VECTOR_TABLE_SIZE) == 0);
+    Stack_Report report;
+    mcu_select(vm);
+    stack_report(&report);
+    mcu_select(NULL);
+    assert(report.sram_high_water == top - 1 && report.headroom == 128 - 60);
+
+    // A push below the limit stops on the push with SP untouched
+    vmcu_reset(vm);
+    vmcu_set_stack_limit(vm, top - 16);
+    assert(vmcu_run_for(vm, 10) == VMCU_STOP_STACK_LIMIT);
+    assert(vmcu_get_reg(vm, VMCU_REG_PC) == 0xC0 && vmcu_get_reg(vm, VMCU_REG_SP) == top);
+
+    // So does an exception entry; the interrupt stays pending
+    vmcu_reset(vm);
+    vmcu_set_stack_limit(vm, top - 48);
+    assert(vmcu_run_for(vm, 10) == VMCU_STOP_BUDGET && vmcu_set_irq(vm, 3));
+    assert(vmcu_run_for(vm, 10) == VMCU_STOP_STACK_LIMIT && vmcu_get_reg(vm, VMCU_REG_SP) == top - 20);
+    vmcu_set_stack_limit(vm, 0);
+    assert(vmcu_run_for(vm, 10) == VMCU_STOP_BUDGET && vmcu_stack_peak(vm, IRQ_BASE + 3) == 40);
+    vmcu_destroy(vm);
+}
+
+void test_latency(CortexM0_CPU *cpu) {
+    (void)cpu;
+    const uint16_t code[] = {
+        0xE7FE, //          B .
+        0x0000,
+        0xB510, // handler: PUSH {r4, lr}
+        0x2001, //          MOVS r0, #1
+        0x2002, //          MOVS r0, #2
+        0xBD10, //          POP {r4, pc}
+    };
+    uint32_t image[0xD0 / 4];
+    build_test_image(image, sizeof(image), code, sizeof(code));
+    image[IRQ_BASE + 3] = (TEST_CODE + 4) | 1;
+    image[IRQ_BASE + 4] = (TEST_CODE + 4) | 1;
+    Vmcu *vm = load_test_image(image, sizeof(image));
+    vmcu_set_exception_cycles(vm, 12, 10);
+    assert(vmcu_run_for(vm, 10) == VMCU_STOP_BUDGET);
+
+    // Taken after the current instruction: one cycle plus the stacking cost
+    assert(vmcu_set_irq(vm, 3) && vmcu_run_for(vm, 40) == VMCU_STOP_BUDGET);
+    Vmcu_Latency lat;
+    assert(vmcu_exception_latency(vm, IRQ_BASE + 3, &lat));
+    assert(lat.count == 1 && lat.mean == 13 && lat.worst == 13 && lat.worst_pc == 0xC0);
+    assert(vmcu_cycles(vm) == 10 + 40 + 12 + 10); // The budget counts instructions
+
+    // IRQ 4 waits for IRQ 3's handler (entry, 4 instructions, return) and is
+    // taken after the next Thread instruction
+    assert(vmcu_set_irq(vm, 3) && vmcu_set_irq(vm, 4) && vmcu_run_for(vm, 100) == VMCU_STOP_BUDGET);
+    assert(vmcu_exception_latency(vm, IRQ_BASE + 4, &lat));
+    assert(lat.count == 1 && lat.worst == 1 + 12 + 4 + 10 + 1 + 12 && lat.p50 == 40 && lat.worst_pc == 0xC0);
+    assert(vmcu_exception_latency(vm, IRQ_BASE + 3, &lat));
+    assert(lat.count == 2 && lat.p50 == 13 && lat.p99 == 13);
+
+    assert(!vmcu_exception_latency(vm, IRQ_BASE + 5, &lat) && lat.count == 0);
+    assert(!vmcu_exception_latency(vm, VECTOR_TABLE_SIZE, &lat));
+    vmcu_latency_reset(vm);
+    assert(!vmcu_exception_latency(vm, IRQ_BASE + 3, &lat));
+
+    // Stacking costs are charged to the cycle counter only when set
+    vmcu_set_exception_cycles(vm, 0, 0);
+    uint64_t before = vmcu_cycles(vm);
+    assert(vmcu_set_irq(vm, 3) && vmcu_run_for(vm, 10) == VMCU_STOP_BUDGET);
+    assert(vmcu_exception_latency(vm, IRQ_BASE + 3, &lat) && lat.worst == 1);
+    assert(vmcu_cycles(vm) - before == 10);
+    vmcu_destroy(vm);
+}
+
+void test_pacing(CortexM0_CPU *cpu) {
+    (void)cpu;
+    const uint16_t code[] = {0xE7FE}; // B .
+    uint32_t image[0xC4 / 4];
+    Vmcu *vm = load_test_program(image, sizeof(image), code, sizeof(code));
+    mcu_select(vm);
+
+    // 20 ms of guest time at 1 MHz in 100 us batches; never ahead of the wall clock
+    Pacer pacer;
+    pacer_init(&pacer, 1000000);
+    assert(pacer.quantum == 100 && pacer.max_lag_ns == PACE_MAX_LAG_NS);
+    assert(pacer_run(&pacer, &vm->cpu, 20000) == STOP_NONE && vm->cpu.cycles == 20000);
+    assert(pacer.batches == 200 && pacer.guest_ns == 20000000);
+    assert(pacer.wall_ns >= pacer.guest_ns);
+    if (getenv("VMCU_TIMING_TESTS")) { // A loaded host may fall behind by any amount
+        assert(pacer.wall_ns < pacer.guest_ns + 1000000000);
+    }
+    assert(pacer.jitter.count + pacer.overruns == pacer.batches);
+
+    // A clock the host cannot keep up with: every batch is late, and with no
+    // catch-up allowed every one moves the origin instead of sleeping
+    pacer_init(&pacer, 1000000000000ull);
+    pacer.quantum = 1000;
+    pacer.max_lag_ns = 0;
+    assert(pacer_run(&pacer, &vm->cpu, 10000) == STOP_NONE);
+    assert(pacer.batches == 10 && pacer.overruns == 10 && pacer.resyncs == 10);
+    assert(pacer.jitter.count == 0 && pacer.dropped_ns > 0);
+
+    mcu_select(NULL);
+    vmcu_destroy(vm);
+}
+
+void test_trace(CortexM0_CPU *cpu) {
+    (void)cpu;
+    // Codec round trip on compressible and random data
+    static uint8_t raw[100000], packed[LZ_BOUND(100000)], back[100000];
+    uint32_t seed = 1;
+    for (size_t i = 0; i < sizeof(raw); i++) {
+        seed = seed * 1103515245 + 12345;
+        raw[i] = i < 60000 ? (uint8_t)("trace"[i % 5] ^ (i % 977 == 0)) : (uint8_t)(seed >> 24);
+    }
+    size_t len = lz_compress(raw, sizeof(raw), packed);
+    assert(len < sizeof(raw) && lz_decompress(packed, len, back, sizeof(back)));
+    assert(memcmp(raw, back, sizeof(raw)) == 0);
+    assert(!lz_decompress(packed, len / 2, back, sizeof(back)));
+    assert(lz_decompress(packed, lz_compress(raw, 0, packed), back, 0));
+
+    const uint16_t code[] = {
+        0x2003, //          MOVS r0, #3
+        0x2701, //          MOVS r7, #1
+        0xB510, //          PUSH {r4, lr}
+        0x1BC0, // loop:    SUBS r0, r0, r7
+        0xD1FD, //          BNE loop
+        0xE7FE, //          B .
+    };
+    uint32_t image[0xCC / 4];
+    build_test_image(image, sizeof(image), code, sizeof(code));
+    const char path[] = "/tmp/vmcu_trace_test.bin";
+    const char expected[] =
+        "0x000000C0\n0x000000C2\n0x000000C4\n"
+        "    W4 [0x200007F8] 0x00000000\n"
+        "    W4 [0x200007FC] 0x00000000\n"
+        "0x000000C6\n0x000000C8\n0x000000C6\n0x000000C8\n0x000000C6\n0x000000C8\n"
+        "0x000000CA\n0x000000CA\n0x000000CA\n"
+        "# 12 instructions, 0 reads, 2 writes\n";
+
+    // Split runs give the same trace as one run
+    for (int split = 0; split <= 5; split += 5) {
+        Vmcu *vm = load_test_image(image, sizeof(image));
+        assert(vmcu_trace_start(vm, path) && !vmcu_trace_start(vm, path));
+        if (split) {
+            assert(vmcu_run_for(vm, split) == VMCU_STOP_BUDGET);
+        }
+        assert(vmcu_run_for(vm, 12 - split) == VMCU_STOP_BUDGET);
+        assert(vmcu_trace_stop(vm) && !vmcu_trace_stop(vm));
+        vmcu_destroy(vm);
+
+        char *text = NULL;
+        size_t size = 0;
+        FILE *out = open_memstream(&text, &size);
+        assert(trace_decode(path, out));
+        fclose(out);
+        assert(strcmp(text, expected) == 0);
+        free(text);
+    }
+
+    // A long run spans many chunks and compresses well
+    Vmcu *vm = load_test_image(image, sizeof(image));
+    assert(vmcu_trace_start(vm, path));
+    assert(vmcu_run_for(vm, 2000000) == VMCU_STOP_BUDGET);
+    vmcu_destroy(vm); // Stops the trace
+    FILE *f = fopen(path, "rb");
+    assert(f && fseek(f, 0, SEEK_END) == 0 && ftell(f) < 64 * 1024);
+    fclose(f);
+    FILE *out = fopen("/dev/null", "w");
+    assert(out && trace_decode(path, out));
+    fclose(out);
+
+    // Re-initialising an instance ends its trace and completes the file
+    vm = load_test_image(image, sizeof(image));
+    assert(vmcu_trace_start(vm, path));
+    assert(vmcu_run_for(vm, 12) == VMCU_STOP_BUDGET);
+    mcu_init(vm);
+    assert(vm->trace == NULL && !vmcu_trace_stop(vm));
+    char *text = NULL;
+    size_t size = 0;
+    out = open_memstream(&text, &size);
+    assert(trace_decode(path, out));
+    fclose(out);
+    assert(strcmp(text, expected) == 0);
+    free(text);
+    vmcu_destroy(vm);
+    unlink(path);
+}
+
+// Loads image into a fresh instance with a UART and runs it as a batch job;
+// setup (if any) runs on the selected instance first
+static Batch_Result run_batch_job(const uint32_t *image, size_t size, const char *input,
+                                  const char *cache_dir, void (*setup)(void)) {
+    Vmcu *vm = load_test_image(image, size);
+    mcu_select(vm);
+    if (setup) {
+        setup();
+    }
+    static Uart uart;
+    assert(uart_init(&uart, UART_DEFAULT_BASE));
+    Batch_Job job = {(const uint8_t *)input, strlen(input), 100000, cache_dir};
+    Batch_Result result;
+    assert(batch_run(&vm->cpu, &uart, &job, &result));
+    uart_detach(&uart);
+    mcu_select(NULL);
+    vmcu_destroy(vm);
+    return result;
+}
+
+static void batch_stack_limit(void) {
+    stack_set_limit(SRAM_BASE + SRAM_SIZE);
+}
+
+static void batch_breakpoint(void) {
+    assert(breakpoint_set(0xE4)); // The BKPT
+}
+
+static void batch_watchpoint(void) {
+    assert(watchpoint_set(SRAM_BASE + SRAM_SIZE - 4, 4));
+}
+
+void test_batch_cache(CortexM0_CPU *cpu) {
+    (void)cpu;
+    const uint16_t code[] = {
+        0x2140, //          MOVS r1, #0x40
+        0x0609, //          LSLS r1, r1, #24
+        0x2244, //          MOVS r2, #0x44
+        0x0212, //          LSLS r2, r2, #8
+        0x1889, //          ADDS r1, r1, r2      ; UART_DEFAULT_BASE
+        0x2504, //          MOVS r5, #UART_DR
+        0x2701, //          MOVS r7, #1
+        0x2603, //          MOVS r6, #3
+        0x590B, // loop:    LDR r3, [r1, r4]     ; SR
+        0x2220, //          MOVS r2, #UART_SR_RXNE
+        0x4013, //          ANDS r3, r2
+        0xD0FB, //          BEQ loop
+        0x5948, //          LDR r0, [r1, r5]
+        0x19C0, //          ADDS r0, r0, r7
+        0x5148, //          STR r0, [r1, r5]     ; Echo byte + 1
+        0x1BF6, //          SUBS r6, r6, r7
+        0xD1F6, //          BNE loop
+        0xB401, //          PUSH {r0}
+        0x2018, //          MOVS r0, #SYS_EXIT
+        0xBEAB, //          BKPT 0xAB
+        0xE7FE, //          B .
+    };
+    uint32_t image[0xEC / 4];
+    build_test_image(image, sizeof(image), code, sizeof(code));
+    char dir[] = "/tmp/vmcu_cache_XXXXXX";
+    assert(mkdtemp(dir));
+
+    Batch_Result first = run_batch_job(image, sizeof(image), "abc", dir, NULL);
+    assert(!first.cached && first.reason == STOP_EXIT && first.exit_code == 1);
+    assert(first.output_len == 3 && memcmp(first.output, "bcd", 3) == 0);
+
+    // An identical run is answered from the cache with the same result
+    Batch_Result second = run_batch_job(image, sizeof(image), "abc", dir, NULL);
+    assert(second.cached && second.reason == STOP_EXIT && second.cycles == first.cycles);
+    assert(memcmp(second.R, first.R, sizeof(first.R)) == 0 && second.xpsr == first.xpsr);
+    assert(second.output_len == 3 && memcmp(second.output, "bcd", 3) == 0);
+
+    // Different input or firmware misses
+    Batch_Result other = run_batch_job(image, sizeof(image), "abd", dir, NULL);
+    assert(!other.cached && memcmp(other.output, "bce", 3) == 0);
+
+    // So do a stack limit, a breakpoint or a watchpoint, which stop the run early
+    Batch_Result limited = run_batch_job(image, sizeof(image), "abc", dir, batch_stack_limit);
+    assert(!limited.cached && limited.reason == STOP_STACK_LIMIT);
+    Batch_Result stopped = run_batch_job(image, sizeof(image), "abc", dir, batch_breakpoint);
+    assert(!stopped.cached && stopped.reason == STOP_BREAKPOINT);
+    Batch_Result watched = run_batch_job(image, sizeof(image), "abc", dir, batch_watchpoint);
+    assert(!watched.cached && watched.reason == STOP_WATCHPOINT);
+    Batch_Result again = run_batch_job(image, sizeof(image), "abc", dir, batch_stack_limit);
+    assert(again.cached && again.reason == STOP_STACK_LIMIT);
+
+    image[0xE4 / 4] = 1;
+    Batch_Result changed = run_batch_job(image, sizeof(image), "abc", dir, NULL);
+    assert(!changed.cached);
+    Batch_Result uncached = run_batch_job(image, sizeof(image), "abc", NULL, NULL);
+    assert(!uncached.cached && uncached.cycles == changed.cycles);
+
+    batch_result_free(&first);
+    batch_result_free(&second);
+    batch_result_free(&other);
+    batch_result_free(&limited);
+    batch_result_free(&stopped);
+    batch_result_free(&watched);
+    batch_result_free(&again);
+    batch_result_free(&changed);
+    batch_result_free(&uncached);
+    DIR *d = opendir(dir);
+    int files = 0;
+    for (struct dirent *e; d && (e = readdir(d));) {
+        if (e->d_name[0] != '.') {
+            char path[64 + sizeof(e->d_name)];
+            snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+            assert(unlink(path) == 0);
+            files++;
+        }
+    }
+    closedir(d);
+    assert(files == 6 && rmdir(dir) == 0);
+}
+
+void test_mem_ops(CortexM0_CPU *cpu) {
+    (void)cpu;
+    // Accessors store little-endian whatever the host
+    assert(mem_write32(SRAM_BASE, 0x11223344) && mem_write16(SRAM_BASE + 4, 0x5566));
+    uint8_t bytes[6];
+    assert(mem_read_block(SRAM_BASE, bytes, sizeof(bytes)));
+    assert(memcmp(bytes, "\x44\x33\x22\x11\x66\x55", 6) == 0);
+
+    // Every start phase and tail length, against the portable kernel
+    uint8_t expect[SRAM_SIZE];
+    for (uint32_t start = 0; start < 4; start++) {
+        for (uint32_t len = 0; len < 200; len += 13) {
+            memset(expect, 0, sizeof(expect));
+            assert(mem_write_block(SRAM_BASE, expect, 256));
+            mem_ops_fill32_scalar(expect + start, 0xA1B2C3D4, len);
+            assert(mem_fill(SRAM_BASE + start, 0xA1B2C3D4, len));
+            uint32_t diff;
+            assert(mem_compare(SRAM_BASE, expect, 256, &diff) && diff == SRAM_BASE + 256);
+        }
+    }
+    assert(expect[0] == 0 && expect[3] == 0xD4 && expect[4] == 0xC3 && expect[6] == 0xA1);
+
+    // The first difference is found in the vector part and in the tail
+    assert(mem_fill(SRAM_BASE, 0, SRAM_SIZE));
+    memset(expect, 0, sizeof(expect));
+    const uint32_t offsets[] = {0, 31, 32, 63, 64, 100, SRAM_SIZE - 70, SRAM_SIZE - 1};
+    for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+        uint32_t diff;
+        expect[offsets[i]] = 1;
+        assert(mem_compare(SRAM_BASE, expect, SRAM_SIZE, &diff) && diff == SRAM_BASE + offsets[i]);
+        assert(mem_ops_mismatch_scalar(SRAM, expect, SRAM_SIZE) == offsets[i]);
+        expect[offsets[i]] = 0;
+    }
+
+    // Overlapping copies behave like memmove()
+    for (uint32_t i = 0; i < 64; i++) {
+        mem_write8(SRAM_BASE + i, (uint8_t)i);
+    }
+    assert(mem_copy(SRAM_BASE + 8, SRAM_BASE, 48));
+    uint8_t b;
+    assert(mem_read8(SRAM_BASE + 8, &b) && b == 0);
+    assert(mem_read8(SRAM_BASE + 55, &b) && b == 47);
+    assert(mem_copy(SRAM_BASE, SRAM_BASE + 8, 48));
+    assert(mem_read8(SRAM_BASE + 47, &b) && b == 47);
+
+    // Blocks must stay inside one region
+    assert(!mem_fill(SRAM_BASE + SRAM_SIZE - 4, 0, 8));
+    assert(!mem_copy(SRAM_BASE, FLASH_BASE + FLASH_SIZE - 4, 8));
+    assert(!mem_compare(SRAM_BASE + SRAM_SIZE, expect, 1, NULL));
+    mem_fill(SRAM_BASE, 0, SRAM_SIZE);
+}
+
+// Writes a minimal ARM ELF file: code in .text at 0 and a DWARF 3 line table
+// giving instructions from 0xC0 on lines 10, 11, ...
+static void write_test_elf(const char *path, const void *code, uint32_t code_len, uint32_t lines) {
+    static uint8_t line_table[256];
+    static const uint8_t header[] = {
+        3, 0,                         // Version
+        26, 0, 0, 0,                  // Header length
+        2, 1, 0xFB, 14, 13,           // Min length, is_stmt, line base/range, opcode base
+        0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1,
+        0,                            // No include directories
+        't', '.', 's', 0, 0, 0, 0, 0, // One file
+    };
+    uint32_t n = 4;
+    memcpy(line_table + n, header, sizeof(header));
+    n += sizeof(header);
+    const uint8_t start[] = {0, 5, 2, 0xC0, 0, 0, 0, 3, 9, 1}; // set_address, line 10, copy
+    memcpy(line_table + n, start, sizeof(start));
+    n += sizeof(start);
+    for (uint32_t i = 1; i < lines; i++) {
+        const uint8_t row[] = {2, 1, 3, 1, 1}; // Next halfword, next line, copy
+        memcpy(line_table + n, row, sizeof(row));
+        n += sizeof(row);
+    }
+    const uint8_t end[] = {2, 1, 0, 1, 1};
+    memcpy(line_table + n, end, sizeof(end));
+    n += sizeof(end);
+    uint32_t unit = n - 4;
+    memcpy(line_table, &unit, 4);
+
+    const char names[] = "\0.text\0.debug_line\0.shstrtab";
+    Elf32_Ehdr eh = {0};
+    memcpy(eh.e_ident, ELFMAG, SELFMAG);
+    eh.e_ident[EI_CLASS] = ELFCLASS32;
+    eh.e_ident[EI_DATA] = ELFDATA2LSB;
+    eh.e_ident[EI_VERSION] = EV_CURRENT;
+    eh.e_type = ET_EXEC;
+    eh.e_machine = EM_ARM;
+    eh.e_ehsize = sizeof(eh);
+    eh.e_shentsize = sizeof(Elf32_Shdr);
+    eh.e_shnum = 4;
+    eh.e_shstrndx = 3;
+    Elf32_Shdr sh[4] = {{0}};
+    sh[1] = (Elf32_Shdr){.sh_name = 1, .sh_type = SHT_PROGBITS, .sh_flags = SHF_ALLOC | SHF_EXECINSTR,
+                         .sh_offset = sizeof(eh), .sh_size = code_len};
+    sh[2] = (Elf32_Shdr){.sh_name = 7, .sh_type = SHT_PROGBITS,
+                         .sh_offset = sh[1].sh_offset + code_len, .sh_size = n};
+    sh[3] = (Elf32_Shdr){.sh_name = 19, .sh_type = SHT_STRTAB,
+                         .sh_offset = sh[2].sh_offset + n, .sh_size = sizeof(names)};
+    eh.e_shoff = (sh[3].sh_offset + sizeof(names) + 3) & ~3u;
+
+    FILE *f = fopen(path, "wb");
+    assert(f);
+    fwrite(&eh, sizeof(eh), 1, f);
+    fwrite(code, 1, code_len, f);
+    fwrite(line_table, 1, n, f);
+    fwrite(names, 1, sizeof(names), f);
+    fseek(f, eh.e_shoff, SEEK_SET);
+    fwrite(sh, sizeof(sh), 1, f);
+    fclose(f);
+}
+
+static uint8_t coverage_nibble(const uint64_t *map, uint32_t addr) {
+    return (map[addr / 2 / COV_HALFWORDS_PER_WORD] >> ((addr / 2 % COV_HALFWORDS_PER_WORD) * 4)) & 0xF;
+}
+
+void test_coverage(CortexM0_CPU *cpu) {
+    (void)cpu;
+    const uint16_t code[] = {
+        0x2000, //          MOVS r0, #0          line 10
+        0x2103, //          MOVS r1, #3
+        0x2201, //          MOVS r2, #1
+        0x1A89, // loop:    SUBS r1, r1, r2
+        0xD1FD, //          BNE loop             line 14: taken and not taken
+        0xD100, //          BNE exit             line 15: never taken
+        0x2018, // exit:    MOVS r0, #SYS_EXIT
+        0xBEAB, //          BKPT 0xAB
+        0xE7FE, //          B .                  line 18: never reached
+    };
+    uint32_t image[0xD4 / 4];
+    build_test_image(image, sizeof(image), code, sizeof(code));
+
+    // Split runs record the same blocks as one run
+    uint64_t merged[64] = {0};
+    for (int split = 0; split < 10; split += 3) {
+        Vmcu *vm = load_test_image(image, sizeof(image));
+        size_t words;
+        assert(vmcu_coverage_map(vm, &words) == NULL);
+        assert(vmcu_coverage_start(vm) && !vmcu_coverage_start(vm));
+        if (split) {
+            assert(vmcu_run_for(vm, split) == VMCU_STOP_BUDGET);
+        }
+        assert(vmcu_run_for(vm, 100) == VMCU_STOP_EXIT);
+        const uint64_t *map = vmcu_coverage_map(vm, &words);
+        assert(map && words == FLASH_SIZE / 2 / COV_HALFWORDS_PER_WORD && words <= 64);
+        for (uint32_t addr = 0xC0; addr < 0xD0; addr += 2) {
+            uint8_t expect = addr == 0xC8 ? COV_EXEC | COV_TAKEN | COV_NOT_TAKEN
+                           : addr == 0xCA ? COV_EXEC | COV_NOT_TAKEN : COV_EXEC;
+            assert(coverage_nibble(map, addr) == expect);
+        }
+        assert(coverage_nibble(map, 0xD0) == 0 && coverage_nibble(map, 0xBE) == 0);
+        if (split == 0) {
+            vmcu_coverage_merge(merged, map, words);
+        } else {
+            assert(memcmp(merged, map, words * sizeof(uint64_t)) == 0);
+        }
+        vmcu_destroy(vm);
+    }
+
+    // Merging ORs the maps, in the vector kernels and the tail
+    uint64_t a[37], b[37];
+    for (int i = 0; i < 37; i++) {
+        a[i] = 0x0123456789ABCDEFull * (i + 1);
+        b[i] = ~a[i] << (i % 7);
+    }
+    uint64_t expect[37];
+    for (int i = 0; i < 37; i++) expect[i] = a[i] | b[i];
+    coverage_merge(a, b, 37);
+    assert(memcmp(a, expect, sizeof(a)) == 0);
+
+    // Saving twice merges into the file; the lcov report maps it to lines
+    const char cov_path[] = "/tmp/vmcu_coverage_test.cov";
+    const char elf_path[] = "/tmp/vmcu_coverage_test.elf";
+    unlink(cov_path);
+    Vmcu *vm = load_test_image(image, sizeof(image));
+    assert(vmcu_coverage_start(vm));
+    assert(vmcu_run_for(vm, 5) == VMCU_STOP_BUDGET); // Up to the first BNE
+    assert(vmcu_coverage_save(vm, cov_path));
+    vmcu_destroy(vm);
+    vm = load_test_image(image, sizeof(image));
+    assert(vmcu_coverage_start(vm));
+    vmcu_set_reg(vm, VMCU_REG_PC, 0xCC);
+    assert(vmcu_run_for(vm, 100) == VMCU_STOP_EXIT);
+    assert(vmcu_coverage_save(vm, cov_path));
+    vmcu_destroy(vm);
+
+    write_test_elf(elf_path, image, sizeof(image), 9);
+    char *text = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&text, &size);
+    assert(coverage_lcov(cov_path, elf_path, out));
+    fclose(out);
+    const char report[] =
+        "TN:\nSF:t.s\n"
+        "DA:10,1\nDA:11,1\nDA:12,1\nDA:13,1\n"
+        "DA:14,1\nBRDA:14,0,0,1\nBRDA:14,0,1,0\n"
+        "DA:15,0\nBRDA:15,0,0,-\nBRDA:15,0,1,-\n"
+        "DA:16,1\nDA:17,1\nDA:18,0\n"
+        "BRF:4\nBRH:1\nLF:9\nLH:7\nend_of_record\n";
+    assert(strcmp(text, report) == 0);
+    free(text);
+    assert(!coverage_lcov(elf_path, elf_path, stdout)); // Not a coverage file
+    unlink(cov_path);
+    unlink(elf_path);
+
+    // Loading an image drops the old code's coverage and pending interrupts
+    vm = load_test_image(image, sizeof(image));
+    assert(vmcu_coverage_start(vm) && vmcu_run_for(vm, 5) == VMCU_STOP_BUDGET);
+    assert(vmcu_set_irq(vm, 3) && vmcu_load_image(vm, image, sizeof(image)));
+    size_t words;
+    const uint64_t *map = vmcu_coverage_map(vm, &words);
+    for (size_t i = 0; i < words; i++) {
+        assert(map[i] == 0);
+    }
+    assert(vm->nvic_pending == 0);
+    vmcu_destroy(vm);
+
+    // Re-initialising an instance frees its map; collection can start again
+    vm = vmcu_create(NULL);
+    assert(vm && vmcu_coverage_start(vm) && vm->coverage);
+    mcu_init(vm);
+    assert(vm->coverage == NULL && vmcu_coverage_start(vm));
+    vmcu_destroy(vm);
+}
+
+void test_reload_image(CortexM0_CPU *cpu) {
+    (void)cpu;
+    static uint8_t old_image[40000], new_image[30000];
+    for (size_t i = 0; i < sizeof(old_image); i++) {
+        old_image[i] = (uint8_t)(i * 7 + 1);
+    }
+    const uint32_t vectors[2] = {SRAM_BASE + SRAM_SIZE, 0xC0 | 1};
+    const uint16_t code[] = {
+        0x2001, // MOVS r0, #1
+        0xE7FE, // B .
+    };
+    memcpy(old_image, vectors, sizeof(vectors));
+    memcpy(old_image + 0xC0, code, sizeof(code));
+    memcpy(new_image, old_image, sizeof(new_image));
+    new_image[20000] ^= 0xFF;
+
+    const Vmcu_Config config = {64 << 10, 0, 0};
+    Vmcu *vm = vmcu_create(&config);
+    assert(vm && vmcu_load_image(vm, old_image, sizeof(old_image)));
+    assert(vmcu_coverage_start(vm) && vmcu_run_for(vm, 10) == VMCU_STOP_BUDGET);
+    assert(vmcu_set_breakpoint(vm, 0xC2, true));
+
+    // Same image: nothing is rewritten, but the CPU still starts over
+    uint32_t changed;
+    assert(vmcu_reload_image(vm, old_image, sizeof(old_image), &changed) && changed == 0);
+    assert(vmcu_get_reg(vm, VMCU_REG_PC) == 0xC0 && vmcu_cycles(vm) == 0);
+
+    // Page 4 differs; the image now ends in page 7, so 7 to 9 are cleared
+    assert(vmcu_reload_image(vm, new_image, sizeof(new_image), &changed) && changed == 4);
+    mcu_select(vm);
+    uint32_t diff;
+    assert(mem_compare(FLASH_BASE, new_image, sizeof(new_image), &diff) && diff == sizeof(new_image));
+    static const uint8_t zero[64 << 10];
+    assert(mem_compare(FLASH_BASE + sizeof(new_image), zero, sizeof(zero) - sizeof(new_image), &diff));
+    assert(diff == sizeof(zero));
+    // Coverage of the untouched page 0 and the breakpoint survive
+    size_t words;
+    const uint64_t *map = vmcu_coverage_map(vm, &words);
+    assert(map[0xC0 / 32] & (COV_EXEC << (0xC0 / 2 % COV_HALFWORDS_PER_WORD * 4)));
+    assert(vmcu_run_for(vm, 10) == VMCU_STOP_BREAKPOINT);
+
+    // A new reset vector takes effect at once; page 0's coverage is dropped
+    new_image[4] = 0xC2 | 1;
+    assert(vmcu_reload_image(vm, new_image, sizeof(new_image), &changed) && changed == 1);
+    assert(vmcu_get_reg(vm, VMCU_REG_PC) == 0xC2);
+    assert(map[0xC0 / 32] == 0);
+
+    // An image that does not fit leaves Flash alone
+    static uint8_t too_big[(64 << 10) + 2];
+    assert(!vmcu_reload_image(vm, too_big, sizeof(too_big), &changed));
+    assert(mem_compare(FLASH_BASE, new_image, sizeof(new_image), &diff) && diff == sizeof(new_image));
+    mcu_select(NULL);
+    vmcu_destroy(vm);
+}
+
+void test_alu_conformance(CortexM0_CPU *cpu) {
+    // Reference: AddWithCarry() at the unsigned and signed boundaries
+    uint32_t result;
+    bool carry, overflow;
+    arm_add_with_carry(0x7FFFFFFF, 1, false, &result, &carry, &overflow);
+    assert(result == 0x80000000 && !carry && overflow);
+    arm_add_with_carry(0xFFFFFFFF, 1, false, &result, &carry, &overflow);
+    assert(result == 0 && carry && !overflow);
+    arm_add_with_carry(0x80000000, ~1u, true, &result, &carry, &overflow); // 0x80000000 - 1
+    assert(result == 0x7FFFFFFF && carry && overflow);
+
+    // Handlers: SUBS/CMP overflow and V kept by shifts
+    memset(cpu, 0, sizeof(*cpu));
+    cpu->R[1] = 0x80000000;
+    cpu->R[2] = 1;
+    SUB(cpu, 0, 1, 2);
+    assert(cpu->R[0] == 0x7FFFFFFF && cpu->APSR.Bits.APSR_C && cpu->APSR.Bits.APSR_V);
+    cpu->R[1] = 0;
+    CMP(cpu, 1, 2); // 0 - 1 borrows but does not overflow
+    assert(cpu->APSR.Bits.APSR_N && !cpu->APSR.Bits.APSR_C && !cpu->APSR.Bits.APSR_V);
+    cpu->APSR.Bits.APSR_V = 1;
+    cpu->R[1] = 0xC0000000;
+    LSL(cpu, 0, 1, 1);
+    assert(cpu->R[0] == 0x80000000 && cpu->APSR.Bits.APSR_C && cpu->APSR.Bits.APSR_V);
+    LSR(cpu, 0, 1, 0); // LSRS #32
+    assert(cpu->R[0] == 0 && cpu->APSR.Bits.APSR_Z && cpu->APSR.Bits.APSR_C &&
+           cpu->APSR.Bits.APSR_V);
+
+    // 8-bit exhaustive spaces plus a few random cases, on two threads
+    Conformance_Config config = {1 << 12, 1, 2, 8};
+    Conformance_Report report[CONF_OPS];
+    bool ok = conformance_run(&config, report);
+    if (!ok) {
+        print_conformance_report(report);
+    }
+    assert(ok);
+    assert(report[CONF_ADD].cases == 65536 + (1 << 12));
+    assert(report[CONF_LSR].cases == 256 * 32 + (1 << 12));
+    memset(cpu, 0, sizeof(*cpu));
+}
+
+void run_all_tests(void) {
+    CortexM0_CPU cpu;
+
+    test_Bcond_EQ(&cpu);
+    test_breakpoint_stops_run(&cpu);
+    test_watchpoint_stops_run(&cpu);
+    test_gdb_stub(&cpu);
+    test_uart(&cpu);
+    test_semihosting(&cpu);
+    test_dma_interrupt(&cpu);
+    test_block_transfer(&cpu);
+    test_cosim(&cpu);
+    test_shared_flash(&cpu);
+    test_sparse_memory(&cpu);
+    test_vmcu_api(&cpu);
+    test_stats(&cpu);
+    test_stack_monitor(&cpu);
+    test_latency(&cpu);
+    test_pacing(&cpu);
+    test_trace(&cpu);
+    test_batch_cache(&cpu);
+    test_mem_ops(&cpu);
+    test_coverage(&cpu);
+    test_reload_image(&cpu);
+    test_alu_conformance(&cpu);
+    printf("All tests passed\n");
+}
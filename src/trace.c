@@ -0,0 +1,364 @@
+#include "trace.h"
+#include "lz.h"
+#include "mcu.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static inline uint8_t *put_varint(uint8_t *p, uint64_t v)
+{
+  while (v >= 0x80)
+  {
+    *p++ = (uint8_t)v | 0x80;
+    v >>= 7;
+  }
+  *p++ = (uint8_t)v;
+  return p;
+}
+
+static inline uint32_t zigzag(uint32_t delta)
+{
+  return (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * @brief Compresses and writes chunks in order until the trace is stopped.
+ */
+static void *trace_writer(void *arg)
+{
+  Trace *t = arg;
+  uint8_t *out = malloc(LZ_BOUND(TRACE_CHUNK_SIZE) + 8);
+  pthread_mutex_lock(&t->lock);
+  for (;;)
+  {
+    while (t->written == t->filled && !t->stopping)
+    {
+      pthread_cond_wait(&t->cond, &t->lock);
+    }
+    if (t->written == t->filled)
+    {
+      break;
+    }
+    uint32_t index = t->written % TRACE_CHUNKS;
+    uint32_t len = t->lengths[index];
+    pthread_mutex_unlock(&t->lock);
+
+    bool ok = out != NULL;
+    if (ok)
+    {
+      size_t packed = lz_compress(t->chunks[index], len, out + 8);
+      if (packed >= len) // Store incompressible chunks as they are
+      {
+        memcpy(out + 8, t->chunks[index], len);
+        packed = len;
+      }
+      put_u32(out, len);
+      put_u32(out + 4, (uint32_t)packed);
+      ok = fwrite(out, 1, packed + 8, t->file) == packed + 8;
+      t->raw_bytes += len;
+      t->file_bytes += packed + 8;
+    }
+
+    pthread_mutex_lock(&t->lock);
+    t->failed |= !ok;
+    t->written++;
+    pthread_cond_signal(&t->cond);
+  }
+  pthread_mutex_unlock(&t->lock);
+  free(out);
+  return NULL;
+}
+
+/**
+ * @brief Hands the current chunk to the writer and continues in the next one.
+ *
+ * Waits only if all TRACE_CHUNKS chunks are still queued.
+ */
+static void trace_next_chunk(Trace *t)
+{
+  uint32_t index = t->filled % TRACE_CHUNKS;
+  t->lengths[index] = (uint32_t)(t->pos - t->chunks[index]);
+  pthread_mutex_lock(&t->lock);
+  t->filled++;
+  pthread_cond_signal(&t->cond);
+  while (t->filled - t->written >= TRACE_CHUNKS)
+  {
+    pthread_cond_wait(&t->cond, &t->lock);
+  }
+  pthread_mutex_unlock(&t->lock);
+  t->pos = t->chunks[t->filled % TRACE_CHUNKS];
+  t->end = t->pos + TRACE_CHUNK_SIZE;
+}
+
+/**
+ * @brief Records that PC is not the address after the last instruction.
+ *
+ * Called from the run loop before executing the instruction at pc.
+ */
+void trace_jump(Trace *t, uint32_t pc)
+{
+  if (t->end - t->pos < TRACE_MAX_RECORD)
+  {
+    trace_next_chunk(t);
+  }
+  uint8_t *p = put_varint(t->pos, (uint64_t)t->count << 2);
+  t->pos = put_varint(p, zigzag(pc - t->next_pc));
+  t->count = 0;
+}
+
+/**
+ * @brief Records a guest memory access of the instruction being executed.
+ */
+void trace_mem(Trace *t, bool write, uint32_t addr, uint32_t size, uint32_t value)
+{
+  if (t->end - t->pos < TRACE_MAX_RECORD)
+  {
+    trace_next_chunk(t);
+  }
+  uint64_t head = ((uint64_t)t->count << 2 | (uint32_t)__builtin_ctz(size)) << 2 | (write ? 1 : 2);
+  uint8_t *p = put_varint(t->pos, head);
+  p = put_varint(p, zigzag(addr - t->last_addr));
+  t->pos = put_varint(p, value);
+  t->last_addr = addr;
+  t->count = 0;
+}
+
+/**
+ * @brief Starts tracing the selected instance to a file.
+ *
+ * Every later cpu_run() on the instance is traced until trace_stop().
+ *
+ * @return false if a trace is already running, the file cannot be created
+ *         or the writer thread cannot be started.
+ */
+bool trace_start(const char *path)
+{
+  if (mcu->trace)
+  {
+    printf("A trace is already running\n");
+    return false;
+  }
+  Trace *t = aligned_alloc(64, (sizeof(Trace) + 63) & ~(size_t)63);
+  if (t == NULL)
+  {
+    return false;
+  }
+  memset(t, 0, sizeof(*t));
+  bool ok = true;
+  for (int i = 0; i < TRACE_CHUNKS; i++)
+  {
+    ok &= (t->chunks[i] = malloc(TRACE_CHUNK_SIZE)) != NULL;
+  }
+  t->file = ok ? fopen(path, "wb") : NULL;
+  if (t->file == NULL || fwrite(TRACE_HEADER, 1, 8, t->file) != 8)
+  {
+    printf("Cannot create trace %s\n", path);
+    if (t->file) fclose(t->file);
+    for (int i = 0; i < TRACE_CHUNKS; i++) free(t->chunks[i]);
+    free(t);
+    return false;
+  }
+  t->pos = t->chunks[0];
+  t->end = t->pos + TRACE_CHUNK_SIZE;
+  pthread_mutex_init(&t->lock, NULL);
+  pthread_cond_init(&t->cond, NULL);
+  if (pthread_create(&t->writer, NULL, trace_writer, t) != 0)
+  {
+    printf("Cannot start the trace writer\n");
+    pthread_mutex_destroy(&t->lock);
+    pthread_cond_destroy(&t->cond);
+    fclose(t->file);
+    for (int i = 0; i < TRACE_CHUNKS; i++) free(t->chunks[i]);
+    free(t);
+    return false;
+  }
+  mcu->trace = t;
+  return true;
+}
+
+/**
+ * @brief Ends the selected instance's trace and waits for the file to be complete.
+ *
+ * @return false if no trace was running or writing failed.
+ */
+bool trace_stop(void)
+{
+  Trace *t = mcu->trace;
+  if (t == NULL)
+  {
+    return false;
+  }
+  mcu->trace = NULL;
+  if (t->end - t->pos < TRACE_MAX_RECORD)
+  {
+    trace_next_chunk(t);
+  }
+  t->pos = put_varint(t->pos, (uint64_t)t->count << 2 | 3);
+  trace_next_chunk(t);
+
+  pthread_mutex_lock(&t->lock);
+  t->stopping = true;
+  pthread_cond_signal(&t->cond);
+  pthread_mutex_unlock(&t->lock);
+  pthread_join(t->writer, NULL);
+
+  bool ok = !t->failed && fclose(t->file) == 0;
+  if (!ok)
+  {
+    printf("Error writing trace\n");
+  }
+  pthread_mutex_destroy(&t->lock);
+  pthread_cond_destroy(&t->cond);
+  for (int i = 0; i < TRACE_CHUNKS; i++)
+  {
+    free(t->chunks[i]);
+  }
+  free(t);
+  return ok;
+}
+
+// Decoder state carried across blocks
+typedef struct {
+  FILE *out;
+  uint32_t pc;
+  bool pc_printed; // The instruction at pc was printed with its accesses
+  uint32_t last_addr;
+  uint64_t instructions, reads, writes;
+  bool ended;
+} Trace_Reader;
+
+static void reader_advance(Trace_Reader *r, uint64_t n)
+{
+  for (uint64_t i = 0; i < n; i++)
+  {
+    if (!r->pc_printed)
+    {
+      fprintf(r->out, "0x%08X\n", r->pc);
+    }
+    r->pc_printed = false;
+    r->pc += 2;
+  }
+  r->instructions += n;
+}
+
+static bool get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+  *v = 0;
+  for (int shift = 0; *p < end && shift < 64; shift += 7)
+  {
+    uint8_t b = *(*p)++;
+    *v |= (uint64_t)(b & 0x7F) << shift;
+    if (!(b & 0x80))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool reader_block(Trace_Reader *r, const uint8_t *p, const uint8_t *end)
+{
+  while (p < end)
+  {
+    uint64_t head, delta, value;
+    if (!get_varint(&p, end, &head))
+    {
+      return false;
+    }
+    switch (head & 3)
+    {
+    case 0: // Jump
+      if (!get_varint(&p, end, &delta))
+      {
+        return false;
+      }
+      reader_advance(r, head >> 2);
+      r->pc += (uint32_t)(delta >> 1) ^ -(uint32_t)(delta & 1);
+      r->pc_printed = false;
+      break;
+    case 1: // Write
+    case 2: // Read
+      if (!get_varint(&p, end, &delta) || !get_varint(&p, end, &value))
+      {
+        return false;
+      }
+      reader_advance(r, head >> 4);
+      if (!r->pc_printed)
+      {
+        fprintf(r->out, "0x%08X\n", r->pc);
+        r->pc_printed = true;
+      }
+      r->last_addr += (uint32_t)(delta >> 1) ^ -(uint32_t)(delta & 1);
+      fprintf(r->out, "    %c%u [0x%08X] 0x%0*X\n", (head & 3) == 1 ? 'W' : 'R',
+              1u << ((head >> 2) & 3), r->last_addr, 2 << ((head >> 2) & 3), (uint32_t)value);
+      *((head & 3) == 1 ? &r->writes : &r->reads) += 1;
+      break;
+    default: // End
+      reader_advance(r, head >> 2);
+      r->ended = true;
+      return p == end;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Decodes a trace file to text: one line per executed instruction
+ *        (its address) followed by the memory accesses it made.
+ *
+ * Accesses made during exception entry and return are listed under the
+ * interrupted instruction.
+ *
+ * @return false if the file is not a complete trace.
+ */
+bool trace_decode(const char *path, FILE *out)
+{
+  FILE *f = fopen(path, "rb");
+  char magic[8];
+  if (f == NULL || fread(magic, 1, 8, f) != 8 || memcmp(magic, TRACE_HEADER, 8) != 0)
+  {
+    printf("%s is not a trace file\n", path);
+    if (f) fclose(f);
+    return false;
+  }
+  uint8_t *packed = malloc(LZ_BOUND(TRACE_CHUNK_SIZE));
+  uint8_t *raw = malloc(TRACE_CHUNK_SIZE);
+  Trace_Reader r = {.out = out};
+  bool ok = packed && raw;
+  uint8_t header[8];
+  while (ok && !r.ended && fread(header, 1, 8, f) == 8)
+  {
+    uint32_t len = get_u32(header);
+    uint32_t packed_len = get_u32(header + 4);
+    ok = len <= TRACE_CHUNK_SIZE && packed_len <= len &&
+         fread(packed, 1, packed_len, f) == packed_len &&
+         (packed_len == len ? (memcpy(raw, packed, len), true)
+                            : lz_decompress(packed, packed_len, raw, len)) &&
+         reader_block(&r, raw, raw + len);
+  }
+  ok &= r.ended;
+  fprintf(out, "# %llu instructions, %llu reads, %llu writes\n",
+          (unsigned long long)r.instructions, (unsigned long long)r.reads,
+          (unsigned long long)r.writes);
+  if (!ok)
+  {
+    printf("%s is truncated or corrupt\n", path);
+  }
+  free(packed);
+  free(raw);
+  fclose(f);
+  return ok;
+}
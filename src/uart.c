@@ -0,0 +1,234 @@
+#define _GNU_SOURCE
+#include "uart.h"
+#include "mmio.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+
+static bool uart_read_reg(void *ctx, uint32_t offset, uint32_t size, uint32_t *value)
+{
+  Uart *uart = ctx;
+  (void)size;
+
+  switch (offset)
+  {
+  case UART_SR:
+    *value = (ring_used(&uart->rx) ? UART_SR_RXNE : 0) |
+             (ring_used(&uart->tx) < RING_SIZE ? UART_SR_TXE : 0) |
+             (ring_used(&uart->tx) == 0 ? UART_SR_TC : 0);
+    return true;
+  case UART_DR:
+  {
+    uint8_t byte = 0;
+    ring_get(&uart->rx, &byte); // Empty receiver reads as 0
+    *value = byte;
+    return true;
+  }
+  default:
+    *value = 0;
+    return true;
+  }
+}
+
+/**
+ * @brief TX data register write: the byte goes into the SPSC ring only.
+ *
+ * If the host thread falls a whole ring behind, the emulator spins in user
+ * space until a slot frees up; it never makes a syscall per character.
+ * A TX hook, when set, takes the byte instead.
+ */
+static bool uart_write_reg(void *ctx, uint32_t offset, uint32_t size, uint32_t value)
+{
+  Uart *uart = ctx;
+  (void)size;
+
+  if (offset == UART_DR)
+  {
+    if (uart->tx_hook)
+    {
+      uart->tx_hook(uart->tx_hook_ctx, value & 0xFF);
+      return true;
+    }
+    if (!uart->running)
+    {
+      return true; // No host attached: discard
+    }
+    while (!ring_put(&uart->tx, value & 0xFF))
+    {
+      cpu_relax();
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Host I/O thread: drains TX to tx_fd and fills RX from rx_fd.
+ *
+ * Each pass moves up to UART_IO_BATCH bytes with one write() and one read().
+ * When there is nothing to send it blocks in poll() for at most 1 ms.
+ */
+static void *uart_io_thread(void *arg)
+{
+  Uart *uart = arg;
+  uint8_t buf[UART_IO_BATCH];
+
+  for (;;)
+  {
+    bool stopping = atomic_load_explicit(&uart->stop, memory_order_acquire);
+    size_t n = ring_read(&uart->tx, buf, sizeof(buf));
+    size_t done = 0;
+    while (done < n && uart->tx_fd >= 0)
+    {
+      ssize_t w = write(uart->tx_fd, buf + done, n - done);
+      if (w < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if (w <= 0)
+      {
+        break;
+      }
+      done += w;
+    }
+    if (stopping && ring_used(&uart->tx) == 0)
+    {
+      break;
+    }
+
+    // Wait for input (at most 1 ms) only when there was nothing to send. While
+    // the RX ring is full, input is left pending and the wait is a plain sleep.
+    size_t space = RING_SIZE - ring_used(&uart->rx);
+    bool want_rx = uart->rx_fd >= 0 && space > 0;
+    struct pollfd pfd = {.fd = uart->rx_fd, .events = POLLIN};
+    int ready = poll(&pfd, want_rx ? 1 : 0, n ? 0 : 1);
+    uart->polls++;
+    if (ready > 0 && (pfd.revents & POLLIN))
+    {
+      ssize_t r = read(uart->rx_fd, buf, space < sizeof(buf) ? space : sizeof(buf));
+      if (r > 0)
+      {
+        ring_write(&uart->rx, buf, r);
+      }
+      else if (r == 0 || (errno != EINTR && errno != EAGAIN))
+      {
+        uart->rx_fd = -1; // End of input or a hard error; keep serving TX
+      }
+    }
+    else if (ready > 0 && (pfd.revents & (POLLHUP | POLLERR | POLLNVAL)))
+    {
+      uart->rx_fd = -1; // Input closed; keep serving TX
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Maps a UART at the given base address.
+ *
+ * Until uart_attach() is called, transmitted bytes are discarded and the
+ * receiver stays empty.
+ *
+ * @return false if the register block overlaps another peripheral.
+ */
+bool uart_init(Uart *uart, uint32_t base)
+{
+  memset(uart, 0, sizeof(*uart));
+  uart->base = base;
+  uart->tx_fd = -1;
+  uart->rx_fd = -1;
+  ring_init(&uart->tx);
+  ring_init(&uart->rx);
+  atomic_init(&uart->stop, false);
+  return mmio_register(base, UART_REG_SIZE, uart_read_reg, uart_write_reg, uart);
+}
+
+/**
+ * @brief Connects the UART to host file descriptors and starts the I/O thread.
+ *
+ * @param tx_fd Descriptor receiving transmitted bytes (-1 to discard).
+ * @param rx_fd Descriptor providing received bytes (-1 for none).
+ */
+bool uart_attach(Uart *uart, int tx_fd, int rx_fd)
+{
+  uart->tx_fd = tx_fd;
+  uart->rx_fd = rx_fd;
+  atomic_store(&uart->stop, false);
+  if (pthread_create(&uart->thread, NULL, uart_io_thread, uart) != 0)
+  {
+    return false;
+  }
+  uart->running = true;
+  return true;
+}
+
+/**
+ * @brief Flushes pending TX bytes, stops the I/O thread and unmaps the UART.
+ *
+ * The host descriptors are left open for the caller.
+ */
+void uart_detach(Uart *uart)
+{
+  if (uart->running)
+  {
+    atomic_store_explicit(&uart->stop, true, memory_order_release);
+    pthread_join(uart->thread, NULL);
+    uart->running = false;
+  }
+  mmio_unregister(uart->base);
+}
+
+/**
+ * @brief Routes transmitted bytes to hook(ctx, byte) instead of the host thread.
+ *
+ * The hook runs on the emulator thread during the DR write, so event_now()
+ * gives the cycle at which the byte was sent. Pass NULL to remove it.
+ */
+void uart_set_tx_hook(Uart *uart, Uart_Tx_Hook hook, void *ctx)
+{
+  uart->tx_hook = hook;
+  uart->tx_hook_ctx = ctx;
+}
+
+/**
+ * @brief Opens the host side of a UART from a command-line spec.
+ *
+ * "stdio" uses stdout/stdin, "pty" allocates a pseudo-terminal and prints
+ * its name, anything else is a file or FIFO path opened for output.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int uart_open_host(const char *spec, int *tx_fd, int *rx_fd)
+{
+  if (strcmp(spec, "stdio") == 0)
+  {
+    *tx_fd = STDOUT_FILENO;
+    *rx_fd = STDIN_FILENO;
+    return 0;
+  }
+  if (strcmp(spec, "pty") == 0)
+  {
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0)
+    {
+      perror("uart pty");
+      return -1;
+    }
+    printf("UART connected to %s\n", ptsname(fd));
+    *tx_fd = fd;
+    *rx_fd = fd;
+    return 0;
+  }
+  int fd = open(spec, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+  {
+    perror("uart");
+    return -1;
+  }
+  *tx_fd = fd;
+  *rx_fd = -1;
+  return 0;
+}
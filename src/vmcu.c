@@ -0,0 +1,404 @@
+#include "vmcu.h"
+#include "mcu.h"
+#include "execute.h"
+
+/*
+ * The library calls select the instance for the duration of the call only,
+ * so hosts can interleave several instances on one thread. The run loop
+ * itself is cpu_run(): the per-call cost of vmcu_run_for() is one
+ * thread-local swap, so hosts can step in small quanta.
+ */
+
+_Static_assert((int)VMCU_STOP_STACK_LIMIT == (int)STOP_STACK_LIMIT, "Vmcu_Stop must mirror Stop_Reason");
+_Static_assert(VMCU_REG_PC == 15, "VMCU_REG_PC must match R[15]");
+
+// Makes vm the calling thread's instance and returns the previous one
+static inline Mcu *vmcu_enter(Vmcu *vm)
+{
+  Mcu *prev = mcu;
+  mcu = vm;
+  return prev;
+}
+
+int vmcu_api_version(void)
+{
+  return VMCU_API_VERSION;
+}
+
+/**
+ * @brief Creates an instance with the given memory map.
+ *
+ * @return The instance, or NULL for an invalid map or if allocation fails.
+ */
+Vmcu *vmcu_create(const Vmcu_Config *config)
+{
+  Mcu_Config map = {FLASH_SIZE, SRAM_SIZE, 0};
+  if (config)
+  {
+    map.flash_size = config->flash_size ? config->flash_size : FLASH_SIZE;
+    map.sram_size = config->sram_size ? config->sram_size : SRAM_SIZE;
+    map.ext_ram_size = config->ext_ram_size;
+  }
+  return mcu_create_config(&map);
+}
+
+void vmcu_destroy(Vmcu *vm)
+{
+  if (vm)
+  {
+    mcu_destroy(vm); // Falls back to the default instance if vm was selected
+  }
+}
+
+/**
+ * @brief Loads a raw binary file into Flash and resets the CPU.
+ */
+bool vmcu_load_file(Vmcu *vm, const char *path)
+{
+  Mcu *prev = vmcu_enter(vm);
+  bool ok = load_binary(path);
+  if (ok)
+  {
+    cpu_reset(&vm->cpu);
+  }
+  mcu = prev;
+  return ok;
+}
+
+/**
+ * @brief Copies an image to the start of Flash and resets the CPU.
+ *
+ * Coverage of the old code and pending interrupts are dropped, as by
+ * vmcu_reload_image().
+ */
+bool vmcu_load_image(Vmcu *vm, const void *image, uint32_t len)
+{
+  if (len > vm->regions[REGION_FLASH].size)
+  {
+    return false;
+  }
+  Mcu *prev = vmcu_enter(vm);
+  mcu_clear_region(vm, REGION_FLASH);
+  bool ok = mem_write_block(FLASH_BASE, image, len);
+  if (vm->coverage)
+  {
+    coverage_invalidate(vm->coverage, FLASH_BASE, FLASH_BASE + vm->regions[REGION_FLASH].size);
+  }
+  load_vector_table((uint32_t *)Flash);
+  cpu_reset(&vm->cpu);
+  vm->nvic_pending = 0;
+  mcu = prev;
+  return ok;
+}
+
+/**
+ * @brief Loads a new build of the firmware, rewriting only the Flash pages
+ *        that changed, and resets the CPU (see reload_image()).
+ *
+ * @return false if the image does not fit in Flash.
+ */
+bool vmcu_reload_image(Vmcu *vm, const void *image, uint32_t len, uint32_t *changed_pages)
+{
+  Mcu *prev = vmcu_enter(vm);
+  bool ok = reload_image(&vm->cpu, image, len, changed_pages);
+  mcu = prev;
+  return ok;
+}
+
+/**
+ * @brief Resets the CPU from the vector table; memory is left as it is.
+ */
+void vmcu_reset(Vmcu *vm)
+{
+  Mcu *prev = vmcu_enter(vm);
+  load_vector_table((uint32_t *)Flash);
+  cpu_reset(&vm->cpu);
+  vm->nvic_pending = 0;
+  mcu = prev;
+}
+
+/**
+ * @brief Runs the instance for up to the given number of instructions.
+ *
+ * The budget counts instructions, not cycles: every instruction takes one
+ * cycle in this model, but exception entry and return add the costs set
+ * with vmcu_set_exception_cycles() (0 by default) to the cycle counter, so
+ * vmcu_cycles() can advance by more than the budget.
+ * A breakpoint at the current PC is stepped over, so a stopped instance can
+ * simply be run again.
+ *
+ * @return VMCU_STOP_BUDGET when the whole budget was used.
+ */
+Vmcu_Stop vmcu_run_for(Vmcu *vm, uint64_t instructions)
+{
+  Mcu *prev = vmcu_enter(vm);
+  Stop_Reason reason = cpu_run(&vm->cpu, instructions);
+  mcu = prev;
+  return (Vmcu_Stop)reason;
+}
+
+uint64_t vmcu_cycles(const Vmcu *vm)
+{
+  return vm->cpu.cycles;
+}
+
+const char *vmcu_stop_name(Vmcu_Stop stop)
+{
+  return stop_reason_name((Stop_Reason)stop);
+}
+
+/**
+ * @brief Reads R0-R15, or the xPSR for VMCU_REG_XPSR (0 for other numbers).
+ */
+uint32_t vmcu_get_reg(const Vmcu *vm, unsigned reg)
+{
+  if (reg < 16)
+  {
+    return vm->cpu.R[reg];
+  }
+  if (reg == VMCU_REG_XPSR)
+  {
+    return get_xpsr((CortexM0_CPU *)&vm->cpu) | vm->cpu.ipsr;
+  }
+  return 0;
+}
+
+/**
+ * @brief Writes R0-R15, or the flags and exception number for VMCU_REG_XPSR.
+ */
+void vmcu_set_reg(Vmcu *vm, unsigned reg, uint32_t value)
+{
+  if (reg < 16)
+  {
+    vm->cpu.R[reg] = value;
+  }
+  else if (reg == VMCU_REG_XPSR)
+  {
+    set_xpsr(&vm->cpu, value);
+    vm->cpu.ipsr = value & 0x3F;
+  }
+}
+
+/**
+ * @brief Copies guest memory to buf, like a debugger read.
+ *
+ * The range must lie inside one RAM or Flash region. Peripheral registers
+ * are not read, since reads can have side effects (popping the UART receive
+ * register, for example); watchpoints and tracing are not triggered.
+ *
+ * @return false if the range is not entirely plain memory.
+ */
+bool vmcu_read_mem(Vmcu *vm, uint32_t addr, void *buf, uint32_t len)
+{
+  Mcu *prev = vmcu_enter(vm);
+  bool ok = mem_read_block(addr, buf, len);
+  mcu = prev;
+  return ok;
+}
+
+/**
+ * @brief Copies buf into guest memory, including Flash.
+ *
+ * Same rules as vmcu_read_mem(): peripheral registers are never written.
+ *
+ * @return false if the range is not entirely plain memory.
+ */
+bool vmcu_write_mem(Vmcu *vm, uint32_t addr, const void *buf, uint32_t len)
+{
+  Mcu *prev = vmcu_enter(vm);
+  bool ok = mem_write_block(addr, buf, len);
+  mcu = prev;
+  return ok;
+}
+
+/**
+ * @brief Marks external interrupt irq pending; it is taken before the next
+ *        instruction once the CPU is in Thread mode.
+ *
+ * @return false if irq is out of range.
+ */
+bool vmcu_set_irq(Vmcu *vm, unsigned irq)
+{
+  if (irq >= NUM_IRQS)
+  {
+    return false;
+  }
+  Mcu *prev = vmcu_enter(vm);
+  nvic_set_pending(irq);
+  mcu = prev;
+  return true;
+}
+
+bool vmcu_set_breakpoint(Vmcu *vm, uint32_t addr, bool enable)
+{
+  Mcu *prev = vmcu_enter(vm);
+  bool ok = enable ? breakpoint_set(addr) : breakpoint_clear(addr);
+  mcu = prev;
+  return ok;
+}
+
+/**
+ * @brief Formats the instance's execution counters as a JSON object.
+ *
+ * The keys are the Mcu_Stats fields; all counters read as 0 in a build with
+ * VMCU_NO_STATS.
+ *
+ * @return Length of the full text; the output is truncated if that is not
+ *         less than len.
+ */
+size_t vmcu_stats_json(Vmcu *vm, char *buf, size_t len)
+{
+  Mcu *prev = vmcu_enter(vm);
+  Mcu_Stats stats;
+  stats_snapshot(&stats);
+  mcu = prev;
+  return stats_json(&stats, buf, len);
+}
+
+void vmcu_stats_reset(Vmcu *vm)
+{
+  Mcu *prev = vmcu_enter(vm);
+  stats_reset();
+  mcu = prev;
+}
+
+void vmcu_set_stack_limit(Vmcu *vm, uint32_t addr)
+{
+  Mcu *prev = vmcu_enter(vm);
+  stack_set_limit(addr);
+  mcu = prev;
+}
+
+/**
+ * @brief Returns the deepest stack use in bytes since the last reset.
+ *
+ * @param exception Exception number (0 = Thread mode), or -1 for the
+ *                  deepest SP in any context.
+ */
+uint32_t vmcu_stack_peak(Vmcu *vm, int exception)
+{
+  if (exception >= VECTOR_TABLE_SIZE)
+  {
+    return 0;
+  }
+  Mcu *prev = vmcu_enter(vm);
+  Stack_Report report;
+  stack_report(&report);
+  mcu = prev;
+  return exception < 0 ? report.max_depth : report.peak[exception];
+}
+
+/**
+ * @brief Starts recording every instruction the instance executes to a
+ *        compressed trace file (see trace_decode()).
+ *
+ * @return false if a trace is already running or the file cannot be created.
+ */
+bool vmcu_trace_start(Vmcu *vm, const char *path)
+{
+  Mcu *prev = vmcu_enter(vm);
+  bool ok = trace_start(path);
+  mcu = prev;
+  return ok;
+}
+
+/**
+ * @brief Ends the trace and waits until the file is complete.
+ *
+ * @return false if no trace was running or writing failed.
+ */
+bool vmcu_trace_stop(Vmcu *vm)
+{
+  Mcu *prev = vmcu_enter(vm);
+  bool ok = trace_stop();
+  mcu = prev;
+  return ok;
+}
+
+/**
+ * @brief Starts collecting instruction and branch coverage of Flash.
+ *
+ * @return false if coverage is already being collected or allocation fails.
+ */
+bool vmcu_coverage_start(Vmcu *vm)
+{
+  Mcu *prev = vmcu_enter(vm);
+  bool ok = coverage_start();
+  mcu = prev;
+  return ok;
+}
+
+/**
+ * @brief Returns the instance's coverage map (see coverage.h for the layout).
+ *
+ * The map stays valid until the instance is destroyed and is up to date
+ * whenever vmcu_run_for() is not running.
+ *
+ * @param words Receives the number of 64-bit words.
+ * @return The map, or NULL if coverage is not being collected.
+ */
+const uint64_t *vmcu_coverage_map(Vmcu *vm, size_t *words)
+{
+  *words = vm->coverage ? vm->coverage->words : 0;
+  return vm->coverage ? vm->coverage->map : NULL;
+}
+
+/**
+ * @brief ORs the map of one instance into a buffer of the same size, for
+ *        combining instances that run the same image.
+ */
+void vmcu_coverage_merge(uint64_t *dst, const uint64_t *src, size_t words)
+{
+  coverage_merge(dst, src, words);
+}
+
+/**
+ * @brief Merges the instance's coverage into a file (created if needed),
+ *        for lcov export with `my_project --lcov`.
+ *
+ * @return false if coverage is not being collected or writing fails.
+ */
+bool vmcu_coverage_save(Vmcu *vm, const char *path)
+{
+  Mcu *prev = vmcu_enter(vm);
+  bool ok = coverage_save(path);
+  mcu = prev;
+  return ok;
+}
+
+/**
+ * @brief Sets the cycles charged for stacking on exception entry and for
+ *        unstacking on return (both 0 after creation).
+ */
+void vmcu_set_exception_cycles(Vmcu *vm, uint32_t entry, uint32_t ret)
+{
+  vm->latency.entry_cycles = entry;
+  vm->latency.return_cycles = ret;
+}
+
+/**
+ * @brief Summarises the entry latency (pending to first handler
+ *        instruction) of one exception number.
+ *
+ * Return is not measured; it costs exactly the `ret` cycles given to
+ * vmcu_set_exception_cycles().
+ *
+ * @return false if the exception was never taken.
+ */
+bool vmcu_exception_latency(Vmcu *vm, unsigned exception, Vmcu_Latency *out)
+{
+  Mcu *prev = vmcu_enter(vm);
+  Latency_Report report = {0};
+  bool ok = exception < VECTOR_TABLE_SIZE && latency_report(exception, &report);
+  mcu = prev;
+  *out = (Vmcu_Latency){report.count, report.mean, report.p50, report.p90, report.p99,
+                        report.p999, report.worst, report.worst_pc};
+  return ok;
+}
+
+void vmcu_latency_reset(Vmcu *vm)
+{
+  Mcu *prev = vmcu_enter(vm);
+  latency_reset();
+  mcu = prev;
+}